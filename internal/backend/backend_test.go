@@ -2,6 +2,9 @@ package backend
 
 import (
 	"context"
+	"errors"
+	"os"
+	"path/filepath"
 	"testing"
 )
 
@@ -149,3 +152,48 @@ func TestShellBackendWithEnv(t *testing.T) {
 		t.Errorf("RunWithEnv() = %q, want %q", result, "test_value\n")
 	}
 }
+
+type mockWorkerClient struct {
+	ctx context.Context
+}
+
+func (w *mockWorkerClient) SendRequest(modelSpec, prompt string, maxTokens int) (string, error) {
+	return "worker response", nil
+}
+
+func (w *mockWorkerClient) SendRequestContext(ctx context.Context, modelSpec, prompt string, maxTokens int) (string, error) {
+	w.ctx = ctx
+	return "worker response", nil
+}
+
+func (w *mockWorkerClient) Close() error {
+	return nil
+}
+
+func TestLlamaBackendContext(t *testing.T) {
+	model := filepath.Join(t.TempDir(), "model.gguf")
+	if err := os.WriteFile(model, nil, 0o644); err != nil {
+		t.Fatal(err)
+	}
+	worker := &mockWorkerClient{}
+	b := NewLlamaBackend(LlamaConfig{WorkerClient: worker})
+
+	// The worker receives the caller's context so it can cancel the request.
+	ctx, cancel := context.WithCancel(context.Background())
+	if _, err := b.Generate(ctx, "hi", model, 8); err != nil {
+		t.Fatalf("Generate() error = %v", err)
+	}
+	if worker.ctx != ctx {
+		t.Error("worker did not receive the request context")
+	}
+
+	// A request whose context is already done never starts.
+	cancel()
+	worker.ctx = nil
+	if _, err := b.Generate(ctx, "hi", model, 8); !errors.Is(err, context.Canceled) {
+		t.Errorf("Generate() error = %v, want context.Canceled", err)
+	}
+	if worker.ctx != nil {
+		t.Error("cancelled request reached the worker")
+	}
+}
@@ -2,6 +2,7 @@ package backend
 
 import (
 	"context"
+	"errors"
 	"fmt"
 	"os"
 	"path/filepath"
@@ -16,10 +17,16 @@ type LlamaBackend struct {
 	models map[string]*llama.Model
 
 	// Worker client for subprocess-based inference (optional).
-	// When set, inference is delegated to a subprocess to avoid
-	// ggml/llama C-level concurrency issues.
+	// When set, inference is delegated to a subprocess.
 	worker WorkerClient
 
+	// parallel is the number of sequences the batching engine decodes
+	// together; <= 1 keeps the serialized path.
+	parallel int
+
+	// load configures model loading and context creation.
+	load llama.LoadOptions
+
 	// Default generation options
 	defaultMaxTokens int
 	defaultTopK      int
@@ -34,6 +41,12 @@ type WorkerClient interface {
 	Close() error
 }
 
+// contextWorkerClient is implemented by worker clients that can cancel a
+// request in flight, such as worker.Client.
+type contextWorkerClient interface {
+	SendRequestContext(ctx context.Context, modelSpec, prompt string, maxTokens int) (string, error)
+}
+
 // LlamaConfig holds configuration for the Llama backend.
 type LlamaConfig struct {
 	// UseSubprocess enables subprocess-based inference for concurrency safety.
@@ -43,6 +56,22 @@ type LlamaConfig struct {
 	// If nil and UseSubprocess is true, a new worker will be created.
 	WorkerClient WorkerClient
 
+	// Parallel starts the continuous-batching engine with this many
+	// sequences for every loaded model, letting concurrent Generate calls
+	// share decode steps instead of queuing on a global lock.
+	Parallel int
+
+	// Load configures context size, batch sizes, thread counts, flash
+	// attention and mmap/mlock for every loaded model. Zero values select
+	// the wrapper defaults.
+	Load llama.LoadOptions
+
+	// ModelBudget bounds, in bytes, the weights of the models the
+	// process keeps loaded: models no backend holds are evicted least
+	// recently used first to stay within it. 0 leaves the process-wide
+	// budget unchanged.
+	ModelBudget uint64
+
 	// Default generation parameters
 	MaxTokens int
 	TopK      int
@@ -76,6 +105,11 @@ func NewLlamaBackend(cfg LlamaConfig) *LlamaBackend {
 	if cfg.WorkerClient != nil {
 		b.worker = cfg.WorkerClient
 	}
+	b.parallel = cfg.Parallel
+	b.load = cfg.Load
+	if cfg.ModelBudget > 0 {
+		llama.SetModelBudget(cfg.ModelBudget)
+	}
 
 	return b
 }
@@ -85,7 +119,9 @@ func (b *LlamaBackend) SetWorker(w WorkerClient) {
 	b.worker = w
 }
 
-// LoadModel loads a GGUF model from the given path.
+// LoadModel returns the model at the given path, acquiring it from the
+// process-wide model registry on first use. The backend holds it until
+// Close.
 func (b *LlamaBackend) LoadModel(modelPath string) (*llama.Model, error) {
 	b.mu.Lock()
 	defer b.mu.Unlock()
@@ -99,24 +135,32 @@ func (b *LlamaBackend) LoadModel(modelPath string) (*llama.Model, error) {
 		return m, nil
 	}
 
-	model, err := llama.LoadModel(abs, 4)
+	model, err := llama.AcquireModel(abs, b.load)
 	if err != nil {
 		return nil, fmt.Errorf("failed to load model %s: %w", abs, err)
 	}
 
+	if b.parallel > 1 && !model.EngineRunning() {
+		if err := model.StartEngine(b.parallel); err != nil {
+			model.Close()
+			return nil, fmt.Errorf("failed to start batching engine for %s: %w", abs, err)
+		}
+	}
+
 	b.models[abs] = model
 	return model, nil
 }
 
-// predictMu serializes in-process Predict calls to avoid C-level concurrency issues.
-var predictMu sync.Mutex
-
-// Generate implements LLMBackend.
+// Generate implements LLMBackend. Generation stops within a token once ctx
+// is done, and ctx.Err() is returned.
 func (b *LlamaBackend) Generate(ctx context.Context, prompt string, model string, maxTokens int) (string, error) {
 	// Validate model path
 	if model == "" {
 		return "", fmt.Errorf("model path is required for llama backend")
 	}
+	if err := ctx.Err(); err != nil {
+		return "", err
+	}
 
 	// Check if file exists
 	if _, err := os.Stat(model); os.IsNotExist(err) {
@@ -125,6 +169,9 @@ func (b *LlamaBackend) Generate(ctx context.Context, prompt string, model string
 
 	// Use worker if available
 	if b.worker != nil {
+		if cw, ok := b.worker.(contextWorkerClient); ok {
+			return cw.SendRequestContext(ctx, model, prompt, maxTokens)
+		}
 		return b.worker.SendRequest(model, prompt, maxTokens)
 	}
 
@@ -139,16 +186,18 @@ func (b *LlamaBackend) Generate(ctx context.Context, prompt string, model string
 		mt = maxTokens
 	}
 
-	// Serialize calls to avoid ggml concurrency issues
-	predictMu.Lock()
-	defer predictMu.Unlock()
-
+	// Concurrent calls each get their own pooled context on the shared
+	// weights, or are batched together by the engine.
 	out, err := m.Predict(prompt, llama.PredictOptions{
 		MaxTokens: mt,
 		TopK:      b.defaultTopK,
 		TopP:      float32(b.defaultTopP),
 		Temp:      float32(b.defaultTemp),
+		Done:      ctx.Done(),
 	})
+	if errors.Is(err, llama.ErrCanceled) {
+		return "", ctx.Err()
+	}
 	if err != nil {
 		return "", fmt.Errorf("prediction failed: %w", err)
 	}
@@ -172,7 +221,11 @@ func (b *LlamaBackend) Close() error {
 		}
 	}
 
-	// Note: llama.Model cleanup would go here if the wrapper supports it
+	// The models go back to the registry, which keeps them loaded for
+	// other users until they are evicted.
+	for _, m := range b.models {
+		m.Close()
+	}
 	b.models = make(map[string]*llama.Model)
 	return nil
 }
@@ -30,6 +30,12 @@ type Options struct {
 
 	// Verbose enables detailed output during compilation.
 	Verbose bool
+
+	// Tokenize, when set, tokenizes the static beginning of local_llm
+	// prompts so the generated program embeds their tokens. When nil, the
+	// llama.cpp vocabularies of the models are used in builds with
+	// `-tags llama`; otherwise all prompts are tokenized at run time.
+	Tokenize generator.TokenizeFunc
 }
 
 // Result contains the results of a successful compilation.
@@ -80,10 +86,13 @@ func CompileFile(inputPath string, opts *Options) (*Result, error) {
 		outputName = strings.TrimSuffix(baseName, filepath.Ext(baseName))
 	}
 
-	// Generate code
+	// Generate code, pre-tokenizing static prompt prefixes
+	tokenize, release := tokenizer(opts)
 	code, err := generator.Generate(wfs, &generator.GenerateOptions{
 		OutputName: outputName,
+		Tokenize:   tokenize,
 	})
+	release()
 	if err != nil {
 		return nil, fmt.Errorf("code generation failed: %w", err)
 	}
@@ -145,10 +154,13 @@ func Compile(wfs []workflow.Workflow, opts *Options) (*Result, error) {
 		}
 	}
 
-	// Generate code
+	// Generate code, pre-tokenizing static prompt prefixes
+	tokenize, release := tokenizer(opts)
 	code, err := generator.Generate(wfs, &generator.GenerateOptions{
 		OutputName: opts.OutputName,
+		Tokenize:   tokenize,
 	})
+	release()
 	if err != nil {
 		return nil, fmt.Errorf("code generation failed: %w", err)
 	}
@@ -0,0 +1,22 @@
+package compiler
+
+import "github.com/LiboWorks/llm-compiler/internal/generator"
+
+// newDefaultTokenizer, when set, returns the tokenizer used for static
+// prompt prefixes when Options.Tokenize is nil, and a function releasing
+// it. It is set by tokenize_llama.go in builds with `-tags llama`; without
+// it the compiler does not need llama.cpp and prompts are tokenized at run
+// time.
+var newDefaultTokenizer func() (generator.TokenizeFunc, func())
+
+// tokenizer returns the tokenizer for opts and a function releasing it;
+// the tokenizer is nil when none is available.
+func tokenizer(opts *Options) (generator.TokenizeFunc, func()) {
+	if opts.Tokenize != nil {
+		return opts.Tokenize, func() {}
+	}
+	if newDefaultTokenizer != nil {
+		return newDefaultTokenizer()
+	}
+	return nil, func() {}
+}
@@ -0,0 +1,48 @@
+//go:build llama
+
+package compiler
+
+import (
+	"fmt"
+
+	"github.com/LiboWorks/llm-compiler/internal/generator"
+	"github.com/LiboWorks/llm-compiler/internal/llama"
+)
+
+func init() {
+	newDefaultTokenizer = func() (generator.TokenizeFunc, func()) {
+		t := newVocabTokenizer()
+		return t.Tokenize, t.Close
+	}
+}
+
+// vocabTokenizer tokenizes prompts for the generator with the vocabularies
+// of the workflow's models, each loaded once without its weights. A model
+// that is not available at compile time leaves its prompts to be tokenized
+// at run time.
+type vocabTokenizer struct {
+	vocabs map[string]*llama.Vocab // nil for models that failed to load
+}
+
+func newVocabTokenizer() *vocabTokenizer {
+	return &vocabTokenizer{vocabs: make(map[string]*llama.Vocab)}
+}
+
+func (t *vocabTokenizer) Tokenize(modelPath, text string, addSpecial bool) ([]int32, error) {
+	v, ok := t.vocabs[modelPath]
+	if !ok {
+		v, _ = llama.LoadVocab(modelPath)
+		t.vocabs[modelPath] = v
+	}
+	if v == nil {
+		return nil, fmt.Errorf("no vocabulary for %s", modelPath)
+	}
+	return v.Tokenize(text, addSpecial)
+}
+
+// Close frees the loaded vocabularies.
+func (t *vocabTokenizer) Close() {
+	for _, v := range t.vocabs {
+		v.Close()
+	}
+}
@@ -17,7 +17,32 @@ type Config struct {
 
 	// Llama settings
 	LlamaModelPath string
-	LlamaThreads   int
+	LlamaThreads   int // 0 = one per physical core
+	LlamaParallel  int // sequences decoded together by the batching engine (<= 1 disables it)
+
+	// Llama context settings (0 / empty = wrapper default)
+	LlamaContextSize  int
+	LlamaBatchSize    int
+	LlamaUBatchSize   int
+	LlamaBatchThreads int    // prefill threads; defaults to LlamaThreads
+	LlamaFlashAttn    string // "on", "off" or "auto"
+	LlamaMmap         bool
+	LlamaMlock        bool
+	LlamaPrefault     bool   // read weights in at load time instead of on first use
+	LlamaHugePages    bool   // back mapped weights with transparent huge pages
+	LlamaCacheTypeK   string // KV cache element types: "f16", "q8_0" or "q4_0"
+	LlamaCacheTypeV   string
+	LlamaStateDir     string // directory for saved prompt KV states; empty disables
+	LlamaStateMaxMB   int    // MiB of saved prompt states kept, least recently used evicted first; 0 = unlimited
+	LlamaDraftModel   string // draft GGUF for speculative decoding; empty disables
+	LlamaDraftTokens  int    // tokens drafted per step (0 = wrapper default)
+	LlamaPromptLookup int    // tokens proposed per step by prompt lookup; 0 disables
+	LlamaCPUs         string // CPUs inference threads are pinned to, e.g. "0-7"; empty = any
+	LlamaSharedPool   bool   // all models compute on one process-wide threadpool
+	LlamaNuma         string // NUMA placement: "distribute", "isolate" or "replicate"; empty = none
+	LlamaModelBudget  int    // MiB of model weights kept loaded; 0 = unlimited
+	LlamaContextShift bool   // evict old tokens when a generation fills its context
+	LlamaSinkTokens   int    // leading tokens kept by context shifting (0 = wrapper default)
 
 	// Runtime settings
 	UseSubprocess  bool
@@ -40,7 +65,9 @@ var (
 const (
 	DefaultOpenAIModel    = "gpt-4"
 	DefaultOpenAIBaseURL  = "https://api.openai.com/v1"
-	DefaultLlamaThreads   = 4
+	DefaultLlamaThreads   = 0
+	DefaultLlamaParallel  = 1
+	DefaultLlamaStateMaxMB = 1024
 	DefaultWorkerTimeout  = 300
 	DefaultMaxRetries     = 3
 	DefaultFmtOutputFile  = "fmt_output.txt"
@@ -73,6 +100,31 @@ func loadFromEnv() *Config {
 		// Llama settings
 		LlamaModelPath: getEnv("LLAMA_MODEL_PATH", ""),
 		LlamaThreads:   getEnvInt("LLAMA_THREADS", DefaultLlamaThreads),
+		LlamaParallel:  getEnvInt("LLAMA_PARALLEL", DefaultLlamaParallel),
+
+		// Llama context settings
+		LlamaContextSize:  getEnvInt("LLAMA_CTX_SIZE", 0),
+		LlamaBatchSize:    getEnvInt("LLAMA_BATCH_SIZE", 0),
+		LlamaUBatchSize:   getEnvInt("LLAMA_UBATCH_SIZE", 0),
+		LlamaBatchThreads: getEnvInt("LLAMA_THREADS_BATCH", 0),
+		LlamaFlashAttn:    getEnv("LLAMA_FLASH_ATTN", "auto"),
+		LlamaMmap:         getEnvBool("LLAMA_MMAP", true),
+		LlamaMlock:        getEnvBool("LLAMA_MLOCK", false),
+		LlamaPrefault:     getEnvBool("LLAMA_PREFAULT", false),
+		LlamaHugePages:    getEnvBool("LLAMA_HUGE_PAGES", false),
+		LlamaCacheTypeK:   getEnv("LLAMA_CACHE_TYPE_K", "f16"),
+		LlamaCacheTypeV:   getEnv("LLAMA_CACHE_TYPE_V", "f16"),
+		LlamaStateDir:     getEnv("LLAMA_STATE_DIR", ""),
+		LlamaStateMaxMB:   getEnvInt("LLAMA_STATE_MAX_MB", DefaultLlamaStateMaxMB),
+		LlamaDraftModel:   getEnv("LLAMA_DRAFT_MODEL", ""),
+		LlamaDraftTokens:  getEnvInt("LLAMA_DRAFT_TOKENS", 0),
+		LlamaPromptLookup: getEnvInt("LLAMA_PROMPT_LOOKUP", 0),
+		LlamaCPUs:         getEnv("LLAMA_CPUS", ""),
+		LlamaSharedPool:   getEnvBool("LLAMA_SHARED_THREADPOOL", false),
+		LlamaNuma:         getEnv("LLAMA_NUMA", ""),
+		LlamaModelBudget:  getEnvInt("LLAMA_MODEL_BUDGET_MB", 0),
+		LlamaContextShift: getEnvBool("LLAMA_CONTEXT_SHIFT", false),
+		LlamaSinkTokens:   getEnvInt("LLAMA_SINK_TOKENS", 0),
 
 		// Runtime settings
 		UseSubprocess: getEnvBool("LLMC_SUBPROCESS", false),
@@ -94,6 +146,11 @@ func NewConfig() *Config {
 		OpenAIBaseURL:   DefaultOpenAIBaseURL,
 		OpenAIModel:     DefaultOpenAIModel,
 		LlamaThreads:    DefaultLlamaThreads,
+		LlamaParallel:   DefaultLlamaParallel,
+		LlamaFlashAttn:  "auto",
+		LlamaMmap:       true,
+		LlamaCacheTypeK: "f16",
+		LlamaCacheTypeV: "f16",
 		WorkerTimeout:   DefaultWorkerTimeout,
 		MaxRetries:      DefaultMaxRetries,
 		FmtOutputFile:   DefaultFmtOutputFile,
@@ -25,6 +25,10 @@ func TestGetConfig(t *testing.T) {
 		t.Errorf("expected default llama threads %d, got %d", config.DefaultLlamaThreads, cfg.LlamaThreads)
 	}
 
+	if cfg.LlamaParallel != config.DefaultLlamaParallel {
+		t.Errorf("expected default llama parallel %d, got %d", config.DefaultLlamaParallel, cfg.LlamaParallel)
+	}
+
 	if cfg.FmtOutputFile != config.DefaultFmtOutputFile {
 		t.Errorf("expected default fmt output file %q, got %q", config.DefaultFmtOutputFile, cfg.FmtOutputFile)
 	}
@@ -37,10 +41,20 @@ func TestConfigFromEnv(t *testing.T) {
 	os.Setenv("LLMC_VERBOSE", "true")
 	os.Setenv("LLMC_DEBUG", "1")
 	os.Setenv("LLMC_SUBPROCESS", "1")
+	os.Setenv("LLAMA_PARALLEL", "8")
+	os.Setenv("LLAMA_CTX_SIZE", "8192")
+	os.Setenv("LLAMA_MMAP", "false")
+	os.Setenv("LLAMA_STATE_DIR", "/tmp/llmc-state")
+	os.Setenv("LLAMA_STATE_MAX_MB", "256")
 	defer func() {
 		os.Unsetenv("LLMC_VERBOSE")
 		os.Unsetenv("LLMC_DEBUG")
 		os.Unsetenv("LLMC_SUBPROCESS")
+		os.Unsetenv("LLAMA_PARALLEL")
+		os.Unsetenv("LLAMA_CTX_SIZE")
+		os.Unsetenv("LLAMA_MMAP")
+		os.Unsetenv("LLAMA_STATE_DIR")
+		os.Unsetenv("LLAMA_STATE_MAX_MB")
 	}()
 
 	cfg := config.Get()
@@ -56,6 +70,26 @@ func TestConfigFromEnv(t *testing.T) {
 	if !cfg.UseSubprocess {
 		t.Error("expected UseSubprocess to be true")
 	}
+
+	if cfg.LlamaParallel != 8 {
+		t.Errorf("expected LlamaParallel 8, got %d", cfg.LlamaParallel)
+	}
+
+	if cfg.LlamaContextSize != 8192 {
+		t.Errorf("expected LlamaContextSize 8192, got %d", cfg.LlamaContextSize)
+	}
+
+	if cfg.LlamaMmap {
+		t.Error("expected LlamaMmap to be false")
+	}
+
+	if cfg.LlamaStateDir != "/tmp/llmc-state" {
+		t.Errorf("expected LlamaStateDir /tmp/llmc-state, got %q", cfg.LlamaStateDir)
+	}
+
+	if cfg.LlamaStateMaxMB != 256 {
+		t.Errorf("expected LlamaStateMaxMB 256, got %d", cfg.LlamaStateMaxMB)
+	}
 }
 
 func TestNewConfigBuilder(t *testing.T) {
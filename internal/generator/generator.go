@@ -2,6 +2,7 @@ package generator
 
 import (
 	"fmt"
+	"slices"
 	"strconv"
 	"strings"
 	"unicode"
@@ -42,6 +43,96 @@ type GenerateOptions struct {
 	// OutputName is used for the JSON output filename (e.g., "example" -> "example_run.json")
 	// If empty, defaults to "contexts_and_signals"
 	OutputName string
+
+	// Tokenize, when set, tokenizes text with the vocabulary of the model
+	// at modelPath, adding BOS/EOS when addSpecial is set. The static
+	// beginning of every local_llm prompt is then tokenized here and
+	// embedded in the program, which only tokenizes the rendered rest.
+	Tokenize TokenizeFunc
+}
+
+// TokenizeFunc tokenizes text for the model at modelPath.
+type TokenizeFunc func(modelPath, text string, addSpecial bool) ([]int32, error)
+
+// promptPrefix returns the static beginning of step's prompt and its tokens
+// for the step's model, or "" when nothing can be tokenized ahead of time.
+// The prefix stops short of the whitespace before the first template
+// action, where tokenizers split words anyway. It is only used if
+// tokenizing it and the remaining template separately gives the same tokens
+// as tokenizing the whole template, i.e. if the split does not change how
+// the prompt is tokenized.
+func promptPrefix(step workflow.WorkflowStep, tokenize TokenizeFunc) (string, []int32) {
+	static := step.Prompt
+	if i := strings.Index(static, "{{"); i >= 0 {
+		static = strings.TrimRightFunc(static[:i], unicode.IsSpace)
+	}
+	if static == "" {
+		return "", nil
+	}
+	prefix, err := tokenize(step.Model, static, true)
+	if err != nil || len(prefix) == 0 {
+		return "", nil
+	}
+	whole, err := tokenize(step.Model, step.Prompt, true)
+	if err != nil {
+		return "", nil
+	}
+	rest, err := tokenize(step.Model, step.Prompt[len(static):], false)
+	if err != nil || !slices.Equal(whole, append(slices.Clip(prefix), rest...)) {
+		return "", nil
+	}
+	return static, prefix
+}
+
+// localLLMOptionsLiteral returns a runtime.LocalLLMOptions composite literal
+// for the per-step options of a local_llm step, or "" when the step sets
+// none and the plain Generate call suffices. A JSON schema is converted to
+// its grammar here, so the generated program embeds the grammar text, and
+// with a tokenizer the prompt's static prefix is embedded as tokens.
+func localLLMOptionsLiteral(step workflow.WorkflowStep, tokenize TokenizeFunc) (string, error) {
+	var fields []string
+	if step.KVCacheType != "" {
+		fields = append(fields, fmt.Sprintf("KVCacheType: %q", step.KVCacheType))
+	}
+	if step.DraftModel != "" {
+		fields = append(fields, fmt.Sprintf("DraftModel: %q", step.DraftModel))
+		if step.DraftTokens > 0 {
+			fields = append(fields, fmt.Sprintf("DraftTokens: %d", step.DraftTokens))
+		}
+	}
+	if step.PromptLookup > 0 {
+		fields = append(fields, fmt.Sprintf("PromptLookup: %d", step.PromptLookup))
+	}
+	if len(step.Stop) > 0 {
+		quoted := make([]string, len(step.Stop))
+		for i, s := range step.Stop {
+			quoted[i] = strconv.Quote(s)
+		}
+		fields = append(fields, "Stop: []string{"+strings.Join(quoted, ", ")+"}")
+	}
+	gbnf, err := step.GBNF()
+	if err != nil {
+		return "", err
+	}
+	if gbnf != "" {
+		fields = append(fields, fmt.Sprintf("Grammar: %q", gbnf))
+	}
+	if step.N > 1 {
+		fields = append(fields, fmt.Sprintf("N: %d", step.N))
+	}
+	if tokenize != nil {
+		if text, tokens := promptPrefix(step, tokenize); len(tokens) > 0 {
+			ids := make([]string, len(tokens))
+			for i, t := range tokens {
+				ids[i] = strconv.Itoa(int(t))
+			}
+			fields = append(fields, fmt.Sprintf("Prefix: &runtime.PromptPrefix{Text: %q, Tokens: []int32{%s}}", text, strings.Join(ids, ", ")))
+		}
+	}
+	if len(fields) == 0 {
+		return "", nil
+	}
+	return "runtime.LocalLLMOptions{MaxTokens: maxTokens, " + strings.Join(fields, ", ") + "}", nil
 }
 
 // Generate builds a single Go program that runs one or more workflows in
@@ -201,7 +292,7 @@ func main() {
 	needLocalLlama := false
 	for _, wf := range wfs {
 		for _, step := range wf.Steps {
-			if step.Type == "local_llm" {
+			if step.Type == "local_llm" || step.Type == "embed" {
 				needLocalLlama = true
 				break
 			}
@@ -226,6 +317,8 @@ func main() {
 		hasShell := false
 		hasLLM := false
 		hasLocal := false
+		hasEmbed := false
+		hasEmbedOutput := false
 		for _, s := range wf.Steps {
 			if s.Type == "shell" || s.Command != "" {
 				hasShell = true
@@ -237,6 +330,11 @@ func main() {
 				hasLLM = true
 				hasLocal = true
 			}
+			if s.Type == "embed" {
+				hasEmbed = true
+				hasEmbedOutput = hasEmbedOutput || s.Output != ""
+				hasLocal = true
+			}
 		}
 
 		sb.WriteString(fmt.Sprintf("    // Workflow: %s\n", wf.Name))
@@ -248,8 +346,10 @@ func main() {
 			sb.WriteString("        var result string\n")
 			sb.WriteString("        var maxTokens int\n")
 		}
-		if hasShell || hasLLM {
+		if hasShell || hasLLM || hasEmbedOutput {
 			sb.WriteString("        var out string\n")
+		}
+		if hasShell || hasLLM || hasEmbed {
 			sb.WriteString("        var err error\n")
 		}
 		if hasShell {
@@ -348,17 +448,58 @@ func main() {
 				rendered := varName + "_rendered"
 				sb.WriteString(fmt.Sprintf("            %s, _ := runtime.RenderTemplate(%s, ctx.Vars)\n", rendered, varName))
 				qModel := strconv.Quote(step.Model)
-				sb.WriteString(fmt.Sprintf("            result, err = %s.Generate(%s, %s, maxTokens)\n", runtimeVar, rendered, qModel))
+				stepOpts := ""
+				if runtimeVar == "localLlama" {
+					var err error
+					if stepOpts, err = localLLMOptionsLiteral(step, opts.Tokenize); err != nil {
+						return "", err
+					}
+				}
+				if stepOpts != "" {
+					sb.WriteString(fmt.Sprintf("            result, err = %s.GenerateWithOptions(%s, %s, %s)\n", runtimeVar, rendered, qModel, stepOpts))
+				} else {
+					sb.WriteString(fmt.Sprintf("            result, err = %s.Generate(%s, %s, maxTokens)\n", runtimeVar, rendered, qModel))
+				}
 				sb.WriteString("            if err != nil {\n")
 				sb.WriteString(fmt.Sprintf("                send(%q, signalMsg{Err: err.Error()})\n", stepKey))
 				sb.WriteString("                return\n")
 				sb.WriteString("            }\n")
+				// Candidate arrays (N > 1) carry raw JSON quotes, so they are
+				// sanitized like any other LLM output before shell steps see them.
 				if step.Output != "" {
 					sb.WriteString(fmt.Sprintf("            out = runtime.SanitizeForShell(result)\n            ctx.Set(%q, out)\n", step.Output))
 					sb.WriteString(fmt.Sprintf("            send(%q, signalMsg{Val: out})\n", stepKey))
 				}
 			}
 
+			// Embed steps: render every input, then embed them in one batch
+			if step.Type == "embed" {
+				quoted := make([]string, len(step.Inputs))
+				for i, in := range step.Inputs {
+					quoted[i] = strconv.Quote(in)
+				}
+				varName := sanitizeIdentifier(fmt.Sprintf("inputs_%s_%s", wf.Name, step.Name))
+				sb.WriteString(fmt.Sprintf("            %s := []string{%s}\n", varName, strings.Join(quoted, ", ")))
+				sb.WriteString(fmt.Sprintf("            for i := range %s {\n", varName))
+				sb.WriteString(fmt.Sprintf("                %s[i], _ = runtime.RenderTemplate(%s[i], ctx.Vars)\n", varName, varName))
+				sb.WriteString("            }\n")
+				// Without an output only the error is needed; out is not
+				// declared unless some embed step reads it.
+				dst := "_"
+				if step.Output != "" {
+					dst = "out"
+				}
+				sb.WriteString(fmt.Sprintf("            %s, err = localLlama.EmbedJSON(%s, %s)\n", dst, varName, strconv.Quote(step.Model)))
+				sb.WriteString("            if err != nil {\n")
+				sb.WriteString(fmt.Sprintf("                send(%q, signalMsg{Err: err.Error()})\n", stepKey))
+				sb.WriteString("                return\n")
+				sb.WriteString("            }\n")
+				if step.Output != "" {
+					sb.WriteString(fmt.Sprintf("            ctx.Set(%q, out)\n", step.Output))
+					sb.WriteString(fmt.Sprintf("            send(%q, signalMsg{Val: out})\n", stepKey))
+				}
+			}
+
 			if step.If != "" {
 				sb.WriteString("        }\n")
 			}
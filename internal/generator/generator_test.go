@@ -1,6 +1,7 @@
 package generator
 
 import (
+	"errors"
 	"os"
 	"path/filepath"
 	"strings"
@@ -217,4 +218,298 @@ func TestGenerateLocalLLMWorkflow(t *testing.T) {
 	if !strings.Contains(code, "localLlama") {
 		t.Error("missing local llama handling in generated code")
 	}
+	if strings.Contains(code, "GenerateWithOptions") {
+		t.Error("step without options should use plain Generate")
+	}
+}
+
+func TestGenerateLocalLLMKVCacheType(t *testing.T) {
+	wfs := []workflow.Workflow{
+		{
+			Name: "kv_cache_test",
+			Steps: []workflow.WorkflowStep{
+				{
+					Name:        "generate",
+					Type:        workflow.StepLocalLLM,
+					Prompt:      "Say hello",
+					Model:       "/path/to/model.gguf",
+					KVCacheType: "q8_0",
+				},
+			},
+		},
+	}
+
+	code, err := Generate(wfs, nil)
+	if err != nil {
+		t.Fatalf("Generate() error = %v", err)
+	}
+
+	if !strings.Contains(code, `localLlama.GenerateWithOptions(`) {
+		t.Error("missing GenerateWithOptions call in generated code")
+	}
+	if !strings.Contains(code, `KVCacheType: "q8_0"`) {
+		t.Error("missing kv cache type in generated code")
+	}
+}
+
+func TestGenerateLocalLLMDraftModel(t *testing.T) {
+	wfs := []workflow.Workflow{
+		{
+			Name: "draft_test",
+			Steps: []workflow.WorkflowStep{
+				{
+					Name:        "generate",
+					Type:        workflow.StepLocalLLM,
+					Prompt:      "Say hello",
+					Model:       "/path/to/model.gguf",
+					DraftModel:  "/path/to/draft.gguf",
+					DraftTokens: 6,
+				},
+			},
+		},
+	}
+
+	code, err := Generate(wfs, nil)
+	if err != nil {
+		t.Fatalf("Generate() error = %v", err)
+	}
+
+	if !strings.Contains(code, `DraftModel: "/path/to/draft.gguf", DraftTokens: 6`) {
+		t.Error("missing draft model options in generated code")
+	}
+}
+
+func TestGenerateLocalLLMPromptLookup(t *testing.T) {
+	wfs := []workflow.Workflow{
+		{
+			Name: "lookup_test",
+			Steps: []workflow.WorkflowStep{
+				{
+					Name:         "generate",
+					Type:         workflow.StepLocalLLM,
+					Prompt:       "Say hello",
+					Model:        "/path/to/model.gguf",
+					PromptLookup: 10,
+				},
+			},
+		},
+	}
+
+	code, err := Generate(wfs, nil)
+	if err != nil {
+		t.Fatalf("Generate() error = %v", err)
+	}
+
+	if !strings.Contains(code, `runtime.LocalLLMOptions{MaxTokens: maxTokens, PromptLookup: 10}`) {
+		t.Error("missing prompt lookup option in generated code")
+	}
+}
+
+func TestGenerateLocalLLMJSONSchema(t *testing.T) {
+	wfs := []workflow.Workflow{
+		{
+			Name: "schema_test",
+			Steps: []workflow.WorkflowStep{
+				{
+					Name:       "extract",
+					Type:       workflow.StepLocalLLM,
+					Prompt:     "Extract the answer",
+					Model:      "/path/to/model.gguf",
+					JSONSchema: `{"type": "object", "properties": {"answer": {"type": "boolean"}}, "required": ["answer"]}`,
+				},
+			},
+		},
+	}
+
+	code, err := Generate(wfs, nil)
+	if err != nil {
+		t.Fatalf("Generate() error = %v", err)
+	}
+
+	// The schema is compiled to a grammar at generation time.
+	if !strings.Contains(code, `Grammar: "root ::= \"{\" space root-answer-kv \"}\" space\n`) {
+		t.Error("missing compiled grammar in generated code")
+	}
+	if strings.Contains(code, `"type": "object"`) {
+		t.Error("generated code should embed the grammar, not the schema")
+	}
+}
+
+func TestGenerateLocalLLMStop(t *testing.T) {
+	wfs := []workflow.Workflow{
+		{
+			Name: "stop_test",
+			Steps: []workflow.WorkflowStep{
+				{
+					Name:   "generate",
+					Type:   workflow.StepLocalLLM,
+					Prompt: "Say hello",
+					Model:  "/path/to/model.gguf",
+					Stop:   []string{"\n", "END"},
+				},
+			},
+		},
+	}
+
+	code, err := Generate(wfs, nil)
+	if err != nil {
+		t.Fatalf("Generate() error = %v", err)
+	}
+
+	if !strings.Contains(code, `runtime.LocalLLMOptions{MaxTokens: maxTokens, Stop: []string{"\n", "END"}}`) {
+		t.Error("missing stop option in generated code")
+	}
+}
+
+func TestGenerateLocalLLMCandidates(t *testing.T) {
+	wfs := []workflow.Workflow{
+		{
+			Name: "candidates_test",
+			Steps: []workflow.WorkflowStep{
+				{
+					Name:   "generate",
+					Type:   workflow.StepLocalLLM,
+					Prompt: "Write a title",
+					Model:  "/path/to/model.gguf",
+					N:      4,
+					Output: "titles",
+				},
+			},
+		},
+	}
+
+	code, err := Generate(wfs, nil)
+	if err != nil {
+		t.Fatalf("Generate() error = %v", err)
+	}
+
+	if !strings.Contains(code, `runtime.LocalLLMOptions{MaxTokens: maxTokens, N: 4}`) {
+		t.Error("missing candidate count in generated code")
+	}
+	if !strings.Contains(code, `out = runtime.SanitizeForShell(result)`) {
+		t.Error("candidate array should be sanitized before it reaches shell steps")
+	}
+	if strings.Contains(code, "out = result\n") {
+		t.Error("candidate array stored unsanitized")
+	}
+}
+
+func TestGenerateEmbedStep(t *testing.T) {
+	wfs := []workflow.Workflow{
+		{
+			Name: "embed_test",
+			Steps: []workflow.WorkflowStep{
+				{
+					Name:   "vectors",
+					Type:   workflow.StepEmbed,
+					Model:  "/path/to/embed.gguf",
+					Inputs: []string{"{{title}}", "{{body}}"},
+					Output: "vecs",
+				},
+				{
+					Name:   "warmup",
+					Type:   workflow.StepEmbed,
+					Model:  "/path/to/embed.gguf",
+					Inputs: []string{"hello"},
+				},
+			},
+		},
+	}
+
+	code, err := Generate(wfs, nil)
+	if err != nil {
+		t.Fatalf("Generate() error = %v", err)
+	}
+
+	for _, want := range []string{
+		"localLlama := runtime.NewLocalLlamaRuntime()",
+		`inputs_embed_test_vectors := []string{"{{title}}", "{{body}}"}`,
+		`out, err = localLlama.EmbedJSON(inputs_embed_test_vectors, "/path/to/embed.gguf")`,
+		`ctx.Set("vecs", out)`,
+		`_, err = localLlama.EmbedJSON(inputs_embed_test_warmup, "/path/to/embed.gguf")`,
+	} {
+		if !strings.Contains(code, want) {
+			t.Errorf("generated code missing %q", want)
+		}
+	}
+	if strings.Contains(code, "var maxTokens int") {
+		t.Error("embed-only workflow should not declare LLM variables")
+	}
+}
+
+// byteTokenizer tokenizes text byte by byte after a BOS token of 1.
+func byteTokenizer(modelPath, text string, addSpecial bool) ([]int32, error) {
+	var tokens []int32
+	if addSpecial {
+		tokens = append(tokens, 1)
+	}
+	for _, b := range []byte(text) {
+		tokens = append(tokens, int32(b))
+	}
+	return tokens, nil
+}
+
+func TestGenerateLocalLLMPromptPrefix(t *testing.T) {
+	wfs := []workflow.Workflow{
+		{
+			Name: "prefix_test",
+			Steps: []workflow.WorkflowStep{
+				{
+					Name:   "generate",
+					Type:   workflow.StepLocalLLM,
+					Prompt: "Hi: {{name}}",
+					Model:  "/path/to/model.gguf",
+				},
+			},
+		},
+	}
+
+	code, err := Generate(wfs, &GenerateOptions{Tokenize: byteTokenizer})
+	if err != nil {
+		t.Fatalf("Generate() error = %v", err)
+	}
+
+	// The prefix stops before the space preceding the variable.
+	if !strings.Contains(code, `runtime.LocalLLMOptions{MaxTokens: maxTokens, Prefix: &runtime.PromptPrefix{Text: "Hi:", Tokens: []int32{1, 72, 105, 58}}}`) {
+		t.Error("missing pre-tokenized prompt prefix in generated code")
+	}
+}
+
+func TestGenerateLocalLLMPromptPrefixSkipped(t *testing.T) {
+	wfs := []workflow.Workflow{
+		{
+			Name: "prefix_test",
+			Steps: []workflow.WorkflowStep{
+				{
+					Name:   "generate",
+					Type:   workflow.StepLocalLLM,
+					Prompt: "Hi: {{name}}",
+					Model:  "/path/to/model.gguf",
+				},
+			},
+		},
+	}
+
+	// A tokenizer that merges tokens across the split point: the prefix
+	// would not match how the whole prompt tokenizes.
+	merging := func(modelPath, text string, addSpecial bool) ([]int32, error) {
+		tokens, _ := byteTokenizer(modelPath, strings.ReplaceAll(text, ": ", "_"), addSpecial)
+		return tokens, nil
+	}
+	failing := func(modelPath, text string, addSpecial bool) ([]int32, error) {
+		return nil, errors.New("no vocabulary")
+	}
+
+	for name, tokenize := range map[string]TokenizeFunc{"merging": merging, "failing": failing} {
+		code, err := Generate(wfs, &GenerateOptions{Tokenize: tokenize})
+		if err != nil {
+			t.Fatalf("%s: Generate() error = %v", name, err)
+		}
+		if strings.Contains(code, "PromptPrefix") {
+			t.Errorf("%s: prompt prefix should not be pre-tokenized", name)
+		}
+		if !strings.Contains(code, "localLlama.Generate(") {
+			t.Errorf("%s: expected plain Generate call", name)
+		}
+	}
 }
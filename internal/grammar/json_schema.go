@@ -0,0 +1,479 @@
+// Package grammar converts structured output specifications into GBNF, the
+// grammar format the llama.cpp grammar sampler consumes.
+package grammar
+
+import (
+	"bytes"
+	"encoding/json"
+	"fmt"
+	"regexp"
+	"strconv"
+	"strings"
+)
+
+// Rules every converted schema may reference. They follow JSON syntax with
+// bounded whitespace so a constrained model cannot pad output indefinitely.
+var primitiveRules = map[string]string{
+	"space":         `| " " | "\n" [ \t]{0,20}`,
+	"boolean":       `("true" | "false") space`,
+	"null":          `"null" space`,
+	"integral-part": `[0] | [1-9] [0-9]{0,15}`,
+	"decimal-part":  `[0-9]{1,16}`,
+	"number":        `("-"? integral-part) ("." decimal-part)? ([eE] [-+]? integral-part)? space`,
+	"integer":       `("-"? integral-part) space`,
+	"char":          `[^"\\\x7F\x00-\x1F] | [\\] (["\\bfnrt] | "u" [0-9a-fA-F]{4})`,
+	"string":        `"\"" char* "\"" space`,
+	"value":         `object | array | string | number | boolean | null`,
+	"object":        `"{" space ( string ":" space value ("," space string ":" space value)* )? "}" space`,
+	"array":         `"[" space ( value ("," space value)* )? "]" space`,
+}
+
+// Rules the primitives above depend on.
+var primitiveDeps = map[string][]string{
+	"number":  {"integral-part", "decimal-part"},
+	"integer": {"integral-part"},
+	"string":  {"char"},
+	"value":   {"object", "array", "string", "number", "boolean", "null"},
+	"object":  {"string", "value"},
+	"array":   {"value"},
+}
+
+// Schema keywords that constrain values in ways the converter cannot
+// express; rejecting them beats silently accepting invalid output.
+var unsupportedKeywords = []string{"$ref", "allOf", "not", "pattern", "patternProperties", "if", "dependentSchemas"}
+
+// FromJSONSchema converts a JSON schema into a GBNF grammar whose root rule
+// matches exactly the JSON documents the schema describes. Object
+// properties are emitted in schema order, required ones first; properties
+// beyond those listed are not allowed. Supported keywords are type, const,
+// enum, anyOf/oneOf, properties/required, items/minItems/maxItems and
+// minLength/maxLength.
+func FromJSONSchema(schema []byte) (string, error) {
+	dec := json.NewDecoder(bytes.NewReader(schema))
+	dec.UseNumber()
+	root, err := decodeOrdered(dec)
+	if err != nil {
+		return "", fmt.Errorf("invalid JSON schema: %w", err)
+	}
+	if _, err := dec.Token(); err == nil {
+		return "", fmt.Errorf("invalid JSON schema: trailing data")
+	}
+
+	c := &converter{rules: map[string]string{}}
+	c.add("space", primitiveRules["space"])
+	body, err := c.visit(root, "root")
+	if err != nil {
+		return "", err
+	}
+	c.add("root", body)
+
+	var sb strings.Builder
+	sb.WriteString("root ::= " + c.rules["root"] + "\n")
+	for _, name := range c.order {
+		if name != "root" {
+			sb.WriteString(name + " ::= " + c.rules[name] + "\n")
+		}
+	}
+	return sb.String(), nil
+}
+
+// member is one key of a JSON object; objects keep their key order.
+type member struct {
+	key string
+	val interface{}
+}
+
+type object []member
+
+func (o object) get(key string) (interface{}, bool) {
+	for _, m := range o {
+		if m.key == key {
+			return m.val, true
+		}
+	}
+	return nil, false
+}
+
+// decodeOrdered reads one JSON value, representing objects as object so
+// that property order survives.
+func decodeOrdered(dec *json.Decoder) (interface{}, error) {
+	tok, err := dec.Token()
+	if err != nil {
+		return nil, err
+	}
+	switch t := tok.(type) {
+	case json.Delim:
+		switch t {
+		case '{':
+			var o object
+			for dec.More() {
+				kt, err := dec.Token()
+				if err != nil {
+					return nil, err
+				}
+				v, err := decodeOrdered(dec)
+				if err != nil {
+					return nil, err
+				}
+				o = append(o, member{key: kt.(string), val: v})
+			}
+			_, err := dec.Token()
+			return o, err
+		case '[':
+			a := []interface{}{}
+			for dec.More() {
+				v, err := decodeOrdered(dec)
+				if err != nil {
+					return nil, err
+				}
+				a = append(a, v)
+			}
+			_, err := dec.Token()
+			return a, err
+		}
+		return nil, fmt.Errorf("unexpected %v", t)
+	default:
+		return t, nil
+	}
+}
+
+// encodeJSON renders v compactly, keeping object key order.
+func encodeJSON(v interface{}) string {
+	switch t := v.(type) {
+	case object:
+		parts := make([]string, len(t))
+		for i, m := range t {
+			parts[i] = encodeJSON(m.key) + ":" + encodeJSON(m.val)
+		}
+		return "{" + strings.Join(parts, ",") + "}"
+	case []interface{}:
+		parts := make([]string, len(t))
+		for i, e := range t {
+			parts[i] = encodeJSON(e)
+		}
+		return "[" + strings.Join(parts, ",") + "]"
+	default:
+		b, _ := json.Marshal(t)
+		return string(b)
+	}
+}
+
+// literal quotes s as a GBNF string literal.
+func literal(s string) string {
+	var sb strings.Builder
+	sb.WriteByte('"')
+	for _, r := range s {
+		switch r {
+		case '"', '\\':
+			sb.WriteByte('\\')
+			sb.WriteRune(r)
+		case '\n':
+			sb.WriteString(`\n`)
+		case '\r':
+			sb.WriteString(`\r`)
+		case '\t':
+			sb.WriteString(`\t`)
+		default:
+			sb.WriteRune(r)
+		}
+	}
+	sb.WriteByte('"')
+	return sb.String()
+}
+
+var invalidRuleChars = regexp.MustCompile(`[^a-zA-Z0-9-]+`)
+
+type converter struct {
+	rules map[string]string
+	order []string
+}
+
+// add defines a rule and returns its name. A name already taken by a
+// different body gets a numeric suffix.
+func (c *converter) add(name, body string) string {
+	name = invalidRuleChars.ReplaceAllString(name, "-")
+	key := name
+	for i := 1; ; i++ {
+		existing, ok := c.rules[key]
+		if !ok {
+			break
+		}
+		if existing == body {
+			return key
+		}
+		key = fmt.Sprintf("%s%d", name, i)
+	}
+	c.rules[key] = body
+	c.order = append(c.order, key)
+	return key
+}
+
+// primitive defines a primitive rule with its dependencies.
+func (c *converter) primitive(name string) string {
+	if _, ok := c.rules[name]; ok {
+		return name
+	}
+	c.add(name, primitiveRules[name])
+	for _, dep := range primitiveDeps[name] {
+		c.primitive(dep)
+	}
+	return name
+}
+
+// visit returns a GBNF expression matching the values of schema, adding
+// the rules it needs under names derived from name.
+func (c *converter) visit(schema interface{}, name string) (string, error) {
+	if b, ok := schema.(bool); ok {
+		if !b {
+			return "", fmt.Errorf("schema %s allows no value", name)
+		}
+		return c.primitive("value"), nil
+	}
+	s, ok := schema.(object)
+	if !ok {
+		return "", fmt.Errorf("schema %s must be an object", name)
+	}
+	for _, kw := range unsupportedKeywords {
+		if _, ok := s.get(kw); ok {
+			return "", fmt.Errorf("schema %s: %s is not supported", name, kw)
+		}
+	}
+
+	if v, ok := s.get("const"); ok {
+		return literal(encodeJSON(v)) + " space", nil
+	}
+	if v, ok := s.get("enum"); ok {
+		values, ok := v.([]interface{})
+		if !ok || len(values) == 0 {
+			return "", fmt.Errorf("schema %s: enum must be a non-empty array", name)
+		}
+		alts := make([]string, len(values))
+		for i, e := range values {
+			alts[i] = literal(encodeJSON(e))
+		}
+		return "(" + strings.Join(alts, " | ") + ") space", nil
+	}
+	for _, kw := range []string{"anyOf", "oneOf"} {
+		if v, ok := s.get(kw); ok {
+			subs, ok := v.([]interface{})
+			if !ok || len(subs) == 0 {
+				return "", fmt.Errorf("schema %s: %s must be a non-empty array", name, kw)
+			}
+			return c.alternatives(subs, name)
+		}
+	}
+
+	t, _ := s.get("type")
+	switch t := t.(type) {
+	case nil:
+		if _, ok := s.get("properties"); ok {
+			return c.object(s, name)
+		}
+		if _, ok := s.get("items"); ok {
+			return c.array(s, name)
+		}
+		return c.primitive("value"), nil
+	case []interface{}:
+		subs := make([]interface{}, len(t))
+		for i, ty := range t {
+			sub := object{{key: "type", val: ty}}
+			for _, m := range s {
+				if m.key != "type" {
+					sub = append(sub, m)
+				}
+			}
+			subs[i] = sub
+		}
+		return c.alternatives(subs, name)
+	case string:
+		switch t {
+		case "object":
+			return c.object(s, name)
+		case "array":
+			return c.array(s, name)
+		case "string":
+			return c.str(s, name)
+		case "number", "integer", "boolean", "null":
+			return c.primitive(t), nil
+		}
+		return "", fmt.Errorf("schema %s: unknown type %q", name, t)
+	}
+	return "", fmt.Errorf("schema %s: type must be a string or an array", name)
+}
+
+func (c *converter) alternatives(subs []interface{}, name string) (string, error) {
+	alts := make([]string, len(subs))
+	for i, sub := range subs {
+		body, err := c.visit(sub, fmt.Sprintf("%s-%d", name, i))
+		if err != nil {
+			return "", err
+		}
+		alts[i] = c.add(fmt.Sprintf("%s-%d", name, i), body)
+	}
+	return strings.Join(alts, " | "), nil
+}
+
+func (c *converter) object(s object, name string) (string, error) {
+	pv, ok := s.get("properties")
+	if !ok {
+		return c.primitive("object"), nil
+	}
+	props, ok := pv.(object)
+	if !ok {
+		return "", fmt.Errorf("schema %s: properties must be an object", name)
+	}
+	required := map[string]bool{}
+	if rv, ok := s.get("required"); ok {
+		list, ok := rv.([]interface{})
+		if !ok {
+			return "", fmt.Errorf("schema %s: required must be an array", name)
+		}
+		for _, r := range list {
+			key, _ := r.(string)
+			if _, ok := props.get(key); !ok {
+				return "", fmt.Errorf("schema %s: required property %q is not defined", name, key)
+			}
+			required[key] = true
+		}
+	}
+
+	// One rule per property matching `"key": value`.
+	var req, opt []string
+	for _, p := range props {
+		pname := name + "-" + p.key
+		body, err := c.visit(p.val, pname)
+		if err != nil {
+			return "", err
+		}
+		kv := c.add(pname+"-kv", literal(encodeJSON(p.key))+" space \":\" space "+c.add(pname, body))
+		if required[p.key] {
+			req = append(req, kv)
+		} else {
+			opt = append(opt, kv)
+		}
+	}
+	body := `"{" space`
+	if len(req) > 0 {
+		body += " " + strings.Join(req, ` "," space `)
+	}
+	if len(opt) > 0 {
+		body += " ("
+		if len(req) > 0 {
+			body += ` "," space (`
+		}
+		// Any suffix of the optional properties may start the optional
+		// part; each later one is preceded by its own comma.
+		alts := make([]string, len(opt))
+		for i := range opt {
+			alts[i] = c.optionalChain(opt[i:], false)
+		}
+		body += " " + strings.Join(alts, " | ")
+		if len(req) > 0 {
+			body += " )"
+		}
+		body += " )?"
+	}
+	return body + ` "}" space`, nil
+}
+
+// optionalChain matches kvs[0] (preceded by a comma when it is itself
+// optional) followed by any subset of the remaining optional properties.
+func (c *converter) optionalChain(kvs []string, optional bool) string {
+	res := kvs[0]
+	if optional {
+		res = `( "," space ` + kvs[0] + ` )?`
+	}
+	if len(kvs) > 1 {
+		res += " " + c.add(kvs[0]+"-rest", c.optionalChain(kvs[1:], true))
+	}
+	return res
+}
+
+func (c *converter) array(s object, name string) (string, error) {
+	item := c.primitive("value")
+	if iv, ok := s.get("items"); ok {
+		body, err := c.visit(iv, name+"-item")
+		if err != nil {
+			return "", err
+		}
+		item = c.add(name+"-item", body)
+	}
+	lo, hi, err := bounds(s, "minItems", "maxItems", name)
+	if err != nil {
+		return "", err
+	}
+	if hi == 0 {
+		return `"[" space "]" space`, nil
+	}
+	// item ("," item){lo-1,hi-1}, optional as a whole when lo == 0.
+	seq := item
+	if hi != 1 {
+		seq += ` ("," space ` + item + `)` + repeat(max(lo-1, 0), hi-1)
+	}
+	if lo == 0 {
+		seq = "(" + seq + ")?"
+	}
+	return `"[" space ` + seq + ` "]" space`, nil
+}
+
+func (c *converter) str(s object, name string) (string, error) {
+	lo, hi, err := bounds(s, "minLength", "maxLength", name)
+	if err != nil {
+		return "", err
+	}
+	if lo == 0 && hi < 0 {
+		return c.primitive("string"), nil
+	}
+	if hi == 0 {
+		return `"\"\"" space`, nil
+	}
+	c.primitive("char")
+	return `"\"" char` + repeat(lo, hi) + ` "\"" space`, nil
+}
+
+// bounds reads a min/max keyword pair; hi is -1 when unbounded.
+func bounds(s object, minKey, maxKey, name string) (lo, hi int, err error) {
+	lo, hi = 0, -1
+	if v, ok := s.get(minKey); ok {
+		if lo, err = nonNegative(v); err != nil {
+			return 0, 0, fmt.Errorf("schema %s: %s %w", name, minKey, err)
+		}
+	}
+	if v, ok := s.get(maxKey); ok {
+		if hi, err = nonNegative(v); err != nil {
+			return 0, 0, fmt.Errorf("schema %s: %s %w", name, maxKey, err)
+		}
+		if hi < lo {
+			return 0, 0, fmt.Errorf("schema %s: %s is below %s", name, maxKey, minKey)
+		}
+	}
+	return lo, hi, nil
+}
+
+func nonNegative(v interface{}) (int, error) {
+	n, ok := v.(json.Number)
+	if !ok {
+		return 0, fmt.Errorf("must be a number")
+	}
+	i, err := strconv.Atoi(n.String())
+	if err != nil || i < 0 {
+		return 0, fmt.Errorf("must be a non-negative integer")
+	}
+	return i, nil
+}
+
+// repeat renders a GBNF repetition suffix for lo..hi occurrences (hi < 0
+// is unbounded).
+func repeat(lo, hi int) string {
+	switch {
+	case hi < 0 && lo == 0:
+		return "*"
+	case hi < 0 && lo == 1:
+		return "+"
+	case hi < 0:
+		return fmt.Sprintf("{%d,}", lo)
+	case lo == hi:
+		return fmt.Sprintf("{%d}", lo)
+	}
+	return fmt.Sprintf("{%d,%d}", lo, hi)
+}
@@ -0,0 +1,82 @@
+package grammar_test
+
+import (
+	"strings"
+	"testing"
+
+	"github.com/LiboWorks/llm-compiler/internal/grammar"
+)
+
+func TestFromJSONSchemaObject(t *testing.T) {
+	schema := `{
+		"type": "object",
+		"properties": {
+			"name": {"type": "string", "maxLength": 20},
+			"age": {"type": "integer"},
+			"tags": {"type": "array", "items": {"enum": ["a", "b"]}, "maxItems": 3}
+		},
+		"required": ["name", "age"]
+	}`
+
+	g, err := grammar.FromJSONSchema([]byte(schema))
+	if err != nil {
+		t.Fatalf("FromJSONSchema() error = %v", err)
+	}
+
+	want := []string{
+		`root ::= "{" space root-name-kv "," space root-age-kv ( "," space ( root-tags-kv ) )? "}" space`,
+		`root-name ::= "\"" char{0,20} "\"" space`,
+		`root-name-kv ::= "\"name\"" space ":" space root-name`,
+		`root-age ::= integer`,
+		`root-tags-item ::= ("\"a\"" | "\"b\"") space`,
+		`root-tags ::= "[" space (root-tags-item ("," space root-tags-item){0,2})? "]" space`,
+	}
+	for _, line := range want {
+		if !strings.Contains(g, line+"\n") {
+			t.Errorf("grammar missing %q:\n%s", line, g)
+		}
+	}
+	if !strings.HasPrefix(g, "root ::= ") {
+		t.Errorf("grammar should start with the root rule:\n%s", g)
+	}
+}
+
+func TestFromJSONSchemaOptionalProperties(t *testing.T) {
+	g, err := grammar.FromJSONSchema([]byte(`{"properties": {"a": {"const": 1}, "b": {"type": "boolean"}}}`))
+	if err != nil {
+		t.Fatalf("FromJSONSchema() error = %v", err)
+	}
+
+	// Either property may come first, and a comma only precedes a
+	// property that follows another one.
+	for _, line := range []string{
+		`root ::= "{" space ( root-a-kv root-a-kv-rest | root-b-kv )? "}" space`,
+		`root-a-kv-rest ::= ( "," space root-b-kv )?`,
+		`root-a ::= "1" space`,
+	} {
+		if !strings.Contains(g, line+"\n") {
+			t.Errorf("grammar missing %q:\n%s", line, g)
+		}
+	}
+}
+
+func TestFromJSONSchemaErrors(t *testing.T) {
+	tests := []struct {
+		name   string
+		schema string
+	}{
+		{"invalid json", `{"type": `},
+		{"unsupported keyword", `{"$ref": "#/definitions/x"}`},
+		{"unknown type", `{"type": "date"}`},
+		{"undefined required", `{"properties": {"a": {}}, "required": ["b"]}`},
+		{"bad bounds", `{"type": "string", "minLength": 3, "maxLength": 1}`},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			if _, err := grammar.FromJSONSchema([]byte(tt.schema)); err == nil {
+				t.Errorf("FromJSONSchema(%s) should fail", tt.schema)
+			}
+		})
+	}
+}
@@ -17,12 +17,17 @@ import "C"
 
 import (
 	"errors"
+	"fmt"
 	"runtime"
+	"strings"
+	"time"
+	"unicode/utf8"
 	"unsafe"
 )
 
 type Model struct {
-	h *C.LlamaModelHandle
+	h          *C.LlamaModelHandle
+	registered bool // acquired from the registry (AcquireModel)
 }
 
 // PredictOptions controls generation
@@ -31,30 +36,592 @@ type PredictOptions struct {
 	Temp      float32
 	TopK      int
 	TopP      float32
+	// PromptLookup enables speculative decoding without a draft model:
+	// each step proposes up to PromptLookup tokens copied from where the
+	// latest n-gram last occurred in the prompt or output (0 = off).
+	// Output is unchanged; text that quotes the prompt decodes faster.
+	PromptLookup int
+	// Grammar is a GBNF grammar with a "root" rule the output must match
+	// (see grammar.FromJSONSchema). Generation stops when the model ends
+	// a complete match, or once the match cannot grow. Empty leaves the
+	// output unconstrained.
+	Grammar string
+	// Stop ends generation as soon as the output contains any of these
+	// strings; the output is cut right before the match.
+	Stop []string
+	// PrefixTokens are the tokens of the first PrefixLen bytes of the
+	// prompt, tokenized ahead of time with Vocab.Tokenize (including BOS).
+	// Only the rest of the prompt is tokenized per call. The caller must
+	// make sure they belong to the prompt and the model.
+	PrefixTokens []int32
+	PrefixLen    int
+	// Done cancels the call when closed, typically ctx.Done(): generation
+	// stops before its next decode step (a running decode is aborted) and
+	// the call fails with ErrCanceled.
+	Done <-chan struct{}
 }
 
-// Note: we currently use the non-streaming C API (llama_predict) provided by the
-// wrapper. If streaming is added, define and export a Go callback matching
-// the C signature (llama_stream_callback) and ensure the cgo preamble and
-// build flags are correct.
+// ErrCanceled is returned by predictions stopped through
+// PredictOptions.Done.
+var ErrCanceled = errors.New("prediction canceled")
+
+// predictError is the error of a prediction the wrapper failed.
+func (opts PredictOptions) predictError() error {
+	select {
+	case <-opts.Done:
+		return ErrCanceled
+	default:
+		return errors.New("prediction failed")
+	}
+}
+
+// cParams converts opts to the wrapper's per-request parameters. The
+// returned function frees the C strings they point to.
+func (opts PredictOptions) cParams() (C.LlamaPredictParams, func()) {
+	p := C.llama_predict_params_default()
+	p.max_tokens = C.int(opts.MaxTokens)
+	p.temp = C.float(opts.Temp)
+	p.top_k = C.int(opts.TopK)
+	p.top_p = C.float(opts.TopP)
+	p.n_lookup = C.int(opts.PromptLookup)
+
+	var allocs []unsafe.Pointer
+	if opts.Grammar != "" {
+		p.grammar = C.CString(opts.Grammar)
+		allocs = append(allocs, unsafe.Pointer(p.grammar))
+	}
+	if n := len(opts.PrefixTokens); n > 0 {
+		// Like the strings, the tokens are referenced from p and must not
+		// live in Go memory.
+		toks := unsafe.Slice((*C.int32_t)(C.malloc(C.size_t(n)*C.size_t(unsafe.Sizeof(C.int32_t(0))))), n)
+		for i, t := range opts.PrefixTokens {
+			toks[i] = C.int32_t(t)
+		}
+		allocs = append(allocs, unsafe.Pointer(&toks[0]))
+		p.prefix_tokens = &toks[0]
+		p.n_prefix_tokens = C.int(n)
+		p.prefix_len = C.int(opts.PrefixLen)
+	}
+	var freeStop func()
+	if len(opts.Stop) > 0 {
+		p.stop, freeStop = cStrings(opts.Stop)
+		p.n_stop = C.int(len(opts.Stop))
+	}
+	var flag *C.LlamaCancelFlag
+	var stopWatch func()
+	if opts.Done != nil {
+		flag = C.llama_cancel_flag_new()
+		p.cancel = flag
+		stopWatch = watchDone(opts.Done, flag)
+	}
+	return p, func() {
+		for _, a := range allocs {
+			C.free(a)
+		}
+		if freeStop != nil {
+			freeStop()
+		}
+		if stopWatch != nil {
+			stopWatch()
+			C.llama_cancel_flag_free(flag)
+		}
+	}
+}
+
+// watchDone sets flag once done is closed. The returned function ends the
+// watch; after it returns the flag is no longer touched and may be freed.
+func watchDone(done <-chan struct{}, flag *C.LlamaCancelFlag) func() {
+	stop := make(chan struct{})
+	exited := make(chan struct{})
+	go func() {
+		defer close(exited)
+		select {
+		case <-done:
+			C.llama_cancel_flag_set(flag)
+		case <-stop:
+		}
+	}()
+	return func() {
+		close(stop)
+		<-exited
+	}
+}
+
+// cStrings copies ss (which must not be empty) into a C array of C
+// strings. The array holds pointers, so it must live in C memory. The
+// returned function frees the array and the strings.
+func cStrings(ss []string) (**C.char, func()) {
+	arr := unsafe.Slice((**C.char)(C.malloc(C.size_t(len(ss))*C.size_t(unsafe.Sizeof((*C.char)(nil))))), len(ss))
+	for i, s := range ss {
+		arr[i] = C.CString(s)
+	}
+	return &arr[0], func() {
+		for _, s := range arr {
+			C.free(unsafe.Pointer(s))
+		}
+		C.free(unsafe.Pointer(&arr[0]))
+	}
+}
+
+// FlashAttnMode selects whether contexts use flash attention.
+type FlashAttnMode int
+
+const (
+	FlashAttnAuto FlashAttnMode = iota // let llama.cpp decide
+	FlashAttnOn
+	FlashAttnOff
+)
+
+// ParseFlashAttn maps "on"/"off" (or boolean spellings) to a mode; anything
+// else selects FlashAttnAuto.
+func ParseFlashAttn(s string) FlashAttnMode {
+	switch strings.ToLower(strings.TrimSpace(s)) {
+	case "on", "1", "true", "enabled":
+		return FlashAttnOn
+	case "off", "0", "false", "disabled":
+		return FlashAttnOff
+	}
+	return FlashAttnAuto
+}
+
+// KVCacheType is the element type of the KV cache: "f16" (default), "q8_0"
+// or "q4_0". Quantized caches fit more tokens and sequences in RAM; a
+// quantized V cache requires flash attention.
+type KVCacheType string
+
+const (
+	KVCacheF16  KVCacheType = "f16"
+	KVCacheQ8_0 KVCacheType = "q8_0"
+	KVCacheQ4_0 KVCacheType = "q4_0"
+)
+
+// ParseKVCacheType validates s as a KV cache type. An empty string selects
+// KVCacheF16.
+func ParseKVCacheType(s string) (KVCacheType, error) {
+	switch t := KVCacheType(strings.ToLower(strings.TrimSpace(s))); t {
+	case "":
+		return KVCacheF16, nil
+	case KVCacheF16, KVCacheQ8_0, KVCacheQ4_0:
+		return t, nil
+	}
+	return "", fmt.Errorf("unsupported KV cache type %q (want f16, q8_0 or q4_0)", s)
+}
+
+func (t KVCacheType) cType() C.LlamaKVCacheType {
+	switch t {
+	case KVCacheQ8_0:
+		return C.LLAMA_KV_CACHE_Q8_0
+	case KVCacheQ4_0:
+		return C.LLAMA_KV_CACHE_Q4_0
+	}
+	return C.LLAMA_KV_CACHE_F16
+}
+
+// NumaStrategy selects how a model is placed on a NUMA host: "distribute"
+// spreads compute threads over all nodes, "isolate" keeps them on the
+// starting node, and "replicate" loads a private copy of the weights on one
+// node (LoadOptions.NumaNode) whose contexts compute there. Distribute and
+// isolate apply to the whole process.
+type NumaStrategy string
+
+const (
+	NumaNone       NumaStrategy = ""
+	NumaDistribute NumaStrategy = "distribute"
+	NumaIsolate    NumaStrategy = "isolate"
+	NumaReplicate  NumaStrategy = "replicate"
+)
+
+// ParseNumaStrategy validates s as a NUMA strategy. An empty string or
+// "none" selects NumaNone.
+func ParseNumaStrategy(s string) (NumaStrategy, error) {
+	switch t := NumaStrategy(strings.ToLower(strings.TrimSpace(s))); t {
+	case "none":
+		return NumaNone, nil
+	case NumaNone, NumaDistribute, NumaIsolate, NumaReplicate:
+		return t, nil
+	}
+	return "", fmt.Errorf("unsupported NUMA strategy %q (want distribute, isolate or replicate)", s)
+}
+
+func (t NumaStrategy) cType() C.LlamaNumaStrategy {
+	switch t {
+	case NumaDistribute:
+		return C.LLAMA_NUMA_DISTRIBUTE
+	case NumaIsolate:
+		return C.LLAMA_NUMA_ISOLATE
+	case NumaReplicate:
+		return C.LLAMA_NUMA_REPLICATE
+	}
+	return C.LLAMA_NUMA_NONE
+}
+
+// NumaNodes returns the number of NUMA nodes with CPUs (1 on hosts that are
+// not NUMA).
+func NumaNodes() int {
+	return int(C.llama_numa_nodes())
+}
+
+// NumaNodeCPUs returns the CPU list of node in the form Threadpool accepts,
+// or "" when the host does not report its topology.
+func NumaNodeCPUs(node int) string {
+	n := C.llama_numa_node_cpus(C.int(node), nil, 0)
+	if n <= 0 {
+		return ""
+	}
+	buf := make([]byte, int(n)+1)
+	C.llama_numa_node_cpus(C.int(node), (*C.char)(unsafe.Pointer(&buf[0])), C.int(len(buf)))
+	return string(buf[:n])
+}
+
+// LoadOptions configures how a model is loaded and how its contexts are
+// created. Zero values select the wrapper defaults.
+type LoadOptions struct {
+	ContextSize  int // context length per sequence (default 2048)
+	BatchSize    int // prompt tokens per decode call (default 512)
+	UBatchSize   int // physical micro-batch size (default 512)
+	Threads      int // threads used while generating (default: physical cores)
+	BatchThreads int // threads used for prompt prefill (default Threads)
+	FlashAttn    FlashAttnMode
+	NoMmap       bool // read the model into memory instead of mapping it
+	Mlock        bool // lock model memory so it is never paged out
+	Prefault     bool // read all weights in at load time instead of on first use
+	HugePages    bool // back mapped weights with transparent huge pages
+	CacheTypeK   KVCacheType
+	CacheTypeV   KVCacheType
+	// DraftModel pairs the model with a small draft GGUF sharing its
+	// vocabulary for speculative decoding; DraftTokens is how many tokens
+	// it proposes per step (default 8).
+	DraftModel  string
+	DraftTokens int
+	// Threadpool makes every context of the model compute on a shared
+	// pool instead of threads of its own; the pool's Threads and
+	// BatchThreads then replace the ones above.
+	Threadpool *Threadpool
+	// Numa places the model on a NUMA host; with NumaReplicate the copy
+	// lives on NumaNode and, without a Threadpool, computes on a pool of
+	// that node's cores.
+	Numa     NumaStrategy
+	NumaNode int
+	// ContextShift lets a generation that fills its context go on: the
+	// first SinkTokens tokens (default 4) stay and the older half of the
+	// rest is evicted, so memory stays bounded however long it runs.
+	ContextShift bool
+	SinkTokens   int
+}
+
+// DefaultThreads returns the physical cores the process may run on, the
+// thread count used when none is given.
+func DefaultThreads() int {
+	return int(C.llama_default_threads())
+}
+
+// ThreadpoolOptions configures a Threadpool.
+type ThreadpoolOptions struct {
+	Threads      int    // workers per generation step (0 = one per physical core of CPUs, or of the host)
+	BatchThreads int    // workers per prompt prefill (0 = Threads)
+	CPUs         string // CPUs the workers are pinned to, e.g. "0-7,16" (empty = any)
+	Poll         int    // busy-wait level 0-100 before a worker sleeps (0 = default)
+}
+
+// Threadpool keeps the compute threads of every model loaded with it on
+// one CPU set without oversubscribing it. The set's cores are split into
+// lanes of Threads cores; each decode runs on a free lane, so up to
+// cores/Threads contexts decode at once and further decodes wait. Pin pools
+// to disjoint CPUs to keep models, or inference and other work, off each
+// other's cores.
+type Threadpool struct {
+	p *C.LlamaThreadpool
+}
+
+// NewThreadpool starts a threadpool configured by opts.
+func NewThreadpool(opts ThreadpoolOptions) (*Threadpool, error) {
+	params := C.llama_threadpool_params_default()
+	params.n_threads = C.int(opts.Threads)
+	params.n_threads_batch = C.int(opts.BatchThreads)
+	if opts.CPUs != "" {
+		ccpus := C.CString(opts.CPUs)
+		defer C.free(unsafe.Pointer(ccpus))
+		params.cpus = ccpus
+	}
+	if opts.Poll > 0 {
+		params.poll = C.int(opts.Poll)
+	}
+	p := C.llama_threadpool_new(&params)
+	if p == nil {
+		return nil, fmt.Errorf("failed to create threadpool (threads %d/%d, cpus %q)", opts.Threads, opts.BatchThreads, opts.CPUs)
+	}
+	tp := &Threadpool{p: p}
+	runtime.SetFinalizer(tp, func(tp *Threadpool) { tp.Close() })
+	return tp, nil
+}
+
+// Threads returns the number of workers a generation step runs on.
+func (tp *Threadpool) Threads() int {
+	if tp == nil || tp.p == nil {
+		return 0
+	}
+	return int(C.llama_threadpool_threads(tp.p))
+}
+
+// BatchThreads returns the number of workers a prompt prefill runs on.
+func (tp *Threadpool) BatchThreads() int {
+	if tp == nil || tp.p == nil {
+		return 0
+	}
+	return int(C.llama_threadpool_batch_threads(tp.p))
+}
+
+// Close releases the caller's reference to the pool. Its threads keep
+// running until every model loaded with it is closed as well.
+func (tp *Threadpool) Close() {
+	if tp == nil || tp.p == nil {
+		return
+	}
+	C.llama_threadpool_free(tp.p)
+	tp.p = nil
+}
 
 // LoadModel loads a GGUF model at modelPath and returns a Model.
-// nThreads sets how many CPU threads to use (0 = default).
+// nThreads sets how many CPU threads to use (0 = one per physical core).
 func LoadModel(modelPath string, nThreads int) (*Model, error) {
+	return LoadModelWithOptions(modelPath, LoadOptions{Threads: nThreads})
+}
+
+// LoadModelWithOptions loads a GGUF model at modelPath using opts.
+func LoadModelWithOptions(modelPath string, opts LoadOptions) (*Model, error) {
 	cpath := C.CString(modelPath)
 	defer C.free(unsafe.Pointer(cpath))
 
-	h := C.llama_load_model(cpath, C.int(nThreads))
+	params := opts.cParams()
+	h := C.llama_load_model_ex(cpath, &params)
+	runtime.KeepAlive(opts.Threadpool)
 	if h == nil {
 		return nil, errors.New("failed to load model (see llama_wrapper.c for details)")
 	}
 	m := &Model{h: h}
 	// Make sure finalizer closes model if GC collects it
 	runtime.SetFinalizer(m, func(m *Model) { m.Close() })
+
+	if opts.DraftModel != "" {
+		if err := m.SetDraftModel(opts.DraftModel, opts.DraftTokens); err != nil {
+			m.Close()
+			return nil, err
+		}
+	}
+	return m, nil
+}
+
+// AcquireModel returns the process-wide model for modelPath and opts from
+// the model registry, loading it on first use. Callers asking for the same
+// file with the same options share one model. Closing the returned Model
+// hands it back to the registry, which keeps it loaded for the next caller
+// until it is evicted to stay within SetModelBudget.
+func AcquireModel(modelPath string, opts LoadOptions) (*Model, error) {
+	cpath := C.CString(modelPath)
+	defer C.free(unsafe.Pointer(cpath))
+	var cdraft *C.char
+	if opts.DraftModel != "" {
+		cdraft = C.CString(opts.DraftModel)
+		defer C.free(unsafe.Pointer(cdraft))
+	}
+
+	params := opts.cParams()
+	h := C.llama_registry_acquire(cpath, &params, cdraft, C.int(opts.DraftTokens))
+	runtime.KeepAlive(opts.Threadpool)
+	if h == nil {
+		return nil, fmt.Errorf("failed to load model %s", modelPath)
+	}
+	m := &Model{h: h, registered: true}
+	runtime.SetFinalizer(m, func(m *Model) { m.Close() })
 	return m, nil
 }
 
-// Predict runs the model and returns the text output
+// SetModelBudget bounds the weights of the models kept by the registry to
+// bytes (0 = unlimited). Models no caller holds are closed, least recently
+// acquired first, to stay within it; models in use are never closed.
+func SetModelBudget(bytes uint64) {
+	C.llama_registry_set_budget(C.uint64_t(bytes))
+}
+
+// EvictIdleModels closes every registered model no caller holds and
+// returns how many were closed.
+func EvictIdleModels() int {
+	return int(C.llama_registry_evict_idle())
+}
+
+// RegistryStats describes the model registry.
+type RegistryStats struct {
+	Models    int    // registered models
+	Idle      int    // of those, held by no caller
+	Bytes     uint64 // weights of the registered models
+	Budget    uint64 // 0 = unlimited
+	Hits      uint64 // acquires served by a registered model
+	Loads     uint64 // acquires that loaded a model
+	Evictions uint64 // idle models closed to stay within the budget
+}
+
+// ModelRegistryStats returns the state of the model registry.
+func ModelRegistryStats() RegistryStats {
+	var cs C.LlamaRegistryStats
+	C.llama_registry_get_stats(&cs)
+	return RegistryStats{
+		Models:    int(cs.n_models),
+		Idle:      int(cs.n_idle),
+		Bytes:     uint64(cs.bytes),
+		Budget:    uint64(cs.budget),
+		Hits:      uint64(cs.n_hits),
+		Loads:     uint64(cs.n_loads),
+		Evictions: uint64(cs.n_evictions),
+	}
+}
+
+// cParams converts opts to wrapper load parameters. The threadpool pointer
+// is only valid while opts.Threadpool is reachable.
+func (opts LoadOptions) cParams() C.LlamaLoadParams {
+	params := C.llama_load_params_default()
+	params.n_ctx = C.int(opts.ContextSize)
+	params.n_batch = C.int(opts.BatchSize)
+	params.n_ubatch = C.int(opts.UBatchSize)
+	params.n_threads = C.int(opts.Threads)
+	params.n_threads_batch = C.int(opts.BatchThreads)
+	switch opts.FlashAttn {
+	case FlashAttnOn:
+		params.flash_attn = 1
+	case FlashAttnOff:
+		params.flash_attn = 0
+	default:
+		params.flash_attn = -1
+	}
+	if opts.NoMmap {
+		params.use_mmap = 0
+	}
+	if opts.Mlock {
+		params.use_mlock = 1
+	}
+	if opts.Prefault {
+		params.prefault = 1
+	}
+	if opts.HugePages {
+		params.huge_pages = 1
+	}
+	params.type_k = opts.CacheTypeK.cType()
+	params.type_v = opts.CacheTypeV.cType()
+	if opts.Threadpool != nil {
+		params.threadpool = opts.Threadpool.p
+	}
+	params.numa = opts.Numa.cType()
+	params.numa_node = C.int(opts.NumaNode)
+	if opts.ContextShift {
+		params.ctx_shift = 1
+	}
+	params.n_sink = C.int(opts.SinkTokens)
+	return params
+}
+
+// SetDraftModel enables speculative decoding with the draft model at path,
+// proposing nDraft tokens per step (<= 0 = default). It must be called
+// before the first prediction and at most once per model.
+func (m *Model) SetDraftModel(path string, nDraft int) error {
+	if m == nil || m.h == nil {
+		return errors.New("model is nil")
+	}
+	cpath := C.CString(path)
+	defer C.free(unsafe.Pointer(cpath))
+	if C.llama_set_draft_model(m.h, cpath, C.int(nDraft)) != 0 {
+		return fmt.Errorf("failed to set draft model %s", path)
+	}
+	return nil
+}
+
+// SpecStats reports how speculative decoding has performed.
+type SpecStats struct {
+	Steps    uint64 // target decodes that verified drafted tokens
+	Drafted  uint64 // tokens proposed by the draft model or prompt lookup
+	Accepted uint64 // drafted tokens the target accepted
+
+	LookupDrafted  uint64 // of Drafted, proposed by prompt lookup
+	LookupAccepted uint64 // of Accepted, proposed by prompt lookup
+}
+
+// AcceptanceRate returns the fraction of drafted tokens that were accepted.
+// A low rate suggests fewer draft tokens per step.
+func (s SpecStats) AcceptanceRate() float64 {
+	if s.Drafted == 0 {
+		return 0
+	}
+	return float64(s.Accepted) / float64(s.Drafted)
+}
+
+// SpecStats returns the speculative decoding statistics of the model.
+func (m *Model) SpecStats() SpecStats {
+	if m == nil || m.h == nil {
+		return SpecStats{}
+	}
+	var cs C.LlamaSpecStats
+	C.llama_get_spec_stats(m.h, &cs)
+	return SpecStats{
+		Steps:    uint64(cs.n_steps),
+		Drafted:  uint64(cs.n_drafted),
+		Accepted: uint64(cs.n_accepted),
+
+		LookupDrafted:  uint64(cs.n_lookup_drafted),
+		LookupAccepted: uint64(cs.n_lookup_accepted),
+	}
+}
+
+// ShiftStats counts the context shifts of a model loaded with
+// LoadOptions.ContextShift.
+type ShiftStats struct {
+	Shifts        uint64 // times a full context was shifted
+	EvictedTokens uint64 // tokens evicted by those shifts
+}
+
+// ShiftStats returns the context shifting statistics of the model.
+func (m *Model) ShiftStats() ShiftStats {
+	if m == nil || m.h == nil {
+		return ShiftStats{}
+	}
+	var cs C.LlamaShiftStats
+	C.llama_get_shift_stats(m.h, &cs)
+	return ShiftStats{
+		Shifts:        uint64(cs.n_shifts),
+		EvictedTokens: uint64(cs.n_evicted_tokens),
+	}
+}
+
+// LoadStats reports what loading a model cost and how much of it is in
+// memory.
+type LoadStats struct {
+	LoadTime      time.Duration // wall time of the load
+	ModelBytes    uint64        // size of the weights
+	MappedBytes   uint64        // bytes of the model file mapped (0 if read in)
+	ResidentBytes uint64        // weight bytes currently in memory
+	RSSBytes      uint64        // resident set of the whole process (0 if unknown)
+}
+
+// LoadStats returns the load statistics of the model. ResidentBytes and
+// RSSBytes are measured on each call.
+func (m *Model) LoadStats() LoadStats {
+	if m == nil || m.h == nil {
+		return LoadStats{}
+	}
+	var cs C.LlamaLoadStats
+	C.llama_get_load_stats(m.h, &cs)
+	return LoadStats{
+		LoadTime:      time.Duration(float64(cs.load_ms) * float64(time.Millisecond)),
+		ModelBytes:    uint64(cs.model_bytes),
+		MappedBytes:   uint64(cs.mapped_bytes),
+		ResidentBytes: uint64(cs.resident_bytes),
+		RSSBytes:      uint64(cs.rss_bytes),
+	}
+}
+
+// Predict runs the model and returns the text output. Predict is safe for
+// concurrent use: when the batching engine is running concurrent calls are
+// decoded together, otherwise each call takes its own context from the
+// model's pool (creating one if none is idle). The engine does not
+// speculate, so it ignores PromptLookup; it does not apply grammars either,
+// so constrained calls always take a pooled context.
 func (m *Model) Predict(prompt string, opts PredictOptions) (string, error) {
 	if m == nil || m.h == nil {
 		return "", errors.New("model is nil")
@@ -62,25 +629,588 @@ func (m *Model) Predict(prompt string, opts PredictOptions) (string, error) {
 	cprompt := C.CString(prompt)
 	defer C.free(unsafe.Pointer(cprompt))
 
-	// Reset the model context before each prediction to ensure a fresh
-	// KV cache and avoid sequence position mismatches when reusing the
-	// same model handle for multiple independent predictions.
-	C.llama_reset_context(m.h)
+	params, free := opts.cParams()
+	defer free()
 
-	cres := C.llama_predict(m.h, cprompt, C.int(opts.MaxTokens), C.float(opts.Temp), C.int(opts.TopK), C.float(opts.TopP))
+	var cres *C.char
+	if opts.Grammar == "" && C.llama_engine_running(m.h) != 0 {
+		cres = C.llama_engine_predict_ex(m.h, cprompt, &params)
+	} else {
+		// The wrapper hands each prediction a pooled context and reuses the
+		// part of its KV cache that matches the prompt prefix, so no explicit
+		// reset is needed here.
+		cres = C.llama_predict_ex(m.h, cprompt, &params, nil, nil)
+	}
 
 	if cres == nil {
-		return "", errors.New("prediction failed")
+		return "", opts.predictError()
 	}
 	defer C.llama_free_string(cres)
 	goStr := C.GoString(cres)
 	return goStr, nil
 }
 
+// PredictBatch runs Predict for every prompt with the same options and
+// returns the outputs in prompt order. The prompts are decoded together as
+// separate sequences of shared decode steps, by the batching engine when it
+// is running, so a fan-out of short prompts costs little more than the
+// longest of them. If any prediction fails, its output is empty and the
+// error reports how many failed.
+func (m *Model) PredictBatch(prompts []string, opts PredictOptions) ([]string, error) {
+	if m == nil || m.h == nil {
+		return nil, errors.New("model is nil")
+	}
+	n := len(prompts)
+	if n == 0 {
+		return nil, nil
+	}
+	cprompts, freePrompts := cStrings(prompts)
+	defer freePrompts()
+
+	p, free := opts.cParams()
+	defer free()
+	// Both arrays hold C pointers, so they live in C memory.
+	params := unsafe.Slice((*C.LlamaPredictParams)(C.malloc(C.size_t(n)*C.size_t(unsafe.Sizeof(p)))), n)
+	defer C.free(unsafe.Pointer(&params[0]))
+	for i := range params {
+		params[i] = p
+	}
+	couts := unsafe.Slice((**C.char)(C.malloc(C.size_t(n)*C.size_t(unsafe.Sizeof((*C.char)(nil))))), n)
+	defer C.free(unsafe.Pointer(&couts[0]))
+
+	C.llama_predict_batch(m.h, cprompts, C.int(n), &params[0], &couts[0])
+
+	outs := make([]string, n)
+	failed := 0
+	for i, c := range couts {
+		if c == nil {
+			failed++
+			continue
+		}
+		outs[i] = C.GoString(c)
+		C.llama_free_string(c)
+	}
+	if failed > 0 {
+		return outs, fmt.Errorf("%d of %d predictions: %w", failed, n, opts.predictError())
+	}
+	return outs, nil
+}
+
+// PredictN generates n candidate completions of prompt (1 to 64). The
+// prompt is decoded once and shared by every candidate, which then sample
+// independently and decode side by side, so n candidates cost one prefill.
+// With Temp <= 0 all candidates are the same. PromptLookup is ignored.
+func (m *Model) PredictN(prompt string, n int, opts PredictOptions) ([]string, error) {
+	if m == nil || m.h == nil {
+		return nil, errors.New("model is nil")
+	}
+	if n <= 0 || n > 64 {
+		return nil, fmt.Errorf("candidate count %d out of range [1, 64]", n)
+	}
+	cprompt := C.CString(prompt)
+	defer C.free(unsafe.Pointer(cprompt))
+	p, free := opts.cParams()
+	defer free()
+	couts := unsafe.Slice((**C.char)(C.malloc(C.size_t(n)*C.size_t(unsafe.Sizeof((*C.char)(nil))))), n)
+	defer C.free(unsafe.Pointer(&couts[0]))
+
+	ok := int(C.llama_predict_n(m.h, cprompt, &p, C.int(n), &couts[0]))
+
+	outs := make([]string, n)
+	for i, c := range couts {
+		if c == nil {
+			continue
+		}
+		outs[i] = C.GoString(c)
+		C.llama_free_string(c)
+	}
+	if ok != n {
+		return nil, opts.predictError()
+	}
+	return outs, nil
+}
+
+// PredictStream starts Predict on a pooled context and returns at once; the
+// output arrives on the stream's Text channel while it is generated. The
+// batching engine has no streaming path, so PredictStream never uses it.
+func (m *Model) PredictStream(prompt string, opts PredictOptions) (*Stream, error) {
+	if m == nil || m.h == nil {
+		return nil, errors.New("model is nil")
+	}
+	return startStream(prompt, opts, func(cprompt *C.char, params *C.LlamaPredictParams, s *C.LlamaTokenStream) *C.char {
+		defer runtime.KeepAlive(m)
+		return C.llama_predict_ex(m.h, cprompt, params, C.llama_stream_callback(C.llama_stream_write), unsafe.Pointer(s))
+	})
+}
+
+// Stream is a prediction in progress. Text receives the output in order as
+// it is generated, in chunks of whatever was decoded since the last one,
+// each ending on a UTF-8 character boundary; it is closed when generation
+// ends. Wait returns the same output as Predict would. Read Text or call
+// Wait: generation stalls once the unread output fills its buffers. Closing
+// the options' Done channel cancels the prediction and closes Text even if
+// nobody reads it any more.
+type Stream struct {
+	Text <-chan string
+
+	done chan struct{}
+	out  string
+	err  error
+}
+
+// streamReadSize is the most output moved from the wrapper's ring buffer to
+// Go per cgo call; streamChunks is how many chunks Text buffers.
+const (
+	streamReadSize = 4096
+	streamChunks   = 16
+)
+
+// startStream runs predict on its own goroutine, writing into a wrapper ring
+// buffer, while a second goroutine drains the ring into Text. Tokens cross
+// into Go in batches, one llama_stream_read call per batch, instead of
+// through a callback per token.
+func startStream(prompt string, opts PredictOptions,
+	predict func(*C.char, *C.LlamaPredictParams, *C.LlamaTokenStream) *C.char) (*Stream, error) {
+	s := C.llama_stream_open(0)
+	if s == nil {
+		return nil, errors.New("failed to open stream")
+	}
+	text := make(chan string, streamChunks)
+	st := &Stream{Text: text, done: make(chan struct{})}
+	drained := make(chan struct{})
+
+	go func() {
+		defer close(drained)
+		defer close(text)
+		buf := (*C.char)(C.malloc(streamReadSize))
+		defer C.free(unsafe.Pointer(buf))
+		// send delivers a chunk unless the caller cancels while nobody
+		// reads Text; the stream is then abandoned so the prediction's
+		// writes stop waiting for room and it can observe the cancel.
+		send := func(chunk string) bool {
+			select {
+			case text <- chunk:
+				return true
+			case <-opts.Done:
+				C.llama_stream_abandon(s)
+				return false
+			}
+		}
+		var pending []byte
+		for {
+			n := int(C.llama_stream_read(s, buf, streamReadSize))
+			if n <= 0 {
+				break
+			}
+			pending = append(pending, unsafe.Slice((*byte)(unsafe.Pointer(buf)), n)...)
+			// Hold back a character split across reads.
+			end := completeUTF8(pending)
+			if end > 0 {
+				if !send(string(pending[:end])) {
+					return
+				}
+				pending = append(pending[:0], pending[end:]...)
+			}
+		}
+		if len(pending) > 0 {
+			send(string(pending))
+		}
+	}()
+
+	go func() {
+		defer close(st.done)
+		cprompt := C.CString(prompt)
+		defer C.free(unsafe.Pointer(cprompt))
+		params, free := opts.cParams()
+		defer free()
+
+		cres := predict(cprompt, &params, s)
+		C.llama_stream_close_write(s)
+		if cres == nil {
+			st.err = opts.predictError()
+		} else {
+			st.out = C.GoString(cres)
+			C.llama_free_string(cres)
+		}
+		<-drained
+		C.llama_stream_free(s)
+	}()
+	return st, nil
+}
+
+// completeUTF8 returns the length of b without a trailing incomplete UTF-8
+// sequence.
+func completeUTF8(b []byte) int {
+	for i := len(b) - 1; i >= 0 && i >= len(b)-utf8.UTFMax; i-- {
+		if utf8.RuneStart(b[i]) {
+			if !utf8.FullRune(b[i:]) {
+				return i
+			}
+			break
+		}
+	}
+	return len(b)
+}
+
+// Wait discards whatever Text still holds, waits for the prediction to
+// finish and returns its output.
+func (st *Stream) Wait() (string, error) {
+	for range st.Text {
+	}
+	<-st.done
+	return st.out, st.err
+}
+
+// EmbeddingSize returns the length of the vectors Embed returns.
+func (m *Model) EmbeddingSize() int {
+	if m == nil || m.h == nil {
+		return 0
+	}
+	return int(C.llama_embed_size(m.h))
+}
+
+// Embed returns one embedding per text, pooled the way the model defines
+// (mean pooling for generative models) and scaled to unit length, so the
+// dot product of two vectors is their cosine similarity. The texts are
+// decoded many at a time, so embedding a batch costs a few decodes rather
+// than one per text. Text beyond the model's batch size is ignored.
+func (m *Model) Embed(texts []string) ([][]float32, error) {
+	if m == nil || m.h == nil {
+		return nil, errors.New("model is nil")
+	}
+	if len(texts) == 0 {
+		return nil, nil
+	}
+	dim := m.EmbeddingSize()
+	if dim <= 0 {
+		return nil, errors.New("model has no embedding size")
+	}
+
+	ctexts, free := cStrings(texts)
+	defer free()
+	// The output holds no Go pointers, so the wrapper may write it in place.
+	out := make([]float32, len(texts)*dim)
+	if C.llama_embed_batch(m.h, ctexts, C.int(len(texts)), (*C.float)(unsafe.Pointer(&out[0]))) != 0 {
+		return nil, errors.New("embedding failed")
+	}
+	vecs := make([][]float32, len(texts))
+	for i := range vecs {
+		vecs[i] = out[i*dim : (i+1)*dim : (i+1)*dim]
+	}
+	return vecs, nil
+}
+
+// KVBytesPerToken returns how many bytes of KV cache one token of one
+// sequence occupies with the model's cache types.
+func (m *Model) KVBytesPerToken() uint64 {
+	if m == nil || m.h == nil {
+		return 0
+	}
+	return uint64(C.llama_kv_bytes_per_token(m.h))
+}
+
+// SavePromptState decodes prompt and writes the resulting KV state to path.
+// It returns the number of prompt tokens saved.
+func (m *Model) SavePromptState(prompt, path string) (int, error) {
+	if m == nil || m.h == nil {
+		return 0, errors.New("model is nil")
+	}
+	cprompt := C.CString(prompt)
+	defer C.free(unsafe.Pointer(cprompt))
+	cpath := C.CString(path)
+	defer C.free(unsafe.Pointer(cpath))
+	n := int(C.llama_save_prompt_state(m.h, cprompt, cpath))
+	if n < 0 {
+		return 0, fmt.Errorf("failed to save prompt state to %s", path)
+	}
+	return n, nil
+}
+
+// LoadPromptState restores a state written by SavePromptState into the
+// model's context pool, so a later Predict whose prompt starts with the
+// saved prompt skips decoding it. It returns the number of tokens restored.
+func (m *Model) LoadPromptState(path string) (int, error) {
+	if m == nil || m.h == nil {
+		return 0, errors.New("model is nil")
+	}
+	cpath := C.CString(path)
+	defer C.free(unsafe.Pointer(cpath))
+	n := int(C.llama_load_prompt_state(m.h, cpath))
+	if n < 0 {
+		return 0, fmt.Errorf("failed to load prompt state from %s", path)
+	}
+	return n, nil
+}
+
+// PoolStats reports how the wrapper's context pool has been used.
+type PoolStats struct {
+	PoolSize     int    // maximum number of idle contexts retained
+	Idle         int    // contexts currently idle in the pool
+	Created      uint64 // contexts freshly allocated
+	Reused       uint64 // predictions served by an already allocated context
+	PrefixTokens uint64 // prompt tokens served from a cached KV prefix
+}
+
+// SetPoolSize sets how many idle contexts the model keeps ready for reuse.
+func (m *Model) SetPoolSize(n int) {
+	if m == nil || m.h == nil {
+		return
+	}
+	C.llama_set_context_pool_size(m.h, C.int(n))
+}
+
+// SetBatchSize sets how many prompt tokens are fed to the model per decode
+// call (nBatch) and the micro-batch each call is split into (nUbatch).
+// Values <= 0 select the wrapper defaults.
+func (m *Model) SetBatchSize(nBatch, nUbatch int) {
+	if m == nil || m.h == nil {
+		return
+	}
+	C.llama_set_batch_size(m.h, C.int(nBatch), C.int(nUbatch))
+}
+
+// PoolStats returns the current context pool statistics.
+func (m *Model) PoolStats() PoolStats {
+	if m == nil || m.h == nil {
+		return PoolStats{}
+	}
+	var cs C.LlamaPoolStats
+	C.llama_get_pool_stats(m.h, &cs)
+	return PoolStats{
+		PoolSize:     int(cs.pool_size),
+		Idle:         int(cs.n_idle),
+		Created:      uint64(cs.n_created),
+		Reused:       uint64(cs.n_reused),
+		PrefixTokens: uint64(cs.n_prefix_tokens),
+	}
+}
+
+// EngineStats reports the state of the continuous-batching engine.
+type EngineStats struct {
+	Parallel      int    // sequences decoded together
+	Active        int    // sequences currently being generated
+	Pending       int    // requests waiting for a free sequence
+	Requests      uint64 // requests submitted
+	DecodeCalls   uint64 // llama_decode steps executed
+	TokensDecoded uint64 // tokens across all decode steps
+}
+
+// StartEngine starts the continuous-batching engine with nParallel
+// sequences. Afterwards Predict may be called from many goroutines at once.
+func (m *Model) StartEngine(nParallel int) error {
+	if m == nil || m.h == nil {
+		return errors.New("model is nil")
+	}
+	if C.llama_engine_start(m.h, C.int(nParallel)) != 0 {
+		return errors.New("failed to start batching engine")
+	}
+	return nil
+}
+
+// StopEngine stops the batching engine; in-flight predictions fail.
+func (m *Model) StopEngine() {
+	if m == nil || m.h == nil {
+		return
+	}
+	C.llama_engine_stop(m.h)
+}
+
+// EngineRunning reports whether the batching engine is serving Predict.
+func (m *Model) EngineRunning() bool {
+	if m == nil || m.h == nil {
+		return false
+	}
+	return C.llama_engine_running(m.h) != 0
+}
+
+// EngineStats returns the batching engine statistics.
+func (m *Model) EngineStats() EngineStats {
+	if m == nil || m.h == nil {
+		return EngineStats{}
+	}
+	var cs C.LlamaEngineStats
+	C.llama_get_engine_stats(m.h, &cs)
+	return EngineStats{
+		Parallel:      int(cs.n_parallel),
+		Active:        int(cs.n_active),
+		Pending:       int(cs.n_pending),
+		Requests:      uint64(cs.n_requests),
+		DecodeCalls:   uint64(cs.n_decode_calls),
+		TokensDecoded: uint64(cs.n_tokens_decoded),
+	}
+}
+
+// Close releases the caller's reference to the model. The weights stay
+// loaded until every Context opened on it is closed as well, and a model
+// from AcquireModel until the registry evicts it.
 func (m *Model) Close() {
 	if m == nil || m.h == nil {
 		return
 	}
-	C.llama_close_model(m.h)
+	if m.registered {
+		C.llama_registry_release(m.h)
+	} else {
+		C.llama_close_model(m.h)
+	}
 	m.h = nil
 }
+
+// Vocab is a model's vocabulary loaded without its weights, for tokenizing
+// prompts ahead of time.
+type Vocab struct {
+	v *C.LlamaVocabHandle
+}
+
+// LoadVocab loads the vocabulary of the GGUF model at path.
+func LoadVocab(path string) (*Vocab, error) {
+	cpath := C.CString(path)
+	defer C.free(unsafe.Pointer(cpath))
+	v := C.llama_open_vocab(cpath)
+	if v == nil {
+		return nil, fmt.Errorf("failed to load vocabulary from %s", path)
+	}
+	voc := &Vocab{v: v}
+	runtime.SetFinalizer(voc, func(voc *Vocab) { voc.Close() })
+	return voc, nil
+}
+
+// Tokenize returns the tokens of text. addSpecial adds the BOS/EOS tokens
+// the model expects around a whole prompt; leave it unset for text that
+// continues earlier tokens.
+func (voc *Vocab) Tokenize(text string, addSpecial bool) ([]int32, error) {
+	if voc == nil || voc.v == nil {
+		return nil, errors.New("vocab is nil")
+	}
+	ctext := C.CString(text)
+	defer C.free(unsafe.Pointer(ctext))
+	special := C.int(0)
+	if addSpecial {
+		special = 1
+	}
+	out := make([]int32, len(text)+2)
+	n := C.llama_tokenize_prompt(voc.v, ctext, special, (*C.int32_t)(unsafe.Pointer(&out[0])), C.int(len(out)))
+	if n < 0 {
+		return nil, errors.New("tokenization failed")
+	}
+	return out[:n], nil
+}
+
+// Close frees the vocabulary.
+func (voc *Vocab) Close() {
+	if voc == nil || voc.v == nil {
+		return
+	}
+	C.llama_close_vocab(voc.v)
+	voc.v = nil
+}
+
+// Context is an inference context with its own KV cache on a shared Model.
+// Calls on one Context are serialized by the wrapper; separate Contexts on
+// the same Model predict concurrently, sharing a single copy of the weights.
+type Context struct {
+	c *C.LlamaContextHandle
+}
+
+// NewContext opens a Context on m. The Context keeps the model loaded until
+// it is closed, even if m is closed first.
+func (m *Model) NewContext() (*Context, error) {
+	if m == nil || m.h == nil {
+		return nil, errors.New("model is nil")
+	}
+	c := C.llama_context_open(m.h)
+	if c == nil {
+		return nil, errors.New("failed to create context")
+	}
+	ctx := &Context{c: c}
+	runtime.SetFinalizer(ctx, func(ctx *Context) { ctx.Close() })
+	return ctx, nil
+}
+
+// Predict runs the model on the context and returns the text output. A
+// prompt that shares a prefix with the context's previous one only decodes
+// the remainder.
+func (ctx *Context) Predict(prompt string, opts PredictOptions) (string, error) {
+	if ctx == nil || ctx.c == nil {
+		return "", errors.New("context is nil")
+	}
+	cprompt := C.CString(prompt)
+	defer C.free(unsafe.Pointer(cprompt))
+
+	params, free := opts.cParams()
+	defer free()
+	cres := C.llama_context_predict_ex(ctx.c, cprompt, &params)
+	if cres == nil {
+		return "", opts.predictError()
+	}
+	defer C.llama_free_string(cres)
+	return C.GoString(cres), nil
+}
+
+// PredictStream is Predict with the output delivered on a Stream as it is
+// generated. The context is busy until the stream's prediction finishes.
+func (ctx *Context) PredictStream(prompt string, opts PredictOptions) (*Stream, error) {
+	if ctx == nil || ctx.c == nil {
+		return nil, errors.New("context is nil")
+	}
+	return startStream(prompt, opts, func(cprompt *C.char, params *C.LlamaPredictParams, s *C.LlamaTokenStream) *C.char {
+		defer runtime.KeepAlive(ctx)
+		return C.llama_context_predict_stream(ctx.c, cprompt, params, C.llama_stream_callback(C.llama_stream_write), unsafe.Pointer(s))
+	})
+}
+
+// SavePromptState is Model.SavePromptState on the context's KV cache.
+func (ctx *Context) SavePromptState(prompt, path string) (int, error) {
+	if ctx == nil || ctx.c == nil {
+		return 0, errors.New("context is nil")
+	}
+	cprompt := C.CString(prompt)
+	defer C.free(unsafe.Pointer(cprompt))
+	cpath := C.CString(path)
+	defer C.free(unsafe.Pointer(cpath))
+	n := int(C.llama_context_save_prompt_state(ctx.c, cprompt, cpath))
+	if n < 0 {
+		return 0, fmt.Errorf("failed to save prompt state to %s", path)
+	}
+	return n, nil
+}
+
+// SaveTokenState is SavePromptState for a prompt already tokenized for the
+// model, such as a compile-time prompt prefix.
+func (ctx *Context) SaveTokenState(tokens []int32, path string) (int, error) {
+	if ctx == nil || ctx.c == nil {
+		return 0, errors.New("context is nil")
+	}
+	if len(tokens) == 0 {
+		return 0, errors.New("no tokens to save")
+	}
+	cpath := C.CString(path)
+	defer C.free(unsafe.Pointer(cpath))
+	n := int(C.llama_context_save_token_state(ctx.c, (*C.int32_t)(unsafe.Pointer(&tokens[0])), C.int(len(tokens)), cpath))
+	if n < 0 {
+		return 0, fmt.Errorf("failed to save prompt state to %s", path)
+	}
+	return n, nil
+}
+
+// LoadPromptState restores a saved prompt state into the context's KV cache.
+func (ctx *Context) LoadPromptState(path string) (int, error) {
+	if ctx == nil || ctx.c == nil {
+		return 0, errors.New("context is nil")
+	}
+	cpath := C.CString(path)
+	defer C.free(unsafe.Pointer(cpath))
+	n := int(C.llama_context_load_prompt_state(ctx.c, cpath))
+	if n < 0 {
+		return 0, fmt.Errorf("failed to load prompt state from %s", path)
+	}
+	return n, nil
+}
+
+// Close frees the context and drops its reference to the model.
+func (ctx *Context) Close() {
+	if ctx == nil || ctx.c == nil {
+		return
+	}
+	C.llama_context_close(ctx.c)
+	ctx.c = nil
+}
@@ -0,0 +1,183 @@
+// N-candidate generation.
+//
+// Sampling several completions of one prompt as separate predictions decodes
+// the prompt once per completion. Here it is decoded once, into sequence 0 of
+// a context with a unified KV cache, and llama_memory_seq_cp adds the other
+// sequences to the same cells without copying any tensor data. Every
+// candidate samples its first token from the prompt's logits with a sampler
+// of its own, and the candidates then decode together, one token each per
+// llama_decode.
+#include "llama_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+// Most candidates one call generates; each is a sequence of its context.
+#define LLAMA_MAX_CANDIDATES 64
+
+struct Candidate {
+    TokenSampler sampler;
+    struct llama_sampler *grammar = NULL;
+    StopMatcher stop;
+    std::string output;
+    llama_token next = 0;  // sampled token waiting to be decoded
+    int n_gen = 0;         // tokens sampled so far
+    int32_t i_logits = -1; // batch index of this candidate's logits
+    bool done = false;
+};
+
+// append adds sampled token id to c's output. Returns false once c is done:
+// end of generation, a completed stop string (cut from the output), a
+// complete grammar match or max_gen tokens.
+static bool append(const LlamaModelHandle *h, const struct llama_vocab *vocab, Candidate &c, llama_token id,
+                   int max_gen) {
+    if (llama_vocab_is_eog(vocab, id)) return false;
+    size_t len;
+    const char *piece = token_piece(h, id, &len);
+    c.output.append(piece, len);
+    if (!c.stop.empty()) {
+        int64_t at = c.stop.feed(piece, len);
+        if (at >= 0) {
+            c.output.resize((size_t)at);
+            return false;
+        }
+    }
+    c.n_gen++;
+    c.next = id;
+    if (c.grammar) {
+        llama_sampler_accept(c.grammar, id);
+        if (grammar_complete(c.grammar, vocab)) return false;
+    }
+    return c.n_gen < max_gen;
+}
+
+static char *copy_output(const std::string &s) {
+    char *out = (char*)malloc(s.size() + 1);
+    if (!out) return NULL;
+    memcpy(out, s.data(), s.size());
+    out[s.size()] = '\0';
+    return out;
+}
+
+int llama_predict_n(LlamaModelHandle *h, const char *prompt, const LlamaPredictParams *params, int n,
+                    char **outputs) {
+    if (!h || !prompt || !outputs || n <= 0 || n > LLAMA_MAX_CANDIDATES) return -1;
+    for (int i = 0; i < n; i++) outputs[i] = NULL;
+    const LlamaPredictParams p = params ? *params : llama_predict_params_default();
+
+    // One candidate has nothing to share; the pooled contexts serve it and
+    // may reuse a cached prefix.
+    if (n == 1) {
+        outputs[0] = llama_predict_ex(h, prompt, &p, NULL, NULL);
+        return outputs[0] ? 1 : 0;
+    }
+
+    const struct llama_vocab *vocab = llama_model_get_vocab(h->model);
+    std::vector<llama_token> tokens;
+    if (!request_tokens(vocab, prompt, p, tokens)) return 0;
+    const int32_t n_prompt = (int32_t)tokens.size();
+    if (n_prompt == 0 || p.max_tokens <= 0) {
+        int n_ok = 0;
+        for (int i = 0; i < n; i++) n_ok += (outputs[i] = (char*)calloc(1, 1)) ? 1 : 0;
+        return n_ok;
+    }
+    if (n_prompt >= h->params.n_ctx) {
+        fprintf(stderr, "Prompt of %d tokens does not fit the %d-token context\n", n_prompt, h->params.n_ctx);
+        return 0;
+    }
+
+    // The prompt's cells are shared, so the cache needs room for it once
+    // plus every candidate's tokens, up to n contexts of the handle.
+    int64_t n_ctx = (int64_t)n_prompt + (int64_t)n * p.max_tokens;
+    if (n_ctx > (int64_t)n * h->params.n_ctx) n_ctx = (int64_t)n * h->params.n_ctx;
+    const int max_gen = (int)((n_ctx - n_prompt) / n);
+    if (max_gen <= 0) {
+        fprintf(stderr, "No room for %d candidates after a %d-token prompt\n", n, n_prompt);
+        return 0;
+    }
+
+    std::vector<Candidate> cands((size_t)n);
+    for (Candidate &c : cands) {
+        c.sampler.configure(p.temp, p.top_k, p.top_p);
+        if (p.stop) c.stop.init(p.stop, p.n_stop);
+        c.output.reserve((size_t)max_gen * LLAMA_OUTPUT_BYTES_PER_TOKEN);
+    }
+    auto free_grammars = [&cands] {
+        for (Candidate &c : cands) if (c.grammar) llama_sampler_free(c.grammar);
+    };
+    if (p.grammar && p.grammar[0]) {
+        for (Candidate &c : cands) {
+            if ((c.grammar = grammar_sampler(h, p.grammar))) continue;
+            free_grammars();
+            return 0;
+        }
+    }
+
+    struct llama_context_params cparams = handle_context_params(h);
+    cparams.n_ctx = (uint32_t)n_ctx;
+    cparams.n_seq_max = (uint32_t)n;
+    cparams.kv_unified = true;
+    if ((int)cparams.n_batch < n) cparams.n_batch = n;
+    struct llama_context *ctx = init_context(h, h->model, cparams);
+    if (!ctx) {
+        fprintf(stderr, "Failed to create a context for %d candidates\n", n);
+        free_grammars();
+        return 0;
+    }
+    if (p.cancel) llama_set_abort_callback(ctx, abort_if_cancelled, (void *)p.cancel);
+
+    bool ok = decode_prompt(h, ctx, tokens.data(), 0, n_prompt) == 0;
+    if (ok) {
+        llama_memory_t mem = llama_get_memory(ctx);
+        for (llama_seq_id s = 1; s < n; s++) llama_memory_seq_cp(mem, 0, s, -1, -1);
+        {
+            std::lock_guard<std::mutex> lock(h->pool_mu);
+            h->n_prefix_tokens += (uint64_t)n_prompt * (uint64_t)(n - 1);
+        }
+
+        const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+        const float *logits = llama_get_logits_ith(ctx, -1);
+        for (Candidate &c : cands) c.done = !append(h, vocab, c, c.sampler.sample(logits, n_vocab, c.grammar), max_gen);
+
+        struct llama_batch batch = llama_batch_init(n, 0, 1);
+        for (;;) {
+            if (cancelled(p.cancel)) {
+                ok = false;
+                break;
+            }
+            batch.n_tokens = 0;
+            for (llama_seq_id s = 0; s < n; s++) {
+                Candidate &c = cands[s];
+                if (c.done) continue;
+                int j = c.i_logits = batch.n_tokens++;
+                batch.token[j] = c.next;
+                batch.pos[j] = n_prompt + c.n_gen - 1;
+                batch.n_seq_id[j] = 1;
+                batch.seq_id[j][0] = s;
+                batch.logits[j] = true;
+            }
+            if (batch.n_tokens == 0) break;
+            int rc = handle_decode(h, ctx, batch);
+            if (rc != 0) {
+                if (!cancelled(p.cancel)) fprintf(stderr, "llama_decode failed on candidates (rc=%d)\n", rc);
+                ok = false;
+                break;
+            }
+            for (Candidate &c : cands) {
+                if (c.done) continue;
+                llama_token id = c.sampler.sample(llama_get_logits_ith(ctx, c.i_logits), n_vocab, c.grammar);
+                c.done = !append(h, vocab, c, id, max_gen);
+            }
+        }
+        llama_batch_free(batch);
+    }
+    free_grammars();
+    llama_free(ctx);
+    if (!ok) return 0;
+
+    int n_ok = 0;
+    for (int i = 0; i < n; i++) n_ok += (outputs[i] = copy_output(cands[i].output)) ? 1 : 0;
+    return n_ok;
+}
@@ -0,0 +1,196 @@
+// Batched embeddings.
+//
+// Texts are packed into as few llama_decode calls as the batch allows, one
+// sequence per text, on a dedicated context with pooling enabled; the
+// pooled vector of every sequence is then scaled to unit length.
+#include "llama_internal.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Sequences, and therefore texts, decoded together by one llama_decode.
+#define LLAMA_EMBED_MAX_SEQS 64
+
+// normalize_into writes src scaled to unit L2 norm to dst. A zero vector is
+// copied unchanged.
+static void normalize_into(float *dst, const float *src, int32_t n) {
+    int32_t i = 0;
+    float sum = 0.0f;
+#if defined(__AVX__)
+    __m256 acc = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(src + i);
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(v, v));
+    }
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    sum = _mm_cvtss_f32(s);
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 acc = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(src + i);
+        acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    sum = _mm_cvtss_f32(acc);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t v = vld1q_f32(src + i);
+        acc = vfmaq_f32(acc, v, v);
+    }
+    sum = vaddvq_f32(acc);
+#endif
+    for (; i < n; i++) sum += src[i] * src[i];
+
+    const float scale = sum > 0.0f ? 1.0f / sqrtf(sum) : 1.0f;
+    i = 0;
+#if defined(__AVX__)
+    const __m256 vs = _mm256_set1_ps(scale);
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(src + i), vs));
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128 vs = _mm_set1_ps(scale);
+    for (; i + 4 <= n; i += 4) _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), vs));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) vst1q_f32(dst + i, vmulq_n_f32(vld1q_f32(src + i), scale));
+#endif
+    for (; i < n; i++) dst[i] = src[i] * scale;
+}
+
+// new_embed_context creates the handle's embedding context. Every text must
+// be decoded in one piece, since pooling happens per decode and non-causal
+// models attend over the whole input in one micro-batch, so the context
+// holds exactly one batch shared by all its sequences and is cleared before
+// every decode. The model's own pooling is used; generative models, which
+// declare none, get mean pooling.
+static struct llama_context *new_embed_context(LlamaModelHandle *h) {
+    struct llama_context_params cparams = handle_context_params(h);
+    cparams.embeddings = true;
+    cparams.n_seq_max = LLAMA_EMBED_MAX_SEQS;
+    cparams.n_ctx = cparams.n_batch;
+    cparams.n_ubatch = cparams.n_batch;
+    cparams.kv_unified = true;
+
+    struct llama_context *ctx = init_context(h, h->model, cparams);
+    if (ctx && llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_NONE) {
+        llama_free(ctx);
+        cparams.pooling_type = LLAMA_POOLING_TYPE_MEAN;
+        ctx = init_context(h, h->model, cparams);
+    }
+    if (!ctx) {
+        fprintf(stderr, "Failed to create embedding context\n");
+        return NULL;
+    }
+    if (llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_RANK) {
+        fprintf(stderr, "Model is a reranker and does not produce embeddings\n");
+        llama_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+// EmbedBatch accumulates texts for one llama_decode: sequence s of the
+// batch holds text index[s].
+struct EmbedBatch {
+    LlamaModelHandle *h;
+    struct llama_context *ctx;
+    struct llama_batch batch;
+    std::vector<int> index;
+    int32_t n_embd;
+    float *out;
+
+    // Decode the pending texts and write their normalized embeddings.
+    // Returns false on error.
+    bool flush() {
+        if (index.empty()) return true;
+        llama_memory_clear(llama_get_memory(ctx), true);
+        int rc = handle_decode(h, ctx, batch);
+        if (rc != 0) {
+            fprintf(stderr, "llama_decode failed on %d embedding inputs (rc=%d)\n", (int)index.size(), rc);
+            return false;
+        }
+        for (size_t s = 0; s < index.size(); s++) {
+            const float *emb = llama_get_embeddings_seq(ctx, (llama_seq_id)s);
+            if (!emb) {
+                fprintf(stderr, "No pooled embedding for input %d\n", index[s]);
+                return false;
+            }
+            normalize_into(out + (size_t)index[s] * n_embd, emb, n_embd);
+        }
+        batch.n_tokens = 0;
+        index.clear();
+        return true;
+    }
+};
+
+int llama_embed_size(LlamaModelHandle *h) {
+    if (!h) return 0;
+    return (int)llama_model_n_embd(h->model);
+}
+
+int llama_embed_batch(LlamaModelHandle *h, const char *const *texts, int n_texts, float *out) {
+    if (!h || n_texts < 0 || (n_texts > 0 && (!texts || !out))) return -1;
+    if (n_texts == 0) return 0;
+
+    std::lock_guard<std::mutex> lock(h->embed_mu);
+    if (!h->embed_ctx) {
+        h->embed_ctx = new_embed_context(h);
+        if (!h->embed_ctx) return -1;
+    }
+
+    const struct llama_vocab *vocab = llama_model_get_vocab(h->model);
+    const int32_t n_batch = (int32_t)llama_n_batch(h->embed_ctx);
+    const int n_seq_max = (int)llama_n_seq_max(h->embed_ctx);
+
+    EmbedBatch eb;
+    eb.h = h;
+    eb.ctx = h->embed_ctx;
+    eb.batch = llama_batch_init(n_batch, 0, 1);
+    eb.index.reserve(n_seq_max);
+    eb.n_embd = llama_model_n_embd(h->model);
+    eb.out = out;
+
+    bool ok = true;
+    std::vector<llama_token> tokens;
+    for (int i = 0; i < n_texts; i++) {
+        if (!texts[i] || !tokenize_text(vocab, texts[i], tokens)) {
+            fprintf(stderr, "Failed to tokenize embedding input %d\n", i);
+            ok = false;
+            break;
+        }
+        if (tokens.empty()) {
+            memset(out + (size_t)i * eb.n_embd, 0, (size_t)eb.n_embd * sizeof(float));
+            continue;
+        }
+        // A text longer than one batch is embedded by its leading tokens.
+        int32_t n = (int32_t)tokens.size() < n_batch ? (int32_t)tokens.size() : n_batch;
+        if ((eb.batch.n_tokens + n > n_batch || (int)eb.index.size() == n_seq_max) && !eb.flush()) {
+            ok = false;
+            break;
+        }
+
+        const llama_seq_id seq = (llama_seq_id)eb.index.size();
+        for (int32_t j = 0; j < n; j++) {
+            int k = eb.batch.n_tokens++;
+            eb.batch.token[k] = tokens[j];
+            eb.batch.pos[k] = j;
+            eb.batch.n_seq_id[k] = 1;
+            eb.batch.seq_id[k][0] = seq;
+            eb.batch.logits[k] = 1;
+        }
+        eb.index.push_back(i);
+    }
+    if (ok) ok = eb.flush();
+    llama_batch_free(eb.batch);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,484 @@
+// Continuous-batching decode engine.
+//
+// The engine owns one llama_context with n_parallel sequences. Callers on any
+// thread submit a request and block until it completes; a single worker
+// thread admits queued requests into free sequence ids, steps every active
+// sequence together with one llama_decode per iteration, and retires
+// sequences as they finish so new requests can take their place.
+#include "llama_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <thread>
+
+// Most sequences a one-off engine of llama_predict_batch decodes at once;
+// further prompts wait for a free sequence.
+#define LLAMA_BATCH_MAX_SEQS 16
+
+struct LlamaEngineRequest {
+    // inputs
+    std::vector<llama_token> prompt;
+    int max_tokens;
+    float temp;
+    int top_k;
+    float top_p;
+    StopMatcher stop;
+    const LlamaCancelFlag *cancel;
+
+    // scheduling state, owned by the worker thread once admitted
+    llama_seq_id seq;
+    size_t n_fed;          // prompt tokens already decoded
+    int n_gen;             // tokens sampled so far
+    int n_evicted;         // tokens removed by context shifts
+    llama_token next;      // sampled token waiting to be decoded
+    int32_t i_logits;      // batch index of this sequence's logits, or -1
+
+    // result, published under the engine mutex
+    std::string output;
+    bool failed;
+    bool done;
+};
+
+struct LlamaEngine {
+    LlamaModelHandle *h;
+    struct llama_context *ctx;
+    struct llama_batch batch;
+    int n_batch;
+    int n_parallel;
+    int n_seq_ctx;
+
+    std::thread worker;
+    std::mutex mu;
+    std::condition_variable cv_work;
+    std::condition_variable cv_done;
+    std::condition_variable cv_idle;
+    std::deque<LlamaEngineRequest *> pending;
+    std::vector<LlamaEngineRequest *> active; // indexed by sequence id
+    std::vector<TokenSampler> samplers;       // indexed by sequence id, worker only
+    bool stopping;
+
+    // Callers holding the engine through engine_acquire. engine_free waits
+    // for them to leave before the engine is deleted, since a caller woken
+    // from cv_done still has to re-lock mu.
+    int n_users;
+
+    uint64_t n_requests;
+    uint64_t n_decode_calls;
+    uint64_t n_tokens_decoded;
+};
+
+// finish publishes the result of req and wakes its caller. The engine mutex
+// must be held.
+static void finish(LlamaEngine *e, LlamaEngineRequest *req, bool failed) {
+    req->failed = failed;
+    req->done = true;
+    e->cv_done.notify_all();
+}
+
+static void retire(LlamaEngine *e, LlamaEngineRequest *req, bool failed) {
+    llama_memory_seq_rm(llama_get_memory(e->ctx), req->seq, -1, -1);
+    std::lock_guard<std::mutex> lock(e->mu);
+    e->active[req->seq] = NULL;
+    finish(e, req, failed);
+}
+
+static void batch_add(struct llama_batch &batch, llama_token id, llama_pos pos, llama_seq_id seq, bool logits) {
+    int i = batch.n_tokens++;
+    batch.token[i] = id;
+    batch.pos[i] = pos;
+    batch.n_seq_id[i] = 1;
+    batch.seq_id[i][0] = seq;
+    batch.logits[i] = logits;
+}
+
+static void engine_loop(LlamaEngine *e) {
+    const struct llama_vocab *vocab = llama_model_get_vocab(e->h->model);
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+    std::vector<LlamaEngineRequest *> running;
+
+    for (;;) {
+        // Admit queued requests into free sequences, or sleep until there is
+        // something to do.
+        {
+            std::unique_lock<std::mutex> lock(e->mu);
+            e->cv_work.wait(lock, [e] {
+                if (e->stopping || !e->pending.empty()) return true;
+                for (LlamaEngineRequest *r : e->active) if (r) return true;
+                return false;
+            });
+            if (e->stopping) break;
+            for (auto it = e->pending.begin(); it != e->pending.end();) {
+                if (!cancelled((*it)->cancel)) {
+                    ++it;
+                    continue;
+                }
+                finish(e, *it, true);
+                it = e->pending.erase(it);
+            }
+            for (int s = 0; s < e->n_parallel && !e->pending.empty(); s++) {
+                if (e->active[s]) continue;
+                LlamaEngineRequest *req = e->pending.front();
+                e->pending.pop_front();
+                req->seq = s;
+                e->active[s] = req;
+                e->samplers[s].configure(req->temp, req->top_k, req->top_p);
+            }
+            running.clear();
+            for (LlamaEngineRequest *r : e->active) if (r) running.push_back(r);
+        }
+
+        // Cancelled sequences leave before the step; the others decode on.
+        size_t n_running = 0;
+        for (LlamaEngineRequest *r : running) {
+            if (cancelled(r->cancel)) {
+                retire(e, r, true);
+            } else {
+                running[n_running++] = r;
+            }
+        }
+        running.resize(n_running);
+
+        // Build one batch: a single token for every decoding sequence first so
+        // generation never stalls behind a long prompt, then prompt chunks
+        // for sequences still in prefill with whatever room is left.
+        e->batch.n_tokens = 0;
+        for (LlamaEngineRequest *r : running) {
+            r->i_logits = -1;
+            if (r->n_fed < r->prompt.size()) continue;
+            r->i_logits = e->batch.n_tokens;
+            batch_add(e->batch, r->next, (llama_pos)(r->prompt.size() + r->n_gen - 1 - r->n_evicted), r->seq, true);
+        }
+        for (LlamaEngineRequest *r : running) {
+            while (r->n_fed < r->prompt.size() && e->batch.n_tokens < e->n_batch) {
+                bool last = r->n_fed + 1 == r->prompt.size();
+                if (last) r->i_logits = e->batch.n_tokens;
+                batch_add(e->batch, r->prompt[r->n_fed], (llama_pos)r->n_fed, r->seq, last);
+                r->n_fed++;
+            }
+        }
+        if (e->batch.n_tokens == 0) continue;
+
+        int rc = handle_decode(e->h, e->ctx, e->batch);
+        {
+            std::lock_guard<std::mutex> lock(e->mu);
+            e->n_decode_calls++;
+            e->n_tokens_decoded += e->batch.n_tokens;
+        }
+        if (rc != 0) {
+            // Without finer-grained recovery the safest option is to fail
+            // every sequence that took part in this step.
+            fprintf(stderr, "llama engine: llama_decode failed (rc=%d)\n", rc);
+            for (LlamaEngineRequest *r : running) retire(e, r, true);
+            continue;
+        }
+
+        // Sample the next token of every sequence that produced logits and
+        // retire the ones that are done.
+        for (LlamaEngineRequest *r : running) {
+            if (r->i_logits < 0) continue;
+            llama_token id = e->samplers[r->seq].sample(llama_get_logits_ith(e->ctx, r->i_logits), n_vocab);
+            if (llama_vocab_is_eog(vocab, id)) {
+                retire(e, r, false);
+                continue;
+            }
+            size_t len;
+            const char *piece = token_piece(e->h, id, &len);
+            r->output.append(piece, len);
+            if (!r->stop.empty()) {
+                int64_t at = r->stop.feed(piece, len);
+                if (at >= 0) {
+                    r->output.resize((size_t)at);
+                    retire(e, r, false);
+                    continue;
+                }
+            }
+            r->n_gen++;
+            r->next = id;
+            if (r->n_gen >= r->max_tokens) {
+                retire(e, r, false);
+                continue;
+            }
+            // A full sequence shifts its context if the handle allows it.
+            const int32_t n_past = (int32_t)(r->prompt.size() + r->n_gen - 1 - r->n_evicted);
+            if (n_past >= e->n_seq_ctx) {
+                const int32_t n_discard = shift_context(e->h, e->ctx, r->seq, n_past);
+                if (n_discard == 0) {
+                    retire(e, r, false);
+                    continue;
+                }
+                r->n_evicted += n_discard;
+            }
+        }
+    }
+
+    // Shutting down: fail everything that has not completed.
+    std::lock_guard<std::mutex> lock(e->mu);
+    for (LlamaEngineRequest *&r : e->active) {
+        if (r) finish(e, r, true);
+        r = NULL;
+    }
+    for (LlamaEngineRequest *r : e->pending) finish(e, r, true);
+    e->pending.clear();
+}
+
+void engine_free(LlamaEngine *e) {
+    if (!e) return;
+    {
+        std::lock_guard<std::mutex> lock(e->mu);
+        e->stopping = true;
+    }
+    e->cv_work.notify_all();
+    if (e->worker.joinable()) e->worker.join();
+    {
+        std::unique_lock<std::mutex> lock(e->mu);
+        e->cv_idle.wait(lock, [e] { return e->n_users == 0; });
+    }
+    llama_batch_free(e->batch);
+    llama_free(e->ctx);
+    delete e;
+}
+
+// engine_new creates an engine of n_parallel sequences with n_seq_ctx
+// tokens of context each, on a context of its own, and starts its worker.
+static LlamaEngine *engine_new(LlamaModelHandle *h, int n_parallel, int n_seq_ctx) {
+    struct llama_context_params cparams = handle_context_params(h);
+    cparams.n_seq_max = n_parallel;
+    cparams.n_ctx = (uint32_t)n_seq_ctx * n_parallel;
+    if ((int)cparams.n_batch < n_parallel) cparams.n_batch = n_parallel;
+    struct llama_context *ctx = init_context(h, h->model, cparams);
+    if (!ctx) {
+        fprintf(stderr, "llama engine: failed to create context for %d sequences\n", n_parallel);
+        return NULL;
+    }
+
+    LlamaEngine *e = new LlamaEngine();
+    e->h = h;
+    e->ctx = ctx;
+    e->n_batch = (int)llama_n_batch(ctx);
+    e->batch = llama_batch_init(e->n_batch, 0, 1);
+    e->n_parallel = n_parallel;
+    e->n_seq_ctx = (int)(llama_n_ctx(ctx) / n_parallel);
+    e->active.assign(n_parallel, NULL);
+    e->samplers.resize(n_parallel);
+    e->stopping = false;
+    e->n_users = 0;
+    e->n_requests = 0;
+    e->n_decode_calls = 0;
+    e->n_tokens_decoded = 0;
+    e->worker = std::thread(engine_loop, e);
+    return e;
+}
+
+// engine_acquire returns the running engine of h with a user reference
+// held, or NULL. The reference keeps a concurrent llama_engine_stop from
+// deleting the engine until engine_release.
+static LlamaEngine *engine_acquire(LlamaModelHandle *h) {
+    std::lock_guard<std::mutex> lock(h->engine_mu);
+    LlamaEngine *e = h->engine;
+    if (e) {
+        std::lock_guard<std::mutex> elock(e->mu);
+        e->n_users++;
+    }
+    return e;
+}
+
+static void engine_release(LlamaEngine *e) {
+    std::lock_guard<std::mutex> lock(e->mu);
+    if (--e->n_users == 0) e->cv_idle.notify_all();
+}
+
+int llama_engine_start(LlamaModelHandle *h, int n_parallel) {
+    if (!h || n_parallel <= 0) return -1;
+    std::lock_guard<std::mutex> lock(h->engine_mu);
+    if (h->engine) return 0;
+
+    // Every sequence gets the same context length as a single-sequence
+    // context of the handle.
+    LlamaEngine *e = engine_new(h, n_parallel, h->params.n_ctx);
+    if (!e) return -1;
+    h->engine = e;
+    return 0;
+}
+
+void llama_engine_stop(LlamaModelHandle *h) {
+    if (!h) return;
+    LlamaEngine *e;
+    {
+        std::lock_guard<std::mutex> lock(h->engine_mu);
+        e = h->engine;
+        h->engine = NULL;
+    }
+    engine_free(e);
+}
+
+int llama_engine_running(LlamaModelHandle *h) {
+    if (!h) return 0;
+    std::lock_guard<std::mutex> lock(h->engine_mu);
+    return h->engine ? 1 : 0;
+}
+
+char *llama_engine_predict(LlamaModelHandle *h, const char *prompt,
+                           int max_tokens, float temp, int top_k, float top_p) {
+    LlamaPredictParams p = llama_predict_params_default();
+    p.max_tokens = max_tokens;
+    p.temp = temp;
+    p.top_k = top_k;
+    p.top_p = top_p;
+    return llama_engine_predict_ex(h, prompt, &p);
+}
+
+// init_request tokenizes prompt into req and sets it up from p. Returns 1
+// when req is ready to submit, 0 when its output is empty without decoding
+// anything, and -1 on error.
+static int init_request(LlamaEngineRequest &req, LlamaModelHandle *h, const char *prompt,
+                        const LlamaPredictParams &p) {
+    if (!request_tokens(llama_model_get_vocab(h->model), prompt, p, req.prompt)) return -1;
+    if (req.prompt.empty() || p.max_tokens <= 0) return 0;
+
+    req.max_tokens = p.max_tokens;
+    req.temp = p.temp;
+    req.top_k = p.top_k;
+    req.top_p = p.top_p;
+    if (p.stop) req.stop.init(p.stop, p.n_stop);
+    req.cancel = p.cancel;
+    req.output.reserve((size_t)p.max_tokens * LLAMA_OUTPUT_BYTES_PER_TOKEN);
+    req.seq = -1;
+    req.n_fed = 0;
+    req.n_gen = 0;
+    req.n_evicted = 0;
+    req.next = 0;
+    req.i_logits = -1;
+    req.failed = false;
+    req.done = false;
+    return 1;
+}
+
+static bool fits(const LlamaEngine *e, const LlamaEngineRequest &req) {
+    if (req.prompt.size() < (size_t)e->n_seq_ctx) return true;
+    fprintf(stderr, "llama engine: prompt of %zu tokens exceeds the %d-token sequence context\n",
+            req.prompt.size(), e->n_seq_ctx);
+    return false;
+}
+
+// Queue reqs together and block until every one of them is done, so the
+// worker admits them side by side. Returns false if the engine is stopping.
+static bool submit_and_wait(LlamaEngine *e, const std::vector<LlamaEngineRequest *> &reqs) {
+    std::unique_lock<std::mutex> lock(e->mu);
+    if (e->stopping) return false;
+    for (LlamaEngineRequest *req : reqs) e->pending.push_back(req);
+    e->n_requests += reqs.size();
+    e->cv_work.notify_one();
+    e->cv_done.wait(lock, [&reqs] {
+        for (LlamaEngineRequest *req : reqs) if (!req->done) return false;
+        return true;
+    });
+    return true;
+}
+
+static char *request_output(const LlamaEngineRequest &req) {
+    if (req.failed) return NULL;
+    char *out = (char*)malloc(req.output.size() + 1);
+    if (!out) return NULL;
+    memcpy(out, req.output.data(), req.output.size());
+    out[req.output.size()] = '\0';
+    return out;
+}
+
+char *llama_engine_predict_ex(LlamaModelHandle *h, const char *prompt, const LlamaPredictParams *params) {
+    if (!h || !prompt) return NULL;
+    const LlamaPredictParams p = params ? *params : llama_predict_params_default();
+
+    LlamaEngine *e = engine_acquire(h);
+    if (!e) return NULL;
+    LlamaEngineRequest req;
+    char *out = NULL;
+    int rc = init_request(req, h, prompt, p);
+    if (rc == 0) {
+        out = (char*)calloc(1, 1);
+    } else if (rc > 0 && fits(e, req) && submit_and_wait(e, {&req})) {
+        out = request_output(req);
+    }
+    engine_release(e);
+    return out;
+}
+
+int llama_predict_batch(LlamaModelHandle *h, const char *const *prompts, int n,
+                        const LlamaPredictParams *params, char **outputs) {
+    if (!h || !prompts || !outputs || n < 0) return -1;
+
+    std::vector<LlamaEngineRequest> reqs((size_t)n);
+    std::vector<LlamaEngineRequest *> queued;
+    std::vector<int> constrained;
+    int n_seq_ctx = 0;
+    for (int i = 0; i < n; i++) {
+        outputs[i] = NULL;
+        const LlamaPredictParams p = params ? params[i] : llama_predict_params_default();
+        if (!prompts[i]) continue;
+        if (p.grammar && p.grammar[0]) {
+            constrained.push_back(i);
+            continue;
+        }
+        int rc = init_request(reqs[i], h, prompts[i], p);
+        if (rc == 0) outputs[i] = (char*)calloc(1, 1);
+        if (rc <= 0) continue;
+        queued.push_back(&reqs[i]);
+        int need = (int)reqs[i].prompt.size() + p.max_tokens + 1;
+        if (need > n_seq_ctx) n_seq_ctx = need;
+    }
+
+    if (!queued.empty()) {
+        // The running engine serves the batch alongside other callers;
+        // otherwise a one-off engine sized for the batch does.
+        LlamaEngine *e = engine_acquire(h);
+        const bool shared = e != NULL;
+        if (!e) {
+            if (n_seq_ctx > h->params.n_ctx) n_seq_ctx = h->params.n_ctx;
+            int n_parallel = queued.size() < LLAMA_BATCH_MAX_SEQS ? (int)queued.size() : LLAMA_BATCH_MAX_SEQS;
+            e = engine_new(h, n_parallel, n_seq_ctx);
+        }
+        if (e) {
+            size_t n_fit = 0;
+            for (LlamaEngineRequest *req : queued) {
+                if (fits(e, *req)) queued[n_fit++] = req;
+            }
+            queued.resize(n_fit);
+            if (submit_and_wait(e, queued)) {
+                for (LlamaEngineRequest *req : queued) outputs[req - reqs.data()] = request_output(*req);
+            }
+            if (shared) {
+                engine_release(e);
+            } else {
+                engine_free(e);
+            }
+        }
+    }
+
+    // The engine does not apply grammars.
+    for (int i : constrained) outputs[i] = llama_predict_ex(h, prompts[i], &params[i], NULL, NULL);
+
+    int n_ok = 0;
+    for (int i = 0; i < n; i++) n_ok += outputs[i] ? 1 : 0;
+    return n_ok;
+}
+
+void llama_get_engine_stats(LlamaModelHandle *h, LlamaEngineStats *out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    if (!h) return;
+    LlamaEngine *e = engine_acquire(h);
+    if (!e) return;
+    {
+        std::lock_guard<std::mutex> lock(e->mu);
+        out->n_parallel = e->n_parallel;
+        out->n_pending = (int)e->pending.size();
+        for (LlamaEngineRequest *r : e->active) if (r) out->n_active++;
+        out->n_requests = e->n_requests;
+        out->n_decode_calls = e->n_decode_calls;
+        out->n_tokens_decoded = e->n_tokens_decoded;
+    }
+    engine_release(e);
+}
@@ -0,0 +1,339 @@
+// Internal declarations shared by the C++ translation units of the wrapper.
+// Not part of the C API; only llama_wrapper.h is visible to Go.
+#ifndef LLAMA_INTERNAL_H
+#define LLAMA_INTERNAL_H
+
+#include "llama_wrapper.h"
+#include "llama.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct LlamaEngine;
+
+// TokenSampler picks the next token straight from a logits row. It stands in
+// for a top_k -> top_p -> temp -> dist llama_sampler chain: temperature <= 0
+// takes a vectorized argmax, otherwise the top k logits are selected with a
+// bounded heap in one pass instead of sorting the vocabulary. Its scratch
+// space and RNG live as long as the context it belongs to, so nothing is
+// allocated per token or per request.
+struct TokenSampler {
+    float temp = 0.8f;
+    int top_k = 40;
+    float top_p = 0.9f;
+
+    TokenSampler();
+    void configure(float temp, int top_k, float top_p);
+    llama_token sample(const float *logits, int32_t n_vocab);
+
+    // Sample subject to grammar (a llama_sampler_init_grammar sampler; NULL
+    // samples freely). The unconstrained choice is checked first and kept
+    // when the grammar allows it; only otherwise is the grammar applied to
+    // the whole vocabulary and the token drawn again from what it allows.
+    // The caller accepts the returned token into the grammar.
+    llama_token sample(const float *logits, int32_t n_vocab, struct llama_sampler *grammar);
+
+private:
+    std::mt19937 rng;
+    std::vector<llama_token_data> cand;
+    std::vector<llama_token_data> grammar_cand;
+    std::vector<float> masked;
+};
+
+// StopMatcher finds the first stop string in a byte stream fed piece by
+// piece (llama_stop.cpp). A match may span any number of pieces.
+struct StopMatcher {
+    // Compile the non-empty strings of stop[0, n_stop). Returns false, and
+    // matches nothing, if there are none.
+    bool init(const char *const *stop, int n_stop);
+    bool empty() const { return delta.empty(); }
+
+    // Feed n more bytes. Returns the stream offset at which the first
+    // complete stop string starts, or -1 if none has completed yet.
+    int64_t feed(const char *s, size_t n);
+
+    // Bytes at the end of the stream that could still begin a stop string;
+    // everything before them is final.
+    size_t pending() const { return delta.empty() ? 0 : (size_t)depth[state]; }
+
+private:
+    std::vector<uint8_t> cls;       // byte -> class; 0 = in no stop string
+    int n_cls = 0;
+    std::vector<int32_t> delta;     // state * n_cls + class -> state
+    std::vector<int32_t> depth;     // length of the prefix a state stands for
+    std::vector<int32_t> match_len; // longest stop string ending in a state
+    int32_t state = 0;
+    uint64_t n_fed = 0;
+};
+
+// Returns a fresh grammar sampler for gbnf (root rule "root"). The grammar
+// is parsed once per handle and cloned for every request; NULL if it does
+// not parse. The caller frees the clone with llama_sampler_free.
+struct llama_sampler *grammar_sampler(LlamaModelHandle *h, const char *gbnf);
+
+// True when grammar is in an accepting state, i.e. it would allow the end
+// of generation next.
+bool grammar_accepting(struct llama_sampler *grammar, const struct llama_vocab *vocab);
+
+// True when grammar allows nothing but the end of generation, i.e. the
+// output is a complete match that cannot grow. Generation stops there;
+// while the match could still grow, the constrained sampler decides
+// whether to end it.
+bool grammar_complete(struct llama_sampler *grammar, const struct llama_vocab *vocab);
+
+// Index of the largest of n values (the first one on ties).
+llama_token argmax_logits(const float *logits, int32_t n);
+
+// A pooled context together with the tokens currently held in its KV cache
+// (sequence 0). Keeping the history lets a later prompt that shares a prefix
+// with it skip re-decoding that prefix.
+struct LlamaContextSlot {
+    struct llama_context *ctx = NULL;
+    std::vector<llama_token> cached;
+    TokenSampler sampler;
+
+    // Context on the handle's draft model, created on first use, and the
+    // tokens it holds. It trails the target context and is re-synced from
+    // `cached` before every draft.
+    struct llama_context *draft_ctx = NULL;
+    std::vector<llama_token> draft_cached;
+};
+
+// The ggml threadpools one decode runs on: gen for single-token steps and
+// batch for prompt prefill, sized from n_threads and n_threads_batch. batch
+// is gen when the two sizes are the same.
+struct ThreadpoolLane {
+    struct ggml_threadpool *gen;
+    struct ggml_threadpool *batch;
+};
+
+// Compute threads for the contexts of every handle loaded with them
+// (llama_threads.cpp). A ggml threadpool runs one graph at a time, so the
+// pool's CPUs are split into as many lanes as fit a decode's threads, each
+// on CPUs of its own. A decode takes an idle lane, starting the next one on
+// first use, and waits for one to come back when all are busy, so the pool
+// never runs more threads than it has CPUs.
+struct LlamaThreadpool {
+    // gen threadpool parameters of every lane, each with the lane's CPUs;
+    // batch threadpools copy them with n_threads_batch.
+    std::vector<struct ggml_threadpool_params> lane_params;
+    int n_threads;
+    int n_threads_batch;
+    std::mutex mu;                    // guards the fields below
+    std::condition_variable cv;       // a lane was handed back
+    std::vector<ThreadpoolLane> idle; // not running a graph
+    std::vector<ThreadpoolLane> all;  // started (or starting), lane k on lane_params[k]
+    size_t n_lanes;                   // most lanes started; lowered if one fails to start
+    std::atomic<int> refs;
+};
+
+// A range of the process's address space.
+struct MappedRange {
+    char *addr;
+    size_t len;
+};
+
+// Model memory helpers (llama_mem.cpp). file_mappings lists the process's
+// mappings of the file at path; prefetch_file starts reading it into the
+// page cache; tune_mappings applies huge-page advice and prefaults ranges;
+// resident_bytes counts the bytes of ranges in memory.
+std::vector<MappedRange> file_mappings(const char *path);
+void prefetch_file(const char *path);
+void tune_mappings(const std::vector<MappedRange> &ranges, bool prefault, bool huge_pages);
+uint64_t resident_bytes(const std::vector<MappedRange> &ranges);
+
+// Add a reference to pool and return it; llama_threadpool_free drops one.
+LlamaThreadpool *threadpool_retain(LlamaThreadpool *pool);
+
+// Set mask[cpu] for every CPU in a list such as "0-3,8"; mask holds
+// GGML_MAX_N_THREADS entries. Returns false on a malformed list.
+bool parse_cpu_list(const char *s, bool *mask);
+
+// Load the model at path as configured by p: on a thread pinned to
+// p.numa_node's CPUs for LLAMA_NUMA_REPLICATE, so the pages of the copy it
+// reads are allocated on that node (llama_numa.cpp).
+struct llama_model *load_model_file(const char *path, const LlamaLoadParams &p);
+
+// Run fn on a thread pinned to the CPUs of node, so memory it touches first
+// is allocated there; node < 0 runs it on the calling thread.
+void run_on_node(int node, const std::function<void()> &fn);
+
+// The node h's replica lives on, or -1 when it is not a replica.
+int handle_numa_node(const LlamaModelHandle *h);
+
+struct LlamaModelHandle {
+    struct llama_model *model;
+
+    // References held by the caller of llama_load_model_ex, by
+    // llama_retain_model and by every open LlamaContextHandle. The model is
+    // freed when the last one is released.
+    std::atomic<int> refs;
+
+    // Resolved load parameters; every context created for the handle is
+    // configured from these (see handle_context_params). n_batch and
+    // n_ubatch are guarded by pool_mu; the rest is fixed after load.
+    LlamaLoadParams params;
+
+    // Threadpool every context of the handle computes on, holding a
+    // reference; NULL when contexts bring their own threads.
+    LlamaThreadpool *threadpool;
+
+    // Pool of ready contexts. A slot is taken out of `idle` for the duration
+    // of a prediction and handed back afterwards with its KV cache intact, so
+    // the next prediction only has to decode the part of its prompt that
+    // diverges from what the slot already holds.
+    std::mutex pool_mu;
+    std::vector<LlamaContextSlot *> idle;
+    int pool_size;
+    uint64_t n_created;
+    uint64_t n_reused;
+    uint64_t n_prefix_tokens;
+
+    // Continuous-batching engine, NULL until llama_engine_start is called.
+    // engine_mu guards the pointer; callers use the engine through
+    // engine_acquire so that llama_engine_stop cannot free it under them.
+    std::mutex engine_mu;
+    struct LlamaEngine *engine;
+
+    // Pooling context for llama_embed_batch, created on first use;
+    // embed_mu serializes its use.
+    std::mutex embed_mu;
+    struct llama_context *embed_ctx;
+
+    // Parsed grammars by GBNF text, cloned per request (grammar_sampler).
+    // Guarded by pool_mu.
+    std::unordered_map<std::string, struct llama_sampler *> grammars;
+
+    // Optional draft model for speculative decoding (llama_set_draft_model)
+    // and the number of tokens it drafts per step. Speculation counters are
+    // guarded by pool_mu.
+    struct llama_model *draft_model;
+    int n_draft;
+    uint64_t n_spec_steps;
+    uint64_t n_drafted;
+    uint64_t n_draft_accepted;
+    uint64_t n_lookup_drafted;  // subset of n_drafted proposed by prompt lookup
+    uint64_t n_lookup_accepted; // subset of n_draft_accepted from prompt lookup
+
+    // Context shifting counters, guarded by pool_mu.
+    uint64_t n_shifts;
+    uint64_t n_evicted_tokens;
+
+    // Wall time of the load and the handle's mappings of the model file
+    // (empty when it was read into memory).
+    double load_ms;
+    std::vector<MappedRange> weight_maps;
+
+    // Detokenization table built once at load: the piece of token i is the
+    // NUL-terminated string at piece_arena[piece_offsets[i]].
+    std::vector<char> piece_arena;
+    std::vector<uint32_t> piece_offsets;
+};
+
+// A context owned by one caller instead of the handle's pool. Its mutex
+// serializes predictions on it; predictions on different contexts of the
+// same model run concurrently.
+struct LlamaContextHandle {
+    LlamaModelHandle *h;
+    std::mutex mu;
+    LlamaContextSlot slot;
+};
+
+struct LlamaCancelFlag {
+    std::atomic<bool> set{false};
+};
+
+// True once the request owning c has been cancelled.
+inline bool cancelled(const LlamaCancelFlag *c) {
+    return c && c->set.load(std::memory_order_relaxed);
+}
+
+// ggml abort callback for a context decoding one request: data is the
+// request's LlamaCancelFlag (llama_wrapper.cpp).
+bool abort_if_cancelled(void *data);
+
+// Initial output capacity per requested token; output buffers grow
+// geometrically past that, so this only avoids early reallocations.
+#define LLAMA_OUTPUT_BYTES_PER_TOKEN 4
+
+// Malloc-backed output string that grows geometrically; release() hands the
+// buffer to the caller, who frees it with llama_free_string.
+struct OutputBuffer {
+    char *data = NULL;
+    size_t len = 0;
+    size_t cap = 0;
+
+    bool init(size_t capacity);
+    bool append(const char *s, size_t n);
+    void truncate(size_t n);
+    char *release();
+    ~OutputBuffer();
+};
+
+// Load parameters with unset (<= 0) fields replaced by defaults and the
+// batch sizes clamped to the context length.
+LlamaLoadParams resolve_params(const LlamaLoadParams *in);
+
+// llama.cpp's backend is process-wide state. Every model and vocabulary
+// handle holds a reference; the first initializes the backend and the last
+// frees it (llama_registry.cpp).
+void backend_acquire(void);
+void backend_release(void);
+
+// Context parameters every context created for h starts from. Takes
+// h->pool_mu, so it must not be called with it held.
+struct llama_context_params handle_context_params(LlamaModelHandle *h);
+
+// Create a context of model (h's model or its draft model) for h, attached
+// to h's threadpool if it has one (llama_threads.cpp).
+struct llama_context *init_context(LlamaModelHandle *h, struct llama_model *model,
+                                   struct llama_context_params cparams);
+
+// llama_decode on a context created by init_context for h, on a ggml
+// threadpool of h's pool that no other decode is using.
+int handle_decode(LlamaModelHandle *h, struct llama_context *ctx, struct llama_batch batch);
+
+// Tokenize text into out, growing it as needed. Returns false on error.
+bool tokenize_text(const struct llama_vocab *vocab, const char *text, std::vector<llama_token> &out,
+                   bool add_special = true);
+
+// Tokenize the prompt of a request: the caller's prefix tokens followed by
+// the rest of prompt, or all of prompt when p has no prefix (llama_tokens.cpp).
+bool request_tokens(const struct llama_vocab *vocab, const char *prompt, const LlamaPredictParams &p,
+                    std::vector<llama_token> &out);
+
+// Return the NUL-terminated piece of token id and store its length in len.
+const char *token_piece(const LlamaModelHandle *h, llama_token id, size_t *len);
+
+// Context pool helpers (llama_wrapper.cpp). acquire_context takes the idle
+// slot sharing the longest prefix with tokens, or creates one; release_context
+// returns it to the pool, or frees it when the pool is full.
+LlamaContextSlot *acquire_context(LlamaModelHandle *h, const llama_token *tokens, size_t n_tokens);
+void release_context(LlamaModelHandle *h, LlamaContextSlot *slot);
+void clear_slot(LlamaContextSlot *slot);
+
+// Trim the slot's KV cache to its common prefix with tokens, leaving at least
+// one token to decode. Returns the number of tokens kept.
+size_t reuse_prefix(LlamaContextSlot *slot, const llama_token *tokens, size_t n_tokens);
+
+// Decode tokens[from, n_tokens) into sequence 0 of a context of h, in n_batch
+// chunks. Returns 0 on success or the failing llama_decode result.
+int decode_prompt(LlamaModelHandle *h, struct llama_context *ctx, const llama_token *tokens, int32_t from,
+                  int32_t n_tokens);
+
+// Make room in sequence seq of ctx, which holds positions [0, n_past), when
+// h has context shifting enabled: positions [n_sink, n_sink + n) are evicted
+// and the ones after them moved down by n. Returns n, or 0 if nothing could
+// be evicted (llama_shift.cpp).
+int32_t shift_context(LlamaModelHandle *h, struct llama_context *ctx, llama_seq_id seq, int32_t n_past);
+
+// Stop the engine's worker thread, fail any request still queued, and free it.
+void engine_free(struct LlamaEngine *e);
+
+#endif // LLAMA_INTERNAL_H
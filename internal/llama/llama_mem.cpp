@@ -0,0 +1,127 @@
+// Model memory: prefaulting, huge pages and residency.
+//
+// A mapped model is read lazily: every page of the weights costs a fault the
+// first time a decode touches it, so the first prediction after a cold load
+// runs at disk speed. Prefaulting moves that cost to load time, where it is
+// paid once with large sequential reads. The weights are found as the
+// process's mappings of the model file that appeared during the load.
+#include "llama_internal.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+#endif
+
+std::vector<MappedRange> file_mappings(const char *path) {
+    std::vector<MappedRange> out;
+#if defined(__linux__)
+    struct stat st;
+    if (stat(path, &st) != 0) return out;
+    FILE *f = fopen("/proc/self/maps", "r");
+    if (!f) return out;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long start, end, inode;
+        unsigned int dev_major, dev_minor;
+        if (sscanf(line, "%lx-%lx %*s %*s %x:%x %lu", &start, &end, &dev_major, &dev_minor, &inode) != 5) {
+            continue;
+        }
+        if (inode != (unsigned long)st.st_ino || makedev(dev_major, dev_minor) != st.st_dev) continue;
+        out.push_back({(char *)start, (size_t)(end - start)});
+    }
+    fclose(f);
+#else
+    (void)path;
+#endif
+    return out;
+}
+
+void prefetch_file(const char *path) {
+#if defined(__linux__)
+    // Start readahead of the whole file into the page cache; the loader's
+    // reads or faults then find most pages already there.
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+#else
+    (void)path;
+#endif
+}
+
+void tune_mappings(const std::vector<MappedRange> &ranges, bool prefault, bool huge_pages) {
+#if defined(__linux__)
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    for (const MappedRange &r : ranges) {
+        if (huge_pages) {
+            // Effective where the kernel backs read-only file mappings with
+            // huge pages; collapsing now needs Linux 6.1, otherwise
+            // khugepaged does it in the background.
+            madvise(r.addr, r.len, MADV_HUGEPAGE);
+            if (prefault) madvise(r.addr, r.len, MADV_COLLAPSE);
+        }
+        if (prefault && madvise(r.addr, r.len, MADV_POPULATE_READ) != 0) {
+            // Before Linux 5.14: fault the pages in by reading one byte of each.
+            volatile char sink = 0;
+            for (size_t off = 0; off < r.len; off += page) sink += r.addr[off];
+            (void)sink;
+        }
+    }
+#else
+    (void)ranges;
+    (void)prefault;
+    (void)huge_pages;
+#endif
+}
+
+uint64_t resident_bytes(const std::vector<MappedRange> &ranges) {
+    uint64_t n = 0;
+#if defined(__linux__)
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> vec;
+    for (const MappedRange &r : ranges) {
+        vec.resize((r.len + page - 1) / page);
+        if (mincore(r.addr, r.len, vec.data()) != 0) continue;
+        for (unsigned char v : vec) n += (v & 1) ? page : 0;
+    }
+#else
+    (void)ranges;
+#endif
+    return n;
+}
+
+// Resident set size of the process, or 0 where it cannot be read.
+static uint64_t process_rss_bytes(void) {
+#if defined(__linux__)
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long size = 0, rss = 0;
+    int n = fscanf(f, "%lu %lu", &size, &rss);
+    fclose(f);
+    return n == 2 ? (uint64_t)rss * (uint64_t)sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+void llama_get_load_stats(LlamaModelHandle *h, LlamaLoadStats *out) {
+    if (!h || !out) return;
+    out->load_ms = h->load_ms;
+    out->model_bytes = llama_model_size(h->model);
+    out->mapped_bytes = 0;
+    for (const MappedRange &r : h->weight_maps) out->mapped_bytes += r.len;
+    out->resident_bytes = h->weight_maps.empty() ? out->model_bytes : resident_bytes(h->weight_maps);
+    out->rss_bytes = process_rss_bytes();
+}
@@ -0,0 +1,128 @@
+// NUMA placement.
+//
+// Memory is allocated on the node of the CPU that first touches it. A mapped
+// model is first read by whichever thread faults it in, and its pages belong
+// to the page cache, so every handle of the file shares the one copy
+// wherever it landed. A replica is instead read into private memory by a
+// thread pinned to its node, and the contexts of its handle are created and
+// computed there as well, so decoding only reads local memory.
+#include "llama_internal.h"
+#include <stdio.h>
+#include <string.h>
+
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Highest node id looked for; ids may be sparse.
+#define LLAMA_MAX_NUMA_NODES 64
+
+// CPU lists of the nodes that have CPUs, in node order. Empty when the host
+// does not report its topology.
+static const std::vector<std::string> &numa_node_cpus() {
+    static const std::vector<std::string> nodes = [] {
+        std::vector<std::string> out;
+#if defined(__linux__)
+        for (int node = 0; node < LLAMA_MAX_NUMA_NODES; node++) {
+            char path[96];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            FILE *f = fopen(path, "r");
+            if (!f) continue;
+            char buf[4096];
+            if (fgets(buf, sizeof(buf), f)) {
+                buf[strcspn(buf, "\n")] = '\0';
+                if (buf[0]) out.push_back(buf); // memory-only nodes have no CPUs
+            }
+            fclose(f);
+        }
+#endif
+        return out;
+    }();
+    return nodes;
+}
+
+int llama_numa_nodes(void) {
+    const size_t n = numa_node_cpus().size();
+    return n > 0 ? (int)n : 1;
+}
+
+int llama_numa_node_cpus(int node, char *out, int n_out) {
+    if (node < 0 || node >= llama_numa_nodes()) return -1;
+    const auto &nodes = numa_node_cpus();
+    // Without topology the single node is every CPU: an empty list.
+    const char *cpus = nodes.empty() ? "" : nodes[node].c_str();
+    if (out && n_out > 0) snprintf(out, (size_t)n_out, "%s", cpus);
+    return (int)strlen(cpus);
+}
+
+void run_on_node(int node, const std::function<void()> &fn) {
+#if defined(__linux__)
+    const auto &nodes = numa_node_cpus();
+    if (node >= 0 && node < (int)nodes.size()) {
+        std::thread t([&] {
+            bool mask[GGML_MAX_N_THREADS];
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (parse_cpu_list(nodes[node].c_str(), mask)) {
+                for (int cpu = 0; cpu < GGML_MAX_N_THREADS && cpu < CPU_SETSIZE; cpu++) {
+                    if (mask[cpu]) CPU_SET(cpu, &set);
+                }
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            }
+            fn();
+        });
+        t.join();
+        return;
+    }
+#endif
+    (void)node;
+    fn();
+}
+
+int handle_numa_node(const LlamaModelHandle *h) {
+    return h->params.numa == LLAMA_NUMA_REPLICATE ? h->params.numa_node : -1;
+}
+
+// llama.cpp's NUMA mode is process-wide and set once.
+static void numa_init(LlamaNumaStrategy strategy) {
+    static std::once_flag once;
+    static LlamaNumaStrategy applied = LLAMA_NUMA_NONE;
+    std::call_once(once, [&] {
+        applied = strategy;
+        llama_numa_init(strategy == LLAMA_NUMA_ISOLATE ? GGML_NUMA_STRATEGY_ISOLATE
+                                                       : GGML_NUMA_STRATEGY_DISTRIBUTE);
+    });
+    if (applied != strategy) {
+        fprintf(stderr, "NUMA strategy %d already set for this process; ignoring %d\n", (int)applied,
+                (int)strategy);
+    }
+}
+
+struct llama_model *load_model_file(const char *path, const LlamaLoadParams &p) {
+    struct llama_model_params mparams = llama_model_default_params();
+    mparams.n_gpu_layers = 0;
+    mparams.use_mmap = p.use_mmap != 0;
+    mparams.use_mlock = p.use_mlock != 0;
+
+    int node = -1;
+    switch (p.numa) {
+    case LLAMA_NUMA_DISTRIBUTE:
+    case LLAMA_NUMA_ISOLATE:
+        numa_init(p.numa);
+        break;
+    case LLAMA_NUMA_REPLICATE:
+        // Mapped pages would be shared with the other replicas.
+        mparams.use_mmap = false;
+        node = p.numa_node;
+        break;
+    default:
+        break;
+    }
+
+    struct llama_model *model = NULL;
+    run_on_node(node, [&] { model = llama_model_load_from_file(path, mparams); });
+    return model;
+}
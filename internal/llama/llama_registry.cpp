@@ -0,0 +1,168 @@
+// Backend lifetime and the model registry.
+//
+// llama_backend_init and llama_backend_free set up and tear down state shared
+// by every model in the process, so they are reference counted here rather
+// than paired with each load.
+//
+// The registry is a short list of loaded models keyed by canonical path,
+// resolved load parameters and draft model. A process touches a handful of
+// models, so lookups and eviction scan the list under one mutex; loads
+// happen under it too, which also keeps two callers from loading the same
+// model at once.
+#include "llama_internal.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sys/stat.h>
+
+static std::mutex backend_mu;
+static int backend_refs = 0;
+
+void backend_acquire(void) {
+    std::lock_guard<std::mutex> lock(backend_mu);
+    if (backend_refs++ == 0) llama_backend_init();
+}
+
+void backend_release(void) {
+    std::lock_guard<std::mutex> lock(backend_mu);
+    if (--backend_refs == 0) llama_backend_free();
+}
+
+struct RegistryEntry {
+    std::string key;
+    LlamaModelHandle *h; // the registry's reference
+    uint64_t bytes;      // weights of the model and its draft model
+    uint64_t last_used;  // registry_tick of the last acquire
+};
+
+static std::mutex registry_mu;
+static std::vector<RegistryEntry> registry;
+static uint64_t registry_bytes = 0;
+static uint64_t registry_budget = 0;
+static uint64_t registry_tick = 0;
+static uint64_t registry_hits = 0;
+static uint64_t registry_loads = 0;
+static uint64_t registry_evictions = 0;
+
+static bool entry_idle(const RegistryEntry &e) {
+    return e.h->refs.load(std::memory_order_acquire) == 1;
+}
+
+static std::string registry_key(const char *path, const LlamaLoadParams &p, const char *draft_path,
+                                int n_draft) {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "|ctx=%d,%d,%d|thr=%d,%d,%p|fa=%d|mm=%d,%d,%d,%d|kv=%d,%d|numa=%d,%d|shift=%d,%d|draft=%d|",
+             p.n_ctx, p.n_batch, p.n_ubatch, p.n_threads, p.n_threads_batch, (void *)p.threadpool,
+             p.flash_attn, p.use_mmap, p.use_mlock, p.prefault, p.huge_pages, (int)p.type_k, (int)p.type_v,
+             (int)p.numa, p.numa_node, p.ctx_shift, p.n_sink, draft_path ? n_draft : 0);
+    return std::string(path) + buf + (draft_path ? draft_path : "");
+}
+
+// Close idle models, least recently used first, until need more bytes fit
+// within the budget or no idle model is left. Caller holds registry_mu.
+static void evict_locked(uint64_t need) {
+    if (registry_budget == 0) return;
+    while (registry_bytes + need > registry_budget) {
+        size_t victim = registry.size();
+        for (size_t i = 0; i < registry.size(); i++) {
+            if (!entry_idle(registry[i])) continue;
+            if (victim == registry.size() || registry[i].last_used < registry[victim].last_used) victim = i;
+        }
+        if (victim == registry.size()) return;
+        llama_close_model(registry[victim].h);
+        registry_bytes -= registry[victim].bytes;
+        registry.erase(registry.begin() + victim);
+        registry_evictions++;
+    }
+}
+
+static uint64_t file_size(const char *path) {
+    struct stat st;
+    return path && stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+LlamaModelHandle *llama_registry_acquire(const char *model_path, const LlamaLoadParams *params,
+                                         const char *draft_path, int n_draft) {
+    if (!model_path) return NULL;
+    char canon[PATH_MAX], draft_canon[PATH_MAX];
+    if (!realpath(model_path, canon)) {
+        fprintf(stderr, "Model file not found: %s\n", model_path);
+        return NULL;
+    }
+    if (draft_path && !realpath(draft_path, draft_canon)) {
+        fprintf(stderr, "Draft model file not found: %s\n", draft_path);
+        return NULL;
+    }
+    if (draft_path) draft_path = draft_canon;
+    const std::string key = registry_key(canon, resolve_params(params), draft_path, n_draft);
+
+    std::lock_guard<std::mutex> lock(registry_mu);
+    registry_tick++;
+    for (RegistryEntry &e : registry) {
+        if (e.key != key) continue;
+        e.last_used = registry_tick;
+        registry_hits++;
+        return llama_retain_model(e.h);
+    }
+
+    // Make room for the file sizes, a close estimate of the weights.
+    evict_locked(file_size(canon) + file_size(draft_path));
+    LlamaModelHandle *h = llama_load_model_ex(canon, params);
+    if (!h) return NULL;
+    if (draft_path && llama_set_draft_model(h, draft_path, n_draft) != 0) {
+        llama_close_model(h);
+        return NULL;
+    }
+    uint64_t bytes = llama_model_size(h->model);
+    if (h->draft_model) bytes += llama_model_size(h->draft_model);
+    registry.push_back({key, h, bytes, registry_tick});
+    registry_bytes += bytes;
+    registry_loads++;
+    // The caller's reference keeps the new model from being evicted itself.
+    llama_retain_model(h);
+    evict_locked(0);
+    return h;
+}
+
+void llama_registry_release(LlamaModelHandle *h) {
+    if (!h) return;
+    std::lock_guard<std::mutex> lock(registry_mu);
+    llama_close_model(h);
+    evict_locked(0);
+}
+
+void llama_registry_set_budget(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(registry_mu);
+    registry_budget = bytes;
+    evict_locked(0);
+}
+
+int llama_registry_evict_idle(void) {
+    std::lock_guard<std::mutex> lock(registry_mu);
+    int n = 0;
+    for (size_t i = 0; i < registry.size();) {
+        if (!entry_idle(registry[i])) {
+            i++;
+            continue;
+        }
+        llama_close_model(registry[i].h);
+        registry_bytes -= registry[i].bytes;
+        registry.erase(registry.begin() + i);
+        n++;
+    }
+    return n;
+}
+
+void llama_registry_get_stats(LlamaRegistryStats *out) {
+    if (!out) return;
+    std::lock_guard<std::mutex> lock(registry_mu);
+    out->n_models = (int)registry.size();
+    out->n_idle = 0;
+    for (const RegistryEntry &e : registry) out->n_idle += entry_idle(e) ? 1 : 0;
+    out->bytes = registry_bytes;
+    out->budget = registry_budget;
+    out->n_hits = registry_hits;
+    out->n_loads = registry_loads;
+    out->n_evictions = registry_evictions;
+}
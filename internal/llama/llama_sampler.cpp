@@ -0,0 +1,199 @@
+// Token sampling straight from logits rows.
+//
+// Equivalent to the top_k -> top_p -> temp -> dist llama_sampler chain the
+// wrapper used to build for every request, without materializing or sorting
+// the whole vocabulary for every token.
+#include "llama_internal.h"
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+llama_token argmax_logits(const float *x, int32_t n) {
+    if (n <= 0) return 0;
+    int32_t i = 0;
+    float best = x[0];
+
+    // Vectorized maximum, then a scalar scan for its first position; the
+    // scan stops early and is branch-predictable.
+#if defined(__AVX__)
+    if (n >= 8) {
+        __m256 vmax = _mm256_loadu_ps(x);
+        for (i = 8; i + 8 <= n; i += 8) vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(x + i));
+        __m128 m = _mm_max_ps(_mm256_castps256_ps128(vmax), _mm256_extractf128_ps(vmax, 1));
+        m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+        m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+        best = _mm_cvtss_f32(m);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    if (n >= 4) {
+        __m128 m = _mm_loadu_ps(x);
+        for (i = 4; i + 4 <= n; i += 4) m = _mm_max_ps(m, _mm_loadu_ps(x + i));
+        m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+        m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+        best = _mm_cvtss_f32(m);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    if (n >= 4) {
+        float32x4_t m = vld1q_f32(x);
+        for (i = 4; i + 4 <= n; i += 4) m = vmaxq_f32(m, vld1q_f32(x + i));
+        best = vmaxvq_f32(m);
+    }
+#endif
+    for (; i < n; i++) {
+        if (x[i] > best) best = x[i];
+    }
+    for (int32_t j = 0; j < n; j++) {
+        if (x[j] == best) return j;
+    }
+    return 0;
+}
+
+TokenSampler::TokenSampler() : rng(std::random_device{}()) {}
+
+void TokenSampler::configure(float t, int k, float p) {
+    temp = t;
+    top_k = k;
+    top_p = p;
+}
+
+static bool logit_greater(const llama_token_data &a, const llama_token_data &b) {
+    return a.logit > b.logit;
+}
+
+llama_token TokenSampler::sample(const float *logits, int32_t n_vocab) {
+    if (temp <= 0.0f || top_k == 1) return argmax_logits(logits, n_vocab);
+
+    // Top-k: keep the k largest logits in a min-heap whose front is the
+    // smallest one kept, so most of the vocabulary costs one comparison.
+    cand.clear();
+    if (top_k <= 0 || top_k >= n_vocab) {
+        cand.resize(n_vocab);
+        for (int32_t i = 0; i < n_vocab; i++) cand[i] = {i, logits[i], 0.0f};
+        std::sort(cand.begin(), cand.end(), logit_greater);
+    } else {
+        const size_t k = (size_t)top_k;
+        cand.reserve(k);
+        for (int32_t i = 0; i < n_vocab; i++) {
+            const float l = logits[i];
+            if (cand.size() < k) {
+                cand.push_back({i, l, 0.0f});
+                if (cand.size() == k) std::make_heap(cand.begin(), cand.end(), logit_greater);
+            } else if (l > cand.front().logit) {
+                std::pop_heap(cand.begin(), cand.end(), logit_greater);
+                cand.back() = {i, l, 0.0f};
+                std::push_heap(cand.begin(), cand.end(), logit_greater);
+            }
+        }
+        std::sort_heap(cand.begin(), cand.end(), logit_greater); // descending
+    }
+    if (cand.empty()) return 0;
+
+    // Top-p on the untempered distribution, as in the chain where top_p
+    // precedes temp: keep the shortest prefix reaching top_p of the mass.
+    const float max_l = cand[0].logit;
+    size_t n = cand.size();
+    if (top_p < 1.0f) {
+        float sum = 0.0f;
+        for (size_t i = 0; i < n; i++) {
+            cand[i].p = expf(cand[i].logit - max_l);
+            sum += cand[i].p;
+        }
+        const float limit = top_p * sum;
+        float cum = 0.0f;
+        for (size_t i = 0; i < n; i++) {
+            cum += cand[i].p;
+            if (cum >= limit) {
+                n = i + 1;
+                break;
+            }
+        }
+    }
+
+    // Temperature, then draw from the remaining candidates.
+    float total = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        cand[i].p = expf((cand[i].logit - max_l) / temp);
+        total += cand[i].p;
+    }
+    float r = std::uniform_real_distribution<float>(0.0f, total)(rng);
+    for (size_t i = 0; i < n; i++) {
+        r -= cand[i].p;
+        if (r < 0.0f) return cand[i].id;
+    }
+    return cand[n - 1].id;
+}
+
+llama_token TokenSampler::sample(const float *logits, int32_t n_vocab, struct llama_sampler *grammar) {
+    llama_token id = sample(logits, n_vocab);
+    if (!grammar) return id;
+
+    // Most tokens a model samples under a grammar are allowed anyway, so a
+    // one-token check saves masking the vocabulary at nearly every step.
+    llama_token_data one = {id, 1.0f, 0.0f};
+    llama_token_data_array single = {&one, 1, -1, false};
+    llama_sampler_apply(grammar, &single);
+    if (!isinf(one.logit)) return id;
+
+    grammar_cand.resize(n_vocab);
+    for (int32_t i = 0; i < n_vocab; i++) grammar_cand[i] = {i, logits[i], 0.0f};
+    llama_token_data_array all = {grammar_cand.data(), grammar_cand.size(), -1, false};
+    llama_sampler_apply(grammar, &all);
+    masked.resize(n_vocab);
+    for (int32_t i = 0; i < n_vocab; i++) masked[grammar_cand[i].id] = grammar_cand[i].logit;
+    return sample(masked.data(), n_vocab);
+}
+
+struct llama_sampler *grammar_sampler(LlamaModelHandle *h, const char *gbnf) {
+    {
+        std::lock_guard<std::mutex> lock(h->pool_mu);
+        auto it = h->grammars.find(gbnf);
+        if (it != h->grammars.end()) return llama_sampler_clone(it->second);
+    }
+
+    // Parse outside the lock; a concurrent request for the same grammar
+    // may parse it too, and the first one stored wins.
+    struct llama_sampler *g = llama_sampler_init_grammar(llama_model_get_vocab(h->model), gbnf, "root");
+    if (!g) {
+        fprintf(stderr, "Failed to parse grammar\n");
+        return NULL;
+    }
+    std::lock_guard<std::mutex> lock(h->pool_mu);
+    auto ins = h->grammars.emplace(gbnf, g);
+    if (!ins.second) llama_sampler_free(g);
+    return llama_sampler_clone(ins.first->second);
+}
+
+bool grammar_accepting(struct llama_sampler *grammar, const struct llama_vocab *vocab) {
+    llama_token eog = llama_vocab_eos(vocab);
+    if (eog == LLAMA_TOKEN_NULL) eog = llama_vocab_eot(vocab);
+    if (eog == LLAMA_TOKEN_NULL) return false;
+    llama_token_data one = {eog, 1.0f, 0.0f};
+    llama_token_data_array single = {&one, 1, -1, false};
+    llama_sampler_apply(grammar, &single);
+    return !isinf(one.logit);
+}
+
+bool grammar_complete(struct llama_sampler *grammar, const struct llama_vocab *vocab) {
+    // Most states either reject the end of generation or are still inside
+    // a token; only accepting ones pay for a pass over the vocabulary.
+    if (!grammar_accepting(grammar, vocab)) return false;
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+    static thread_local std::vector<llama_token_data> cand;
+    cand.resize((size_t)n_vocab);
+    for (int32_t i = 0; i < n_vocab; i++) cand[i] = {i, 0.0f, 0.0f};
+    llama_token_data_array all = {cand.data(), cand.size(), -1, false};
+    llama_sampler_apply(grammar, &all);
+    for (size_t i = 0; i < all.size; i++) {
+        if (!isinf(all.data[i].logit) && !llama_vocab_is_eog(vocab, all.data[i].id)) return false;
+    }
+    return true;
+}
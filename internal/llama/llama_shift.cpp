@@ -0,0 +1,38 @@
+// Context shifting.
+//
+// A generation that reaches the end of its context has to stop unless old
+// tokens make room. Attention concentrates heavily on the first few
+// positions of a sequence whatever they hold, so those "sink" tokens are
+// always kept: evicting them degrades the output far more than evicting
+// anything after them. A shift removes the older half of the tokens after
+// the sinks and moves the rest down with llama_memory_seq_add; llama.cpp
+// re-rotates their keys to the new positions on the next decode. The cache
+// then holds the sinks plus a sliding window of recent tokens, so generation
+// continues in bounded memory.
+#include "llama_internal.h"
+#include <string.h>
+
+int32_t shift_context(LlamaModelHandle *h, struct llama_context *ctx, llama_seq_id seq, int32_t n_past) {
+    if (!h->params.ctx_shift) return 0;
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (!llama_memory_can_shift(mem)) return 0;
+    const int32_t n_keep = h->params.n_sink;
+    const int32_t n_discard = (n_past - n_keep) / 2;
+    if (n_discard <= 0) return 0;
+    if (!llama_memory_seq_rm(mem, seq, n_keep, n_keep + n_discard)) return 0;
+    llama_memory_seq_add(mem, seq, n_keep + n_discard, n_past, -n_discard);
+
+    std::lock_guard<std::mutex> lock(h->pool_mu);
+    h->n_shifts++;
+    h->n_evicted_tokens += (uint64_t)n_discard;
+    return n_discard;
+}
+
+void llama_get_shift_stats(LlamaModelHandle *h, LlamaShiftStats *out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    if (!h) return;
+    std::lock_guard<std::mutex> lock(h->pool_mu);
+    out->n_shifts = h->n_shifts;
+    out->n_evicted_tokens = h->n_evicted_tokens;
+}
@@ -0,0 +1,265 @@
+// Prompt state persistence.
+//
+// A state file holds one sequence of a pooled context: the prompt tokens it
+// was decoded from and the KV cache bytes produced by llama_state_seq_get_data.
+//
+//   LlamaStateHeader | llama_token[n_tokens] | uint8_t[n_state]
+//
+// Restoring hands the mapped file straight to llama_state_seq_set_data, so a
+// state that is already in the page cache loads without an intermediate copy.
+#include "llama_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define LLAMA_STATE_MAGIC   0x54534c4cu // "LLST"
+#define LLAMA_STATE_VERSION 1
+
+struct LlamaStateHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t n_tokens;
+    uint32_t n_vocab;  // guards against loading a state saved from another model
+    uint64_t n_state;  // bytes of sequence state following the tokens
+};
+
+// StateFile is a read-only view of a state file: memory-mapped where the
+// platform supports it, read into memory otherwise.
+struct StateFile {
+    const uint8_t *data = NULL;
+    size_t size = 0;
+    void *map = NULL;
+    std::vector<uint8_t> buf;
+
+    bool open(const char *path);
+    ~StateFile();
+};
+
+bool StateFile::open(const char *path) {
+#ifndef _WIN32
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            // The state is consumed front to back exactly once.
+            posix_madvise(p, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+            map = p;
+            data = (const uint8_t *)p;
+            size = (size_t)st.st_size;
+            ::close(fd);
+            return true;
+        }
+    }
+    ::close(fd);
+#endif
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    bool ok = fseek(f, 0, SEEK_END) == 0;
+    long n = ok ? ftell(f) : -1;
+    ok = n >= 0 && fseek(f, 0, SEEK_SET) == 0;
+    if (ok) {
+        buf.resize((size_t)n);
+        ok = n == 0 || fread(buf.data(), 1, (size_t)n, f) == (size_t)n;
+    }
+    fclose(f);
+    if (!ok) return false;
+    data = buf.data();
+    size = buf.size();
+    return true;
+}
+
+StateFile::~StateFile() {
+#ifndef _WIN32
+    if (map) munmap(map, size);
+#endif
+}
+
+// write_state writes the sequence 0 state of slot to path. The file is
+// written next to path and renamed into place so a concurrent reader never
+// maps a partially written state.
+static bool write_state(const LlamaModelHandle *h, const LlamaContextSlot *slot, const char *path) {
+    const size_t n_state = llama_state_seq_get_size(slot->ctx, 0);
+    std::vector<uint8_t> state(n_state);
+    if (n_state == 0 || llama_state_seq_get_data(slot->ctx, state.data(), n_state, 0) != n_state) {
+        fprintf(stderr, "Failed to read sequence state\n");
+        return false;
+    }
+
+    LlamaStateHeader hdr;
+    hdr.magic = LLAMA_STATE_MAGIC;
+    hdr.version = LLAMA_STATE_VERSION;
+    hdr.n_tokens = (uint32_t)slot->cached.size();
+    hdr.n_vocab = (uint32_t)llama_vocab_n_tokens(llama_model_get_vocab(h->model));
+    hdr.n_state = n_state;
+
+    std::string tmp = std::string(path) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    bool ok = f != NULL &&
+              fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(slot->cached.data(), sizeof(llama_token), slot->cached.size(), f) == slot->cached.size() &&
+              fwrite(state.data(), 1, n_state, f) == n_state;
+    if (f && fclose(f) != 0) ok = false;
+    if (ok) {
+#ifdef _WIN32
+        remove(path); // rename does not replace an existing file on Windows
+#endif
+        ok = rename(tmp.c_str(), path) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to write prompt state to %s\n", path);
+        remove(tmp.c_str());
+    }
+    return ok;
+}
+
+// save_slot decodes tokens into slot, which the caller holds exclusively,
+// and writes the resulting state to path. Returns the number of tokens
+// saved or -1.
+static int save_slot(LlamaModelHandle *h, LlamaContextSlot *slot, std::vector<llama_token> &tokens, const char *path) {
+    int32_t n_tokens = (int32_t)tokens.size();
+    const int32_t n_ctx = (int32_t)llama_n_ctx(slot->ctx);
+    if (n_tokens >= n_ctx) {
+        fprintf(stderr, "Prompt of %d tokens does not fit the %d-token context\n", n_tokens, n_ctx);
+        return -1;
+    }
+    size_t n_keep = reuse_prefix(slot, tokens.data(), n_tokens);
+    if (decode_prompt(h, slot->ctx, tokens.data(), (int32_t)n_keep, n_tokens) != 0) {
+        clear_slot(slot);
+        return -1;
+    }
+    slot->cached.swap(tokens);
+    return write_state(h, slot, path) ? n_tokens : -1;
+}
+
+// open_state maps path and validates its header against h.
+static bool open_state(const LlamaModelHandle *h, const char *path, StateFile &file, LlamaStateHeader &hdr) {
+    if (!file.open(path)) {
+        fprintf(stderr, "Failed to open prompt state %s\n", path);
+        return false;
+    }
+    if (file.size < sizeof(hdr)) {
+        fprintf(stderr, "Prompt state %s is truncated\n", path);
+        return false;
+    }
+    memcpy(&hdr, file.data, sizeof(hdr));
+    if (hdr.magic != LLAMA_STATE_MAGIC || hdr.version != LLAMA_STATE_VERSION) {
+        fprintf(stderr, "%s is not a prompt state file\n", path);
+        return false;
+    }
+    if (hdr.n_tokens == 0 || file.size != sizeof(hdr) + (size_t)hdr.n_tokens * sizeof(llama_token) + hdr.n_state) {
+        fprintf(stderr, "Prompt state %s is truncated\n", path);
+        return false;
+    }
+    if (hdr.n_vocab != (uint32_t)llama_vocab_n_tokens(llama_model_get_vocab(h->model))) {
+        fprintf(stderr, "Prompt state %s was saved from a different model\n", path);
+        return false;
+    }
+    return true;
+}
+
+// state_tokens returns the saved prompt tokens of an opened state file. The
+// header size is a multiple of 8 and both mmap and vector storage are
+// suitably aligned, so the tokens can be read in place.
+static const llama_token *state_tokens(const StateFile &file) {
+    return (const llama_token *)(file.data + sizeof(LlamaStateHeader));
+}
+
+// restore_slot loads an opened state file into slot, which the caller holds
+// exclusively. Returns the number of tokens restored or -1.
+static int restore_slot(LlamaContextSlot *slot, const StateFile &file, const LlamaStateHeader &hdr, const char *path) {
+    const llama_token *tokens = state_tokens(file);
+    const size_t n_tokens = hdr.n_tokens;
+    const uint32_t n_ctx = llama_n_ctx(slot->ctx);
+    if (n_tokens >= n_ctx) {
+        fprintf(stderr, "Prompt state of %zu tokens does not fit the %u-token context\n", n_tokens, n_ctx);
+        return -1;
+    }
+
+    // A slot that already holds the whole saved prompt has nothing to gain.
+    if (slot->cached.size() >= n_tokens &&
+        memcmp(slot->cached.data(), tokens, n_tokens * sizeof(llama_token)) == 0) {
+        return (int)n_tokens;
+    }
+    clear_slot(slot);
+    const uint8_t *state = file.data + sizeof(hdr) + n_tokens * sizeof(llama_token);
+    if (llama_state_seq_set_data(slot->ctx, state, (size_t)hdr.n_state, 0) == 0) {
+        fprintf(stderr, "Prompt state %s does not match this context\n", path);
+        clear_slot(slot);
+        return -1;
+    }
+    // Logits are not part of the state; reuse_prefix always leaves the last
+    // prompt token to be decoded again, which regenerates them.
+    slot->cached.assign(tokens, tokens + n_tokens);
+    return (int)n_tokens;
+}
+
+static bool tokenize_prompt(const LlamaModelHandle *h, const char *prompt, std::vector<llama_token> &tokens) {
+    if (!tokenize_text(llama_model_get_vocab(h->model), prompt, tokens) || tokens.empty()) {
+        fprintf(stderr, "Failed to tokenize prompt\n");
+        return false;
+    }
+    return true;
+}
+
+int llama_save_prompt_state(LlamaModelHandle *h, const char *prompt, const char *path) {
+    if (!h || !prompt || !path) return -1;
+    std::vector<llama_token> tokens;
+    if (!tokenize_prompt(h, prompt, tokens)) return -1;
+
+    LlamaContextSlot *slot = acquire_context(h, tokens.data(), tokens.size());
+    if (!slot) return -1;
+    int rc = save_slot(h, slot, tokens, path);
+    release_context(h, slot);
+    return rc;
+}
+
+int llama_load_prompt_state(LlamaModelHandle *h, const char *path) {
+    if (!h || !path) return -1;
+    StateFile file;
+    LlamaStateHeader hdr;
+    if (!open_state(h, path, file, hdr)) return -1;
+
+    LlamaContextSlot *slot = acquire_context(h, state_tokens(file), hdr.n_tokens);
+    if (!slot) return -1;
+    int rc = restore_slot(slot, file, hdr, path);
+    release_context(h, slot);
+    return rc;
+}
+
+int llama_context_save_prompt_state(LlamaContextHandle *c, const char *prompt, const char *path) {
+    if (!c || !prompt || !path) return -1;
+    std::vector<llama_token> tokens;
+    if (!tokenize_prompt(c->h, prompt, tokens)) return -1;
+
+    std::lock_guard<std::mutex> lock(c->mu);
+    return save_slot(c->h, &c->slot, tokens, path);
+}
+
+int llama_context_save_token_state(LlamaContextHandle *c, const int32_t *tokens, int n_tokens, const char *path) {
+    if (!c || !tokens || n_tokens <= 0 || !path) return -1;
+    std::vector<llama_token> toks(tokens, tokens + n_tokens);
+
+    std::lock_guard<std::mutex> lock(c->mu);
+    return save_slot(c->h, &c->slot, toks, path);
+}
+
+int llama_context_load_prompt_state(LlamaContextHandle *c, const char *path) {
+    if (!c || !path) return -1;
+    StateFile file;
+    LlamaStateHeader hdr;
+    if (!open_state(c->h, path, file, hdr)) return -1;
+
+    std::lock_guard<std::mutex> lock(c->mu);
+    return restore_slot(&c->slot, file, hdr, path);
+}
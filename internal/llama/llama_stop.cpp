@@ -0,0 +1,89 @@
+// Stop string matching.
+//
+// The stop strings are compiled into an Aho-Corasick automaton whose failure
+// transitions are resolved ahead of time, giving a DFA over byte classes:
+// bytes that occur in no stop string share class 0, so the table has one
+// column per distinct pattern byte plus one. Feeding a byte is a single table
+// lookup regardless of how many stop strings there are, and a stop string
+// split across several tokens is found like any other.
+#include "llama_internal.h"
+#include <string.h>
+
+#include <deque>
+
+bool StopMatcher::init(const char *const *stop, int n_stop) {
+    cls.assign(256, 0);
+    n_cls = 1;
+    delta.clear();
+    depth.clear();
+    match_len.clear();
+    state = 0;
+    n_fed = 0;
+
+    for (int i = 0; i < n_stop; i++) {
+        if (!stop[i]) continue;
+        for (const unsigned char *p = (const unsigned char *)stop[i]; *p; p++) {
+            if (!cls[*p]) cls[*p] = (uint8_t)n_cls++;
+        }
+    }
+    if (n_cls == 1) return false; // no non-empty stop string
+
+    // Trie of the stop strings; -1 marks a missing edge.
+    delta.assign((size_t)n_cls, -1);
+    depth.push_back(0);
+    match_len.push_back(0);
+    for (int i = 0; i < n_stop; i++) {
+        if (!stop[i] || !stop[i][0]) continue;
+        int32_t s = 0;
+        for (const unsigned char *p = (const unsigned char *)stop[i]; *p; p++) {
+            int32_t &next = delta[(size_t)s * n_cls + cls[*p]];
+            if (next < 0) {
+                next = (int32_t)depth.size();
+                depth.push_back(depth[s] + 1);
+                match_len.push_back(0);
+                delta.resize(delta.size() + n_cls, -1);
+            }
+            s = delta[(size_t)s * n_cls + cls[*p]];
+        }
+        match_len[s] = depth[s];
+    }
+
+    // Breadth-first, fill every missing edge with the transition of the
+    // state's failure link, which is already complete since it is shallower.
+    // A state also matches whatever its failure link matches.
+    std::vector<int32_t> fail(depth.size(), 0);
+    std::deque<int32_t> queue;
+    for (int c = 0; c < n_cls; c++) {
+        int32_t &next = delta[c];
+        if (next < 0) {
+            next = 0;
+        } else {
+            queue.push_back(next);
+        }
+    }
+    while (!queue.empty()) {
+        int32_t s = queue.front();
+        queue.pop_front();
+        if (match_len[fail[s]] > match_len[s]) match_len[s] = match_len[fail[s]];
+        for (int c = 0; c < n_cls; c++) {
+            int32_t &next = delta[(size_t)s * n_cls + c];
+            const int32_t via_fail = delta[(size_t)fail[s] * n_cls + c];
+            if (next < 0) {
+                next = via_fail;
+            } else {
+                fail[next] = via_fail;
+                queue.push_back(next);
+            }
+        }
+    }
+    return true;
+}
+
+int64_t StopMatcher::feed(const char *s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        state = delta[(size_t)state * n_cls + cls[(unsigned char)s[i]]];
+        n_fed++;
+        if (match_len[state]) return (int64_t)(n_fed - match_len[state]);
+    }
+    return -1;
+}
@@ -0,0 +1,123 @@
+// Token streaming through a ring buffer.
+//
+// The prediction thread is the only writer and the reading thread the only
+// reader, so the ring needs no lock: each side publishes its position with an
+// atomic store and the other side reads it. The reader takes whatever has
+// accumulated in one call, so a slow reader gets many tokens at once instead
+// of one callback per token. A side only sleeps on the condition variable
+// when the ring is empty (reader) or full (writer); the other side takes the
+// mutex to wake it only when someone is actually waiting. A reader that gives
+// up abandons the stream, which also releases a writer waiting for room.
+#include "llama_internal.h"
+#include <string.h>
+
+#include <condition_variable>
+
+#define LLAMA_STREAM_DEFAULT_CAPACITY (64 * 1024)
+
+struct LlamaTokenStream {
+    std::vector<char> buf;
+    size_t mask; // buf.size() - 1; the size is a power of two
+
+    // Bytes written and read since the stream was opened. head is only
+    // stored by the writer and tail only by the reader; head - tail bytes
+    // are readable. They live on separate cache lines so the two threads do
+    // not contend on one.
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    std::atomic<bool> closed{false};
+    std::atomic<bool> abandoned{false}; // the reader has gone; writes are dropped
+
+    std::atomic<int> n_waiting{0};
+    std::mutex mu;
+    std::condition_variable cv;
+};
+
+// Block until ready() holds. The waiter is counted before ready() is checked
+// under the mutex, and a side that changes the ring stores its position
+// before looking at the count (both sequentially consistent), so either the
+// change is seen here or the other side sees the waiter and notifies.
+template <typename Ready>
+static void stream_wait(LlamaTokenStream *s, Ready ready) {
+    if (ready()) return;
+    std::unique_lock<std::mutex> lock(s->mu);
+    s->n_waiting.fetch_add(1);
+    s->cv.wait(lock, ready);
+    s->n_waiting.fetch_sub(1);
+}
+
+static void stream_wake(LlamaTokenStream *s) {
+    if (s->n_waiting.load() == 0) return;
+    std::lock_guard<std::mutex> lock(s->mu);
+    s->cv.notify_all();
+}
+
+LlamaTokenStream *llama_stream_open(int capacity) {
+    size_t want = capacity > 0 ? (size_t)capacity : LLAMA_STREAM_DEFAULT_CAPACITY;
+    size_t size = 1;
+    while (size < want) size <<= 1;
+
+    LlamaTokenStream *s = new LlamaTokenStream();
+    s->buf.resize(size);
+    s->mask = size - 1;
+    return s;
+}
+
+void llama_stream_write(const char *text, void *user_data) {
+    LlamaTokenStream *s = (LlamaTokenStream *)user_data;
+    if (!s || !text) return;
+    const size_t cap = s->buf.size();
+    size_t n = strlen(text);
+    while (n > 0) {
+        const size_t head = s->head.load(std::memory_order_relaxed);
+        stream_wait(s, [&] { return s->abandoned.load() || head - s->tail.load() < cap; });
+        if (s->abandoned.load()) return;
+        size_t k = cap - (head - s->tail.load(std::memory_order_acquire));
+        if (k > n) k = n;
+
+        // Copy in at most two pieces, around the end of the buffer.
+        const size_t at = head & s->mask;
+        const size_t first = k < cap - at ? k : cap - at;
+        memcpy(s->buf.data() + at, text, first);
+        memcpy(s->buf.data(), text + first, k - first);
+        s->head.store(head + k);
+        stream_wake(s);
+        text += k;
+        n -= k;
+    }
+}
+
+void llama_stream_close_write(LlamaTokenStream *s) {
+    if (!s) return;
+    s->closed.store(true);
+    stream_wake(s);
+}
+
+void llama_stream_abandon(LlamaTokenStream *s) {
+    if (!s) return;
+    s->abandoned.store(true);
+    stream_wake(s);
+}
+
+int llama_stream_read(LlamaTokenStream *s, char *out, int n_max) {
+    if (!s || !out || n_max <= 0) return -1;
+    const size_t tail = s->tail.load(std::memory_order_relaxed);
+    // closed is read before head: once it is set, head is final.
+    stream_wait(s, [&] { return s->closed.load() || s->abandoned.load() || s->head.load() != tail; });
+    if (s->abandoned.load()) return 0;
+    size_t k = s->head.load(std::memory_order_acquire) - tail;
+    if (k == 0) return 0; // closed and drained
+    if (k > (size_t)n_max) k = (size_t)n_max;
+
+    const size_t at = tail & s->mask;
+    const size_t first = k < s->buf.size() - at ? k : s->buf.size() - at;
+    memcpy(out, s->buf.data() + at, first);
+    memcpy(out + first, s->buf.data(), k - first);
+    s->tail.store(tail + k);
+    stream_wake(s);
+    return (int)k;
+}
+
+void llama_stream_free(LlamaTokenStream *s) {
+    delete s;
+}
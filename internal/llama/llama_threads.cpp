@@ -0,0 +1,295 @@
+// Compute threads.
+//
+// Without a threadpool every context runs its graphs on threads of its own,
+// so models or contexts decoding at the same time each bring a full set of
+// threads and oversubscribe the cores. A LlamaThreadpool, optionally pinned
+// to a CPU set, serves the contexts of every handle that uses it. Its cores
+// are split into lanes of n_threads (or n_threads_batch, if larger) cores,
+// each with a generation and a prefill ggml threadpool pinned to the lane's
+// own CPUs. Every decode borrows a lane for its llama_decode call: as many
+// decodes as there are lanes run side by side on disjoint cores, and any
+// beyond that wait for a lane. With the default of one thread per core the
+// pool has a single lane and its decodes take turns; a smaller n_threads
+// trades per-decode speed for concurrency.
+#include "llama_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <set>
+#include <thread>
+#include <utility>
+
+#include "ggml-cpu.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+// Default busy-wait level of threadpool workers between graphs (0-100),
+// as in llama.cpp; spinning briefly avoids a wake-up per decode step.
+#define LLAMA_THREADPOOL_DEFAULT_POLL 50
+
+#if defined(__linux__)
+static int read_sysfs_int(int cpu, const char *name) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int v = -1;
+    if (fscanf(f, "%d", &v) != 1) v = -1;
+    fclose(f);
+    return v;
+}
+#endif
+
+// Physical cores among the CPUs in mask (all CPUs the process may run on
+// when mask is NULL). SMT siblings share a core's execution units, so more
+// threads than cores only adds contention to matrix multiplication. With
+// prune, mask is reduced to the first allowed CPU of every core, so pinned
+// threads land on distinct cores.
+static int count_physical_cores(bool *mask, bool prune) {
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        std::set<std::pair<int, int>> cores;
+        for (int cpu = 0; cpu < CPU_SETSIZE && cpu < GGML_MAX_N_THREADS; cpu++) {
+            if (mask && !mask[cpu]) continue;
+            bool keep = CPU_ISSET(cpu, &allowed);
+            if (keep) {
+                int core = read_sysfs_int(cpu, "core_id");
+                int pkg = read_sysfs_int(cpu, "physical_package_id");
+                keep = cores.insert(core < 0 ? std::make_pair(-1, cpu) : std::make_pair(pkg, core)).second;
+            }
+            if (mask && prune && !keep) mask[cpu] = false;
+        }
+        if (!cores.empty()) return (int)cores.size();
+    }
+#elif defined(__APPLE__)
+    if (!mask) {
+        // Performance cores only; efficiency cores slow down every graph
+        // they take part in.
+        int n = 0;
+        size_t len = sizeof(n);
+        if (sysctlbyname("hw.perflevel0.physicalcpu", &n, &len, NULL, 0) == 0 && n > 0) return n;
+        if (sysctlbyname("hw.physicalcpu", &n, &len, NULL, 0) == 0 && n > 0) return n;
+    }
+#endif
+    if (mask) {
+        int n = 0;
+        for (int cpu = 0; cpu < GGML_MAX_N_THREADS; cpu++) n += mask[cpu] ? 1 : 0;
+        return n;
+    }
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? (int)n : 1;
+}
+
+int llama_default_threads(void) {
+    static const int n = count_physical_cores(NULL, false);
+    return n;
+}
+
+// CPUs beyond GGML_MAX_N_THREADS make the list malformed.
+bool parse_cpu_list(const char *s, bool *mask) {
+    memset(mask, 0, GGML_MAX_N_THREADS * sizeof(bool));
+    bool any = false;
+    while (*s) {
+        char *end;
+        long lo = strtol(s, &end, 10);
+        if (end == s || lo < 0) return false;
+        long hi = lo;
+        s = end;
+        if (*s == '-') {
+            hi = strtol(s + 1, &end, 10);
+            if (end == s + 1 || hi < lo) return false;
+            s = end;
+        }
+        if (hi >= GGML_MAX_N_THREADS) return false;
+        for (long cpu = lo; cpu <= hi; cpu++) mask[cpu] = true;
+        any = true;
+        if (*s == ',') {
+            s++;
+        } else if (*s) {
+            return false;
+        }
+    }
+    return any;
+}
+
+LlamaThreadpoolParams llama_threadpool_params_default(void) {
+    LlamaThreadpoolParams p;
+    p.n_threads = 0;
+    p.n_threads_batch = 0;
+    p.cpus = NULL;
+    p.poll = LLAMA_THREADPOOL_DEFAULT_POLL;
+    return p;
+}
+
+static void lane_free(const ThreadpoolLane &lane) {
+    if (!lane.gen) return; // a lane that failed to start
+    if (lane.batch != lane.gen) ggml_threadpool_free(lane.batch);
+    ggml_threadpool_free(lane.gen);
+}
+
+// Start the generation and batch threadpools of lane k of pool.
+static bool lane_new(LlamaThreadpool *pool, size_t k, ThreadpoolLane &lane) {
+    struct ggml_threadpool_params tpp = pool->lane_params[k];
+    lane.gen = ggml_threadpool_new(&tpp);
+    lane.batch = lane.gen;
+    if (lane.gen && pool->n_threads_batch != pool->n_threads) {
+        tpp.n_threads = pool->n_threads_batch;
+        lane.batch = ggml_threadpool_new(&tpp);
+        if (!lane.batch) {
+            ggml_threadpool_free(lane.gen);
+            lane.gen = NULL;
+        }
+    }
+    if (!lane.gen) {
+        fprintf(stderr, "Failed to create a threadpool of %d/%d threads\n", pool->n_threads, pool->n_threads_batch);
+        return false;
+    }
+    return true;
+}
+
+LlamaThreadpool *llama_threadpool_new(const LlamaThreadpoolParams *params) {
+    const LlamaThreadpoolParams p = params ? *params : llama_threadpool_params_default();
+    struct ggml_threadpool_params tpp = ggml_threadpool_params_default(1);
+
+    bool pinned = p.cpus && p.cpus[0];
+    if (pinned && !parse_cpu_list(p.cpus, tpp.cpumask)) {
+        fprintf(stderr, "Invalid CPU list \"%s\" (want e.g. \"0-7,16\")\n", p.cpus);
+        return NULL;
+    }
+    // One thread per physical core: a pinned set is reduced to one CPU of
+    // every core it covers.
+    int n_cores = pinned ? count_physical_cores(tpp.cpumask, true) : llama_default_threads();
+    int n_threads = p.n_threads > 0 ? p.n_threads : n_cores;
+    if (n_threads <= 0) {
+        fprintf(stderr, "No usable CPU in \"%s\"\n", p.cpus);
+        return NULL;
+    }
+    if (n_threads > GGML_MAX_N_THREADS) n_threads = GGML_MAX_N_THREADS;
+    int n_threads_batch = p.n_threads_batch > 0 ? p.n_threads_batch : n_threads;
+    if (n_threads_batch > GGML_MAX_N_THREADS) n_threads_batch = GGML_MAX_N_THREADS;
+    // Pinned workers each take the next CPU of their lane in turn.
+    tpp.strict_cpu = pinned;
+    tpp.poll = p.poll < 0 ? 0 : p.poll > 100 ? 100 : (uint32_t)p.poll;
+    tpp.n_threads = n_threads;
+
+    // Lanes get disjoint slices of width threads, the last one the rest.
+    // A decode runs on one of its two threadpools at a time, so the wider
+    // of them sets the width.
+    const int width = n_threads > n_threads_batch ? n_threads : n_threads_batch;
+    const int n_lanes = n_cores / width > 1 ? n_cores / width : 1;
+    LlamaThreadpool *pool = new LlamaThreadpool();
+    pool->n_threads = n_threads;
+    pool->n_threads_batch = n_threads_batch;
+    pool->refs = 1;
+    if (pinned) {
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < GGML_MAX_N_THREADS; cpu++) {
+            if (tpp.cpumask[cpu]) cpus.push_back(cpu);
+        }
+        for (int k = 0; k < n_lanes; k++) {
+            struct ggml_threadpool_params lane = tpp;
+            memset(lane.cpumask, 0, sizeof(lane.cpumask));
+            size_t end = k + 1 == n_lanes ? cpus.size() : (size_t)(k + 1) * width;
+            for (size_t i = (size_t)k * width; i < end; i++) lane.cpumask[cpus[i]] = true;
+            pool->lane_params.push_back(lane);
+        }
+    } else {
+        // Unpinned lanes share the host; the lane count alone keeps their
+        // threads within its cores.
+        pool->lane_params.assign(n_lanes, tpp);
+    }
+    pool->n_lanes = pool->lane_params.size();
+
+    // The first lane is started now so a pool that cannot run fails here
+    // rather than at the first decode.
+    ThreadpoolLane lane;
+    if (!lane_new(pool, 0, lane)) {
+        delete pool;
+        return NULL;
+    }
+    pool->idle.push_back(lane);
+    pool->all.push_back(lane);
+    return pool;
+}
+
+int llama_threadpool_threads(LlamaThreadpool *pool) {
+    return pool ? pool->n_threads : 0;
+}
+
+int llama_threadpool_batch_threads(LlamaThreadpool *pool) {
+    return pool ? pool->n_threads_batch : 0;
+}
+
+LlamaThreadpool *threadpool_retain(LlamaThreadpool *pool) {
+    if (pool) pool->refs.fetch_add(1);
+    return pool;
+}
+
+void llama_threadpool_free(LlamaThreadpool *pool) {
+    if (!pool || pool->refs.fetch_sub(1) != 1) return;
+    for (const ThreadpoolLane &lane : pool->all) lane_free(lane);
+    delete pool;
+}
+
+// Take an idle lane of pool, starting the next one if every started lane is
+// running a graph, or waiting for one when all lanes are busy. Returns false
+// if no lane is started and none can be.
+static bool lane_take(LlamaThreadpool *pool, ThreadpoolLane &lane) {
+    std::unique_lock<std::mutex> lock(pool->mu);
+    for (;;) {
+        if (!pool->idle.empty()) {
+            lane = pool->idle.back();
+            pool->idle.pop_back();
+            return true;
+        }
+        if (pool->all.size() < pool->n_lanes) break;
+        pool->cv.wait(lock);
+    }
+    // Reserve lane k with a placeholder while it starts outside the lock.
+    const size_t k = pool->all.size();
+    pool->all.push_back(ThreadpoolLane{NULL, NULL});
+    lock.unlock();
+    bool ok = lane_new(pool, k, lane);
+    lock.lock();
+    if (ok) {
+        pool->all[k] = lane;
+        return true;
+    }
+    // Start no further lanes; callers share the ones already running.
+    pool->n_lanes = pool->all.size();
+    return false;
+}
+
+static void lane_give(LlamaThreadpool *pool, const ThreadpoolLane &lane) {
+    {
+        std::lock_guard<std::mutex> lock(pool->mu);
+        pool->idle.push_back(lane);
+    }
+    pool->cv.notify_one();
+}
+
+struct llama_context *init_context(LlamaModelHandle *h, struct llama_model *model,
+                                   struct llama_context_params cparams) {
+    // A replica's KV cache is cleared, and so first touched, on its node.
+    struct llama_context *ctx = NULL;
+    run_on_node(handle_numa_node(h), [&] { ctx = llama_init_from_model(model, cparams); });
+    return ctx;
+}
+
+int handle_decode(LlamaModelHandle *h, struct llama_context *ctx, struct llama_batch batch) {
+    ThreadpoolLane lane;
+    // Without a lane the context falls back to threads of its own.
+    if (!h->threadpool || !lane_take(h->threadpool, lane)) return llama_decode(ctx, batch);
+    llama_attach_threadpool(ctx, lane.gen, lane.batch);
+    int rc = llama_decode(ctx, batch);
+    llama_detach_threadpool(ctx);
+    lane_give(h->threadpool, lane);
+    return rc;
+}
@@ -0,0 +1,59 @@
+// Prompts tokenized ahead of time.
+//
+// A caller that knows how its prompts begin (llmc compile knows every prompt
+// template) tokenizes that static text once with a vocabulary-only handle
+// and passes the tokens with each request, so only the rest of the prompt is
+// tokenized per call. The prefix tokens never change between calls, so a
+// pooled context holding them is always reused for the full prefix.
+#include "llama_internal.h"
+#include <string.h>
+#include <stdio.h>
+
+struct LlamaVocabHandle {
+    struct llama_model *model; // loaded with vocab_only
+};
+
+LlamaVocabHandle *llama_open_vocab(const char *model_path) {
+    if (!model_path) return NULL;
+    backend_acquire();
+
+    struct llama_model_params mparams = llama_model_default_params();
+    mparams.vocab_only = true;
+    struct llama_model *model = llama_model_load_from_file(model_path, mparams);
+    if (!model) {
+        fprintf(stderr, "Failed to load vocabulary: %s\n", model_path);
+        backend_release();
+        return NULL;
+    }
+    LlamaVocabHandle *v = new LlamaVocabHandle();
+    v->model = model;
+    return v;
+}
+
+int llama_tokenize_prompt(LlamaVocabHandle *v, const char *text, int add_special, int32_t *out, int n_max) {
+    if (!v || !text || !out) return -1;
+    const struct llama_vocab *vocab = llama_model_get_vocab(v->model);
+    int32_t n = llama_tokenize(vocab, text, (int32_t)strlen(text), out, n_max, add_special != 0, false);
+    return n < 0 ? -1 : n;
+}
+
+void llama_close_vocab(LlamaVocabHandle *v) {
+    if (!v) return;
+    llama_model_free(v->model);
+    backend_release();
+    delete v;
+}
+
+bool request_tokens(const struct llama_vocab *vocab, const char *prompt, const LlamaPredictParams &p,
+                    std::vector<llama_token> &out) {
+    if (!p.prefix_tokens || p.n_prefix_tokens <= 0) return tokenize_text(vocab, prompt, out);
+
+    if (p.prefix_len < 0 || strlen(prompt) < (size_t)p.prefix_len) {
+        fprintf(stderr, "Prompt prefix of %d bytes exceeds the prompt\n", p.prefix_len);
+        return false;
+    }
+    // The remainder continues the prefix, so it gets no BOS of its own.
+    if (!tokenize_text(vocab, prompt + p.prefix_len, out, false)) return false;
+    out.insert(out.begin(), p.prefix_tokens, p.prefix_tokens + p.n_prefix_tokens);
+    return true;
+}
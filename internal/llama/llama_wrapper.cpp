@@ -1,14 +1,34 @@
 // C++ wrapper - same implementation as the previous C file but compiled as C++
-#include "llama_wrapper.h"
-#include "llama.h"
+#include "llama_internal.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-struct LlamaModelHandle {
-    struct llama_model *model;
-    struct llama_context *ctx;
-};
+#include <chrono>
+
+// Number of idle contexts a handle keeps around when the caller does not
+// configure the pool explicitly. One is enough for the serialized callers.
+#define LLAMA_DEFAULT_POOL_SIZE 1
+
+// Defaults for LlamaLoadParams fields left at 0.
+#define LLAMA_DEFAULT_N_CTX     2048
+#define LLAMA_DEFAULT_N_BATCH   512
+#define LLAMA_DEFAULT_N_UBATCH  512
+
+// Leading tokens kept by context shifting when the caller does not say; the
+// first few positions draw much of the attention in every layer.
+#define LLAMA_DEFAULT_N_SINK 4
+
+// Tokens a draft model proposes per step when the caller does not say.
+#define LLAMA_DEFAULT_N_DRAFT 8
+
+// Default generation length of llama_predict_params_default.
+#define LLAMA_DEFAULT_MAX_TOKENS 128
+
+// N-gram lengths prompt lookup tries to match, longest first. Single tokens
+// recur too often to predict anything.
+#define LLAMA_LOOKUP_NGRAM_MAX 4
+#define LLAMA_LOOKUP_NGRAM_MIN 2
 
 // helper
 static char *strdup_m(const char *s) {
@@ -19,121 +39,742 @@ static char *strdup_m(const char *s) {
     return r;
 }
 
+bool OutputBuffer::init(size_t capacity) {
+    cap = capacity < 64 ? 64 : capacity;
+    len = 0;
+    data = (char*)malloc(cap);
+    if (!data) return false;
+    data[0] = '\0';
+    return true;
+}
+
+bool OutputBuffer::append(const char *s, size_t n) {
+    if (len + n + 1 > cap) {
+        size_t new_cap = cap * 2;
+        while (len + n + 1 > new_cap) new_cap *= 2;
+        char *p = (char*)realloc(data, new_cap);
+        if (!p) return false;
+        data = p;
+        cap = new_cap;
+    }
+    memcpy(data + len, s, n);
+    len += n;
+    data[len] = '\0';
+    return true;
+}
+
+void OutputBuffer::truncate(size_t n) {
+    if (n >= len) return;
+    len = n;
+    data[len] = '\0';
+}
+
+char *OutputBuffer::release() {
+    char *p = data;
+    data = NULL;
+    return p;
+}
+
+OutputBuffer::~OutputBuffer() {
+    free(data);
+}
+
+// build_piece_table detokenizes every vocabulary entry once into one
+// contiguous arena so generation never has to call llama_token_to_piece.
+static void build_piece_table(LlamaModelHandle *h) {
+    const struct llama_vocab *vocab = llama_model_get_vocab(h->model);
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+
+    h->piece_offsets.resize((size_t)n_vocab + 1);
+    h->piece_arena.clear();
+    h->piece_arena.reserve((size_t)n_vocab * 8);
+
+    std::vector<char> buf(256);
+    for (int32_t id = 0; id < n_vocab; id++) {
+        h->piece_offsets[id] = (uint32_t)h->piece_arena.size();
+        int32_t n = llama_token_to_piece(vocab, id, buf.data(), (int32_t)buf.size(), 0, true);
+        if (n < 0) {
+            buf.resize(-n);
+            n = llama_token_to_piece(vocab, id, buf.data(), (int32_t)buf.size(), 0, true);
+        }
+        if (n > 0) h->piece_arena.insert(h->piece_arena.end(), buf.data(), buf.data() + n);
+        h->piece_arena.push_back('\0');
+    }
+    h->piece_offsets[n_vocab] = (uint32_t)h->piece_arena.size();
+}
+
+const char *token_piece(const LlamaModelHandle *h, llama_token id, size_t *len) {
+    if (id < 0 || (size_t)id + 1 >= h->piece_offsets.size()) {
+        *len = 0;
+        return "";
+    }
+    uint32_t begin = h->piece_offsets[id];
+    *len = h->piece_offsets[id + 1] - begin - 1;
+    return h->piece_arena.data() + begin;
+}
+
+static enum ggml_type kv_cache_ggml_type(LlamaKVCacheType t) {
+    switch (t) {
+    case LLAMA_KV_CACHE_Q8_0: return GGML_TYPE_Q8_0;
+    case LLAMA_KV_CACHE_Q4_0: return GGML_TYPE_Q4_0;
+    default:                  return GGML_TYPE_F16;
+    }
+}
+
+struct llama_context_params handle_context_params(LlamaModelHandle *h) {
+    struct llama_context_params cparams = llama_context_default_params();
+    cparams.n_ctx = h->params.n_ctx;
+    {
+        // llama_set_batch_size may change these at any time.
+        std::lock_guard<std::mutex> lock(h->pool_mu);
+        cparams.n_batch = h->params.n_batch;
+        cparams.n_ubatch = h->params.n_ubatch;
+    }
+    cparams.n_threads = h->params.n_threads;
+    cparams.n_threads_batch = h->params.n_threads_batch;
+    if (h->threadpool) {
+        // Graphs run on the pool's workers, capped by these counts.
+        cparams.n_threads = h->threadpool->n_threads;
+        cparams.n_threads_batch = h->threadpool->n_threads_batch;
+    }
+    cparams.flash_attn_type = h->params.flash_attn < 0 ? LLAMA_FLASH_ATTN_TYPE_AUTO
+                            : h->params.flash_attn > 0 ? LLAMA_FLASH_ATTN_TYPE_ENABLED
+                            : LLAMA_FLASH_ATTN_TYPE_DISABLED;
+    cparams.type_k = kv_cache_ggml_type(h->params.type_k);
+    cparams.type_v = kv_cache_ggml_type(h->params.type_v);
+    return cparams;
+}
+
+bool tokenize_text(const struct llama_vocab *vocab, const char *text, std::vector<llama_token> &out, bool add_special) {
+    int32_t len = (int32_t)strlen(text);
+    // A token covers at least one byte, plus room for BOS/EOS.
+    out.resize(len + 2);
+    int32_t n = llama_tokenize(vocab, text, len, out.data(), (int32_t)out.size(), add_special, false);
+    if (n < 0) {
+        out.resize(-n);
+        n = llama_tokenize(vocab, text, len, out.data(), (int32_t)out.size(), add_special, false);
+    }
+    if (n < 0) {
+        out.clear();
+        return false;
+    }
+    out.resize(n);
+    return true;
+}
+
+static struct llama_context *new_context(LlamaModelHandle *h) {
+    return init_context(h, h->model, handle_context_params(h));
+}
+
+static size_t common_prefix(const std::vector<llama_token> &a, const llama_token *b, size_t n) {
+    size_t i = 0;
+    while (i < a.size() && i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+static void free_slot_contexts(LlamaContextSlot *slot) {
+    llama_free(slot->ctx);
+    if (slot->draft_ctx) llama_free(slot->draft_ctx);
+}
+
+// acquire_context returns the idle slot whose cached tokens share the longest
+// prefix with tokens, or a freshly created slot when the pool is empty.
+// Returns NULL if a new context could not be created.
+LlamaContextSlot *acquire_context(LlamaModelHandle *h, const llama_token *tokens, size_t n_tokens) {
+    {
+        std::lock_guard<std::mutex> lock(h->pool_mu);
+        if (!h->idle.empty()) {
+            size_t best = 0, best_len = 0;
+            for (size_t i = 0; i < h->idle.size(); i++) {
+                size_t len = common_prefix(h->idle[i]->cached, tokens, n_tokens);
+                if (len > best_len) {
+                    best = i;
+                    best_len = len;
+                }
+            }
+            LlamaContextSlot *slot = h->idle[best];
+            h->idle.erase(h->idle.begin() + best);
+            h->n_reused++;
+            return slot;
+        }
+    }
+
+    struct llama_context *ctx = new_context(h);
+    if (!ctx) {
+        fprintf(stderr, "Failed to create llama context\n");
+        return NULL;
+    }
+    LlamaContextSlot *slot = new LlamaContextSlot();
+    slot->ctx = ctx;
+    std::lock_guard<std::mutex> lock(h->pool_mu);
+    h->n_created++;
+    return slot;
+}
+
+// release_context returns slot to the pool with its KV cache intact, or frees
+// it when the pool is already full.
+void release_context(LlamaModelHandle *h, LlamaContextSlot *slot) {
+    if (!slot) return;
+    {
+        std::lock_guard<std::mutex> lock(h->pool_mu);
+        if ((int)h->idle.size() < h->pool_size) {
+            h->idle.push_back(slot);
+            return;
+        }
+    }
+    free_slot_contexts(slot);
+    delete slot;
+}
+
+void clear_slot(LlamaContextSlot *slot) {
+    llama_memory_clear(llama_get_memory(slot->ctx), true);
+    slot->cached.clear();
+}
+
+// reuse_prefix drops everything in the slot's KV cache past the longest
+// common prefix with tokens and returns the number of tokens that can be
+// kept. At least one token is always left to decode so the prompt produces
+// fresh logits.
+size_t reuse_prefix(LlamaContextSlot *slot, const llama_token *tokens, size_t n_tokens) {
+    size_t n_keep = common_prefix(slot->cached, tokens, n_tokens);
+    if (n_keep >= n_tokens) n_keep = n_tokens - 1;
+    if (n_keep == slot->cached.size()) return n_keep;
+
+    // Not every memory type supports partial removal (e.g. recurrent
+    // models); fall back to a full clear in that case.
+    if (!llama_memory_seq_rm(llama_get_memory(slot->ctx), 0, (llama_pos)n_keep, -1)) {
+        clear_slot(slot);
+        return 0;
+    }
+    slot->cached.resize(n_keep);
+    return n_keep;
+}
+
+// decode_prompt feeds tokens[from, n_tokens) into sequence 0 of ctx in
+// chunks of the context's n_batch, requesting logits only for the final
+// token. Returns 0 on success or the failing llama_decode result.
+int decode_prompt(LlamaModelHandle *h, struct llama_context *ctx, const llama_token *tokens, int32_t from,
+                  int32_t n_tokens) {
+    const int32_t n_batch = (int32_t)llama_n_batch(ctx);
+    struct llama_batch batch = llama_batch_init(n_batch, 0, 1);
+    int rc = 0;
+    for (int32_t start = from; start < n_tokens && rc == 0; start += n_batch) {
+        int32_t end = start + n_batch < n_tokens ? start + n_batch : n_tokens;
+        batch.n_tokens = 0;
+        for (int32_t i = start; i < end; i++) {
+            int j = batch.n_tokens++;
+            batch.token[j] = tokens[i];
+            batch.pos[j] = i;
+            batch.n_seq_id[j] = 1;
+            batch.seq_id[j][0] = 0;
+            batch.logits[j] = (i == n_tokens - 1);
+        }
+        rc = handle_decode(h, ctx, batch);
+        if (rc != 0) {
+            fprintf(stderr, "llama_decode failed on prompt tokens [%d, %d) (rc=%d)\n", start, end, rc);
+        }
+    }
+    llama_batch_free(batch);
+    return rc;
+}
+
+LlamaLoadParams llama_load_params_default(void) {
+    LlamaLoadParams p;
+    p.n_ctx = LLAMA_DEFAULT_N_CTX;
+    p.n_batch = LLAMA_DEFAULT_N_BATCH;
+    p.n_ubatch = LLAMA_DEFAULT_N_UBATCH;
+    p.n_threads = llama_default_threads();
+    p.n_threads_batch = p.n_threads;
+    p.flash_attn = -1;
+    p.use_mmap = 1;
+    p.use_mlock = 0;
+    p.prefault = 0;
+    p.huge_pages = 0;
+    p.type_k = LLAMA_KV_CACHE_F16;
+    p.type_v = LLAMA_KV_CACHE_F16;
+    p.threadpool = NULL;
+    p.numa = LLAMA_NUMA_NONE;
+    p.numa_node = 0;
+    p.ctx_shift = 0;
+    p.n_sink = LLAMA_DEFAULT_N_SINK;
+    return p;
+}
+
+
+LlamaLoadParams resolve_params(const LlamaLoadParams *in) {
+    LlamaLoadParams p = in ? *in : llama_load_params_default();
+    if (p.n_ctx <= 0) p.n_ctx = LLAMA_DEFAULT_N_CTX;
+    if (p.n_batch <= 0) p.n_batch = LLAMA_DEFAULT_N_BATCH;
+    if (p.n_batch > p.n_ctx) p.n_batch = p.n_ctx;
+    if (p.n_ubatch <= 0) p.n_ubatch = LLAMA_DEFAULT_N_UBATCH;
+    if (p.n_ubatch > p.n_batch) p.n_ubatch = p.n_batch;
+    if (p.n_threads <= 0) p.n_threads = llama_default_threads();
+    if (p.n_threads_batch <= 0) p.n_threads_batch = p.n_threads;
+    if (p.n_sink <= 0) p.n_sink = LLAMA_DEFAULT_N_SINK;
+    return p;
+}
+
 LlamaModelHandle *llama_load_model(const char *model_path, int n_threads) {
+    LlamaLoadParams params = llama_load_params_default();
+    params.n_threads = n_threads;
+    params.n_threads_batch = n_threads;
+    return llama_load_model_ex(model_path, &params);
+}
+
+LlamaModelHandle *llama_load_model_ex(const char *model_path, const LlamaLoadParams *params) {
     if (!model_path) return NULL;
 
-    llama_backend_init();
+    LlamaLoadParams p = resolve_params(params);
+    if (p.type_v != LLAMA_KV_CACHE_F16 && p.flash_attn == 0) {
+        fprintf(stderr, "A quantized V cache requires flash attention; enable it or use an f16 V cache\n");
+        return NULL;
+    }
+
+    if (p.numa == LLAMA_NUMA_REPLICATE && (p.numa_node < 0 || p.numa_node >= llama_numa_nodes())) {
+        fprintf(stderr, "NUMA node %d does not exist (%d nodes)\n", p.numa_node, llama_numa_nodes());
+        return NULL;
+    }
+
+    const auto t_start = std::chrono::steady_clock::now();
+    backend_acquire();
 
-    struct llama_model_params mparams = llama_model_default_params();
-    mparams.n_gpu_layers = 0;
-    mparams.use_mmap = true;
-    mparams.use_mlock = false;
+    // Mappings of the file that exist before the load belong to other handles.
+    const bool mapped = p.use_mmap && p.numa != LLAMA_NUMA_REPLICATE;
+    std::vector<MappedRange> earlier;
+    if (mapped) earlier = file_mappings(model_path);
+    if (p.prefault) prefetch_file(model_path);
 
-    struct llama_model *model = llama_model_load_from_file(model_path, mparams);
+    struct llama_model *model = load_model_file(model_path, p);
     if (!model) {
         fprintf(stderr, "Failed to load model: %s\n", model_path);
+        backend_release();
         return NULL;
     }
 
-    struct llama_context_params cparams = llama_context_default_params();
-    cparams.n_threads = n_threads;
-    cparams.n_threads_batch = n_threads;
-    cparams.n_ctx = 2048;
+    std::vector<MappedRange> weight_maps;
+    if (mapped) {
+        for (const MappedRange &r : file_mappings(model_path)) {
+            bool seen = false;
+            for (const MappedRange &e : earlier) seen = seen || e.addr == r.addr;
+            if (!seen) weight_maps.push_back(r);
+        }
+        // mlock already faults every page in.
+        tune_mappings(weight_maps, p.prefault && !p.use_mlock, p.huge_pages != 0);
+    }
 
-    struct llama_context *ctx = llama_init_from_model(model, cparams);
-    if (!ctx) {
-        fprintf(stderr, "Failed to create llama context\n");
+    LlamaModelHandle *h = new LlamaModelHandle();
+    h->model = model;
+    h->params = p;
+    h->threadpool = threadpool_retain(p.threadpool);
+    if (!h->threadpool && p.numa == LLAMA_NUMA_REPLICATE) {
+        // One thread per physical core of the replica's node.
+        char cpus[4096];
+        LlamaThreadpoolParams tp = llama_threadpool_params_default();
+        if (llama_numa_node_cpus(p.numa_node, cpus, sizeof(cpus)) > 0) tp.cpus = cpus;
+        h->threadpool = llama_threadpool_new(&tp);
+    }
+    h->pool_size = LLAMA_DEFAULT_POOL_SIZE;
+    h->n_created = 0;
+    h->n_reused = 0;
+    h->n_prefix_tokens = 0;
+    h->engine = NULL;
+    h->embed_ctx = NULL;
+    h->draft_model = NULL;
+    h->n_draft = 0;
+    h->n_spec_steps = 0;
+    h->n_drafted = 0;
+    h->n_draft_accepted = 0;
+    h->n_shifts = 0;
+    h->n_evicted_tokens = 0;
+    h->n_lookup_drafted = 0;
+    h->n_lookup_accepted = 0;
+    h->load_ms = 0;
+    h->weight_maps = std::move(weight_maps);
+    h->refs.store(1, std::memory_order_relaxed);
+    build_piece_table(h);
+
+    // Create the first context eagerly so a broken configuration surfaces at
+    // load time rather than on the first prediction.
+    LlamaContextSlot *slot = acquire_context(h, NULL, 0);
+    if (!slot) {
+        llama_threadpool_free(h->threadpool);
         llama_model_free(model);
+        delete h;
+        backend_release();
         return NULL;
     }
-
-    LlamaModelHandle *h = (LlamaModelHandle*)malloc(sizeof(LlamaModelHandle));
-    h->model = model;
-    h->ctx = ctx;
+    release_context(h, slot);
+    h->load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
     return h;
 }
 
+void llama_get_load_params(LlamaModelHandle *h, LlamaLoadParams *out) {
+    if (!h || !out) return;
+    std::lock_guard<std::mutex> lock(h->pool_mu);
+    *out = h->params;
+}
+
+uint64_t llama_kv_bytes_per_token(LlamaModelHandle *h) {
+    if (!h) return 0;
+    const int32_t n_layer = llama_model_n_layer(h->model);
+    const int32_t n_head = llama_model_n_head(h->model);
+    const int32_t n_head_kv = llama_model_n_head_kv(h->model);
+    if (n_head <= 0) return 0;
+    // Width of one K (or V) row: head size times the number of KV heads.
+    const int64_t n_embd_kv = (int64_t)llama_model_n_embd(h->model) / n_head * n_head_kv;
+    const size_t k = ggml_row_size(kv_cache_ggml_type(h->params.type_k), n_embd_kv);
+    const size_t v = ggml_row_size(kv_cache_ggml_type(h->params.type_v), n_embd_kv);
+    return (uint64_t)n_layer * (k + v);
+}
+
+LlamaPredictParams llama_predict_params_default(void) {
+    LlamaPredictParams p;
+    p.max_tokens = LLAMA_DEFAULT_MAX_TOKENS;
+    p.temp = 0.8f;
+    p.top_k = 40;
+    p.top_p = 0.95f;
+    p.n_lookup = 0;
+    p.grammar = NULL;
+    p.stop = NULL;
+    p.n_stop = 0;
+    p.prefix_tokens = NULL;
+    p.n_prefix_tokens = 0;
+    p.prefix_len = 0;
+    p.cancel = NULL;
+    return p;
+}
+
+LlamaCancelFlag *llama_cancel_flag_new(void) {
+    return new LlamaCancelFlag();
+}
+
+void llama_cancel_flag_set(LlamaCancelFlag *c) {
+    if (c) c->set.store(true, std::memory_order_relaxed);
+}
+
+void llama_cancel_flag_free(LlamaCancelFlag *c) {
+    delete c;
+}
+
+// ggml abort callback: stops a running llama_decode once the request's
+// cancel flag is set. llama_decode then fails and the caller clears the slot.
+bool abort_if_cancelled(void *data) {
+    return cancelled((const LlamaCancelFlag *)data);
+}
+
+// predict_params packs the positional arguments of the original entry points.
+static LlamaPredictParams predict_params(int max_tokens, float temp, int top_k, float top_p) {
+    LlamaPredictParams p = llama_predict_params_default();
+    p.max_tokens = max_tokens;
+    p.temp = temp;
+    p.top_k = top_k;
+    p.top_p = top_p;
+    return p;
+}
+
 char *llama_predict(LlamaModelHandle *h, const char *prompt,
                     int max_tokens, float temp, int top_k, float top_p) {
-    if (!h || !prompt) return NULL;
+    LlamaPredictParams p = predict_params(max_tokens, temp, top_k, top_p);
+    return llama_predict_ex(h, prompt, &p, NULL, NULL);
+}
+
+// lookup_tokens proposes up to n tokens to follow id without a draft model:
+// it finds the latest earlier occurrence of the n-gram ending in id in the
+// slot's history (the prompt and everything generated so far) and copies the
+// tokens that followed it. Longer n-grams are tried first since they predict
+// better. Returns the number of tokens written to out.
+static size_t lookup_tokens(const LlamaContextSlot *slot, llama_token id, int n, std::vector<llama_token> &out) {
+    const std::vector<llama_token> &hist = slot->cached;
+    const size_t n_hist = hist.size() + 1; // hist followed by id
+    auto at = [&](size_t i) { return i < hist.size() ? hist[i] : id; };
+
+    for (size_t g = LLAMA_LOOKUP_NGRAM_MAX; g >= LLAMA_LOOKUP_NGRAM_MIN; g--) {
+        if (g >= n_hist) continue;
+        const size_t tail = n_hist - g;
+        for (size_t i = tail; i-- > 0;) {
+            if (hist[i + g - 1] != id) continue;
+            size_t k = 0;
+            while (k + 1 < g && at(i + k) == at(tail + k)) k++;
+            if (k + 1 < g) continue;
+            for (size_t j = i + g; j < n_hist && out.size() < (size_t)n; j++) out.push_back(at(j));
+            return out.size();
+        }
+    }
+    return 0;
+}
+
+// draft_tokens syncs the slot's draft context with the target history plus
+// id and greedily drafts up to n tokens that would follow id. It returns the
+// number of tokens written to out; drafting failures just yield fewer.
+static size_t draft_tokens(LlamaModelHandle *h, LlamaContextSlot *slot, llama_token id, int n, std::vector<llama_token> &out) {
+    if (!slot->draft_ctx) {
+        slot->draft_ctx = init_context(h, h->draft_model, handle_context_params(h));
+        if (!slot->draft_ctx) {
+            fprintf(stderr, "Failed to create draft context\n");
+            return 0;
+        }
+    }
+    struct llama_context *dctx = slot->draft_ctx;
+
+    // Bring the draft up to date: keep what it shares with the target and
+    // decode the rest, including id, whose logits start the draft.
+    slot->cached.push_back(id);
+    const int32_t n_hist = (int32_t)slot->cached.size();
+    size_t n_keep = 0;
+    while (n_keep < slot->draft_cached.size() && n_keep + 1 < (size_t)n_hist &&
+           slot->draft_cached[n_keep] == slot->cached[n_keep]) {
+        n_keep++;
+    }
+    if (!llama_memory_seq_rm(llama_get_memory(dctx), 0, (llama_pos)n_keep, -1)) {
+        llama_memory_clear(llama_get_memory(dctx), true);
+        n_keep = 0;
+    }
+    int rc = decode_prompt(h, dctx, slot->cached.data(), (int32_t)n_keep, n_hist);
+    slot->draft_cached.assign(slot->cached.begin(), slot->cached.end());
+    slot->cached.pop_back();
+    if (rc != 0) {
+        llama_memory_clear(llama_get_memory(dctx), true);
+        slot->draft_cached.clear();
+        return 0;
+    }
 
     const struct llama_vocab *vocab = llama_model_get_vocab(h->model);
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
+    for (int i = 0; i < n; i++) {
+        llama_token d = argmax_logits(llama_get_logits_ith(dctx, -1), n_vocab);
+        out.push_back(d);
+        if (i + 1 == n || llama_vocab_is_eog(vocab, d)) break;
+        struct llama_batch b1 = llama_batch_get_one(&d, 1);
+        if (handle_decode(h, dctx, b1) != 0) {
+            llama_memory_clear(llama_get_memory(dctx), true);
+            slot->draft_cached.clear();
+            break;
+        }
+        slot->draft_cached.push_back(d);
+    }
+    return out.size();
+}
 
-    // Ensure the context's KV cache is fresh for this prediction. Some usage
-    // patterns expect each predict to start from an empty KV cache; if the
-    // context previously had tokens, feeding a new prompt with positions
-    // starting at 0 will cause sequence position mismatches. Resetting the
-    // context here avoids that class of errors. This is a conservative
-    // approach; callers that need persistent context should maintain their
-    // own llama context management.
-    if (h->ctx) {
-        llama_free(h->ctx);
-        struct llama_context_params cparams = llama_context_default_params();
-        cparams.n_threads = 4;
-        cparams.n_threads_batch = 4;
-        cparams.n_ctx = 2048;
-        h->ctx = llama_init_from_model(h->model, cparams);
-        if (!h->ctx) {
-            fprintf(stderr, "Failed to reinit llama context\n");
-            return NULL;
-        }
-    }
-
-    // tokenize prompt
-    const int32_t max_prompt_tokens = 1024;
-    llama_token tokens[max_prompt_tokens];
-    int32_t n_tokens = llama_tokenize(vocab, prompt, strlen(prompt),
-                                      tokens, max_prompt_tokens, true, false);
-    if (n_tokens < 0) n_tokens = -n_tokens;
+// generate runs one prediction on slot, which the caller holds exclusively:
+// it keeps the longest prefix of tokens already in the slot's KV cache,
+// decodes the rest of the prompt and samples up to max_tokens tokens.
+//
+// Each step decodes the last sampled token together with any drafted
+// continuation in one batch. Drafts come from prompt lookup when the request
+// enables it and it finds a match, otherwise from the handle's draft model.
+// The target samples at every position in turn and keeps drafted tokens only
+// while they equal its own choice, so the output is what plain decoding
+// would sample; accepted drafts just save target decodes. Without drafts a
+// step is an ordinary one-token decode.
+//
+// When the context fills up, generation ends unless the handle has context
+// shifting enabled, in which case older tokens are evicted (llama_shift.cpp).
+//
+// A grammar constrains every sampled token and ends generation once the
+// output is a complete match that cannot grow (grammar_complete). Drafts are not used with a grammar, since
+// verifying them would need the grammar state rolled back on rejection.
+//
+// The request's cancel flag is checked before every step and, through the
+// context's abort callback, inside llama_decode, so a cancelled request
+// stops within one token (or one prompt chunk) and returns NULL.
+static char *generate(LlamaModelHandle *h, LlamaContextSlot *slot, const std::vector<llama_token> &tokens,
+                      const LlamaPredictParams &p, llama_stream_callback on_token, void *user_data) {
+    const int max_tokens = p.max_tokens;
+    const struct llama_vocab *vocab = llama_model_get_vocab(h->model);
+    int32_t n_tokens = (int32_t)tokens.size();
     if (n_tokens <= 0) return strdup_m("");
 
-    struct llama_batch batch = llama_batch_init(512, 0, 1);
-
-    // feed prompt
-    for (int i = 0; i < n_tokens; i++) {
-        batch.token[i] = tokens[i];
-        batch.pos[i] = i;
-        batch.n_seq_id[i] = 1;
-        batch.seq_id[i][0] = 0;
-        batch.logits[i] = (i == n_tokens - 1);
+    // Drop only the part of the slot's KV cache that diverges from the
+    // prompt. Positions then continue from the kept prefix, so no sequence
+    // position mismatch is possible.
+    struct llama_context *ctx = slot->ctx;
+    const int32_t n_ctx = (int32_t)llama_n_ctx(ctx);
+    if (n_tokens >= n_ctx) {
+        fprintf(stderr, "Prompt of %d tokens does not fit the %d-token context\n", n_tokens, n_ctx);
+        return NULL;
+    }
+    // Parse the grammar before spending time on the prompt.
+    struct llama_sampler *grammar = NULL;
+    if (p.grammar && p.grammar[0]) {
+        grammar = grammar_sampler(h, p.grammar);
+        if (!grammar) return NULL;
     }
-    batch.n_tokens = n_tokens;
-    llama_decode(h->ctx, batch);
 
-    llama_batch_free(batch);
+    size_t n_keep = reuse_prefix(slot, tokens.data(), n_tokens);
+    {
+        std::lock_guard<std::mutex> lock(h->pool_mu);
+        h->n_prefix_tokens += n_keep;
+    }
 
+    // Feed the remaining prompt suffix into the model. The abort callback
+    // is only installed for this request, since the context outlives it.
+    if (p.cancel) llama_set_abort_callback(ctx, abort_if_cancelled, (void *)p.cancel);
+    if (decode_prompt(h, ctx, tokens.data(), (int32_t)n_keep, n_tokens) != 0) {
+        if (p.cancel) llama_set_abort_callback(ctx, NULL, NULL);
+        clear_slot(slot);
+        if (grammar) llama_sampler_free(grammar);
+        return NULL;
+    }
+    slot->cached.assign(tokens.begin(), tokens.end());
 
-    struct llama_sampler *smpl = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(smpl, llama_sampler_init_top_k(top_k));
-    llama_sampler_chain_add(smpl, llama_sampler_init_top_p(top_p, 1));
-    llama_sampler_chain_add(smpl, llama_sampler_init_temp(temp));
-    llama_sampler_chain_add(smpl, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+    // The slot's sampler keeps its scratch space and RNG across requests.
+    slot->sampler.configure(p.temp, p.top_k, p.top_p);
+    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
 
-    char *output = (char*)malloc(8192);
-    size_t out_pos = 0;
+    // Generation loop
+    OutputBuffer output;
+    if (!output.init((size_t)(max_tokens > 0 ? max_tokens : 0) * LLAMA_OUTPUT_BYTES_PER_TOKEN)) {
+        if (p.cancel) llama_set_abort_callback(ctx, NULL, NULL);
+        if (grammar) llama_sampler_free(grammar);
+        return NULL;
+    }
 
-    for (int t = 0; t < max_tokens; t++) {
-        llama_token id = llama_sampler_sample(smpl, h->ctx, -1);
+    // With stop strings, output that may still turn out to begin one is
+    // held back from on_token until the matcher rules it out.
+    StopMatcher stop;
+    if (p.stop) stop.init(p.stop, p.n_stop);
+    size_t n_streamed = 0;
+    std::string chunk;
+    auto stream_to = [&](size_t end) {
+        if (!on_token || end <= n_streamed) return;
+        chunk.assign(output.data + n_streamed, end - n_streamed);
+        on_token(chunk.c_str(), user_data);
+        n_streamed = end;
+    };
+
+    // emit hands one generated token to the callback and the output;
+    // false means generation must end: a stop string completed (and was
+    // cut from the output) or the output could not grow.
+    auto emit = [&](llama_token id) {
+        size_t len;
+        const char *piece = token_piece(h, id, &len);
+        if (len == 0) return true;
+        if (stop.empty()) {
+            if (!output.append(piece, len)) return false;
+            // Pieces are NUL-terminated in the table
+            if (on_token) on_token(piece, user_data);
+            n_streamed = output.len;
+            return true;
+        }
+        if (!output.append(piece, len)) return false;
+        int64_t at = stop.feed(piece, len);
+        if (at >= 0) {
+            output.truncate((size_t)at);
+            stream_to(output.len);
+            return false;
+        }
+        stream_to(output.len - stop.pending());
+        return true;
+    };
+
+    // A step's batch holds the sampled token plus its drafts.
+    const int n_spec_max = (int)llama_n_batch(ctx) - 1;
+    int n_draft = h->draft_model && !grammar ? h->n_draft : 0;
+    int n_lookup = p.n_lookup > 0 && !grammar ? p.n_lookup : 0;
+    if (n_draft > n_spec_max) n_draft = n_spec_max;
+    if (n_lookup > n_spec_max) n_lookup = n_spec_max;
+    struct llama_batch batch = llama_batch_init(1 + (n_draft > n_lookup ? n_draft : n_lookup), 0, 1);
+    std::vector<llama_token> drafts;
+    uint64_t n_steps = 0, n_drafted = 0, n_accepted = 0;
+    uint64_t n_lookup_drafted = 0, n_lookup_accepted = 0;
+
+    llama_token id = slot->sampler.sample(llama_get_logits_ith(ctx, -1), n_vocab, grammar);
+    int n_gen = 0;
+    bool done = false;
+    bool shifted = false;
+    while (!done && max_tokens > 0 && !cancelled(p.cancel)) {
+        int32_t n_past = (int32_t)slot->cached.size();
         if (llama_vocab_is_eog(vocab, id)) break;
+        if (n_past >= n_ctx) {
+            // Full: continue on a shifted context if the handle allows it.
+            // cached keeps mirroring the KV cache for lookup and the draft.
+            const int32_t n_discard = shift_context(h, ctx, 0, n_past);
+            if (n_discard == 0) break;
+            auto first = slot->cached.begin() + h->params.n_sink;
+            slot->cached.erase(first, first + n_discard);
+            n_past -= n_discard;
+            shifted = true;
+        }
+        if (!emit(id) || ++n_gen >= max_tokens) break;
+        if (grammar) {
+            llama_sampler_accept(grammar, id);
+            if (grammar_complete(grammar, vocab)) break;
+        }
 
-        char piece[256];
-        int len = llama_token_to_piece(vocab, id, piece, sizeof(piece), 0, true);
-        if (len > 0 && out_pos + len < 8191) {
-            memcpy(output + out_pos, piece, len);
-            out_pos += len;
+        // Draft no further than the remaining token budget and context.
+        drafts.clear();
+        int room = max_tokens - n_gen;
+        if (room > n_ctx - n_past - 1) room = n_ctx - n_past - 1;
+        bool looked_up = false;
+        if (room > 0 && n_lookup > 0) {
+            looked_up = lookup_tokens(slot, id, room < n_lookup ? room : n_lookup, drafts) > 0;
+        }
+        if (!looked_up && room > 0 && n_draft > 0) {
+            draft_tokens(h, slot, id, room < n_draft ? room : n_draft, drafts);
         }
-        output[out_pos] = '\0';
 
-    struct llama_batch b1 = llama_batch_get_one(&id, 1);
-    llama_decode(h->ctx, b1);
-    // llama_batch_get_one returns a non-owning batch (it points to stack memory);
-    // do NOT call llama_batch_free on it because that would attempt to free
-    // memory that was not allocated by malloc and cause a crash.
+        batch.n_tokens = 0;
+        for (size_t i = 0; i <= drafts.size(); i++) {
+            int j = batch.n_tokens++;
+            batch.token[j] = i == 0 ? id : drafts[i - 1];
+            batch.pos[j] = n_past + (llama_pos)i;
+            batch.n_seq_id[j] = 1;
+            batch.seq_id[j][0] = 0;
+            batch.logits[j] = true;
+        }
+        if (handle_decode(h, ctx, batch) != 0) {
+            // The KV cache no longer matches slot->cached; start over next time.
+            clear_slot(slot);
+            break;
+        }
+        slot->cached.push_back(id);
+
+        // Verify: accept drafted tokens for as long as they match what the
+        // target samples at the same position.
+        size_t n_acc = 0;
+        llama_token next = slot->sampler.sample(llama_get_logits_ith(ctx, 0), n_vocab, grammar);
+        while (n_acc < drafts.size() && next == drafts[n_acc]) {
+            n_acc++;
+            next = slot->sampler.sample(llama_get_logits_ith(ctx, (int32_t)n_acc), n_vocab);
+        }
+        if (!drafts.empty()) {
+            n_steps++;
+            n_drafted += drafts.size();
+            n_accepted += n_acc;
+            if (looked_up) {
+                n_lookup_drafted += drafts.size();
+                n_lookup_accepted += n_acc;
+            }
+            if (n_acc < drafts.size() &&
+                !llama_memory_seq_rm(llama_get_memory(ctx), 0, n_past + 1 + (llama_pos)n_acc, -1)) {
+                clear_slot(slot);
+                break;
+            }
+        }
+        slot->cached.insert(slot->cached.end(), drafts.begin(), drafts.begin() + n_acc);
+        for (size_t i = 0; i < n_acc && !done; i++) {
+            done = llama_vocab_is_eog(vocab, drafts[i]) || !emit(drafts[i]) || ++n_gen >= max_tokens;
+        }
+        id = next;
     }
-
-    llama_sampler_free(smpl);
-    output[out_pos] = '\0';
-    return output;
+    llama_batch_free(batch);
+    if (grammar) llama_sampler_free(grammar);
+    // A shifted cache was computed with the evicted tokens in view, so it
+    // does not match a fresh decode of cached and must not serve a prefix.
+    if (shifted) clear_slot(slot);
+    if (p.cancel) llama_set_abort_callback(ctx, NULL, NULL);
+    const bool aborted = cancelled(p.cancel);
+    if (!aborted) stream_to(output.len);
+
+    if (n_steps > 0) {
+        std::lock_guard<std::mutex> lock(h->pool_mu);
+        h->n_spec_steps += n_steps;
+        h->n_drafted += n_drafted;
+        h->n_draft_accepted += n_accepted;
+        h->n_lookup_drafted += n_lookup_drafted;
+        h->n_lookup_accepted += n_lookup_accepted;
+    }
+    return aborted ? NULL : output.release();
 }
 
 char *llama_predict_stream(
@@ -146,90 +787,200 @@ char *llama_predict_stream(
     llama_stream_callback on_token,
     void *user_data
 ) {
+    LlamaPredictParams p = predict_params(max_tokens, temp, top_k, top_p);
+    return llama_predict_ex(h, prompt, &p, on_token, user_data);
+}
+
+char *llama_predict_ex(LlamaModelHandle *h, const char *prompt, const LlamaPredictParams *params,
+                       llama_stream_callback on_token, void *user_data) {
     if (!h || !prompt) return NULL;
+    const LlamaPredictParams p = params ? *params : llama_predict_params_default();
 
-    const struct llama_vocab *vocab = llama_model_get_vocab(h->model);
+    std::vector<llama_token> tokens;
+    if (!request_tokens(llama_model_get_vocab(h->model), prompt, p, tokens)) {
+        fprintf(stderr, "Failed to tokenize prompt\n");
+        return NULL;
+    }
+    if (tokens.empty()) return strdup_m("");
+
+    // Take the pooled context that already holds the longest prefix of this
+    // prompt; it is ours alone until released.
+    LlamaContextSlot *slot = acquire_context(h, tokens.data(), tokens.size());
+    if (!slot) return NULL;
+    char *out = generate(h, slot, tokens, p, on_token, user_data);
+    release_context(h, slot);
+    return out;
+}
 
-    // 1. Tokenize prompt
-    llama_token tokens[1024];
-    int n_tokens = llama_tokenize(vocab, prompt, strlen(prompt), tokens, 1024, true, false);
-    if (n_tokens < 0) n_tokens = -n_tokens;
-    if (n_tokens <= 0) return strdup("");
-
-    // 2. Feed prompt into model
-    struct llama_batch batch = llama_batch_init(512, 0, 1);
-    for (int i = 0; i < n_tokens; i++) {
-        batch.token[i] = tokens[i];
-        batch.pos[i] = i;
-        batch.n_seq_id[i] = 1;
-        batch.seq_id[i][0] = 0;
-        batch.logits[i] = (i == n_tokens - 1);
-    }
-    batch.n_tokens = n_tokens;
-    llama_decode(h->ctx, batch);
-    llama_batch_free(batch);
+LlamaContextHandle *llama_context_open(LlamaModelHandle *h) {
+    if (!h) return NULL;
+    struct llama_context *ctx = new_context(h);
+    if (!ctx) {
+        fprintf(stderr, "Failed to create llama context\n");
+        return NULL;
+    }
+    LlamaContextHandle *c = new LlamaContextHandle();
+    c->h = llama_retain_model(h);
+    c->slot.ctx = ctx;
+    return c;
+}
 
-    // 3. Sampler setup
-    struct llama_sampler *smpl = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(smpl, llama_sampler_init_top_k(top_k));
-    llama_sampler_chain_add(smpl, llama_sampler_init_top_p(top_p, 1));
-    llama_sampler_chain_add(smpl, llama_sampler_init_temp(temp));
-    llama_sampler_chain_add(smpl, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
+char *llama_context_predict(LlamaContextHandle *c, const char *prompt,
+                            int max_tokens, float temp, int top_k, float top_p) {
+    LlamaPredictParams p = predict_params(max_tokens, temp, top_k, top_p);
+    return llama_context_predict_ex(c, prompt, &p);
+}
 
-    // 4. Streaming loop
-    char *output = (char*)malloc(8192);
-    size_t out_pos = 0;
+char *llama_context_predict_ex(LlamaContextHandle *c, const char *prompt, const LlamaPredictParams *params) {
+    return llama_context_predict_stream(c, prompt, params, NULL, NULL);
+}
 
-    for (int t = 0; t < max_tokens; t++) {
-        llama_token id = llama_sampler_sample(smpl, h->ctx, -1);
-        if (llama_vocab_is_eog(vocab, id)) break;
+char *llama_context_predict_stream(LlamaContextHandle *c, const char *prompt, const LlamaPredictParams *params,
+                                   llama_stream_callback on_token, void *user_data) {
+    if (!c || !prompt) return NULL;
+    const LlamaPredictParams p = params ? *params : llama_predict_params_default();
 
-        char piece[256];
-        int len = llama_token_to_piece(vocab, id, piece, sizeof(piece), 0, true);
+    std::vector<llama_token> tokens;
+    if (!request_tokens(llama_model_get_vocab(c->h->model), prompt, p, tokens)) {
+        fprintf(stderr, "Failed to tokenize prompt\n");
+        return NULL;
+    }
+    std::lock_guard<std::mutex> lock(c->mu);
+    return generate(c->h, &c->slot, tokens, p, on_token, user_data);
+}
 
-        if (len > 0) {
-            // Send piece to callback immediately
-            if (on_token) on_token(piece, user_data);
+void llama_context_close(LlamaContextHandle *c) {
+    if (!c) return;
+    free_slot_contexts(&c->slot);
+    LlamaModelHandle *h = c->h;
+    delete c;
+    llama_close_model(h);
+}
 
-            // Also append to accumulated output
-            if (out_pos + len < 8191) {
-                memcpy(output + out_pos, piece, len);
-                out_pos += len;
-                output[out_pos] = '\0';
-            }
-        }
+int llama_set_draft_model(LlamaModelHandle *h, const char *draft_path, int n_draft) {
+    if (!h || !draft_path) return -1;
+    if (h->draft_model) {
+        fprintf(stderr, "Model already has a draft model\n");
+        return -1;
+    }
+
+    // On the target's node when it is a replica.
+    struct llama_model *draft = load_model_file(draft_path, h->params);
+    if (!draft) {
+        fprintf(stderr, "Failed to load draft model: %s\n", draft_path);
+        return -1;
+    }
 
-    struct llama_batch b1 = llama_batch_get_one(&id, 1);
-    llama_decode(h->ctx, b1);
-    // see comment above: do not free b1 because it's non-owning
+    // Draft tokens are fed to the target as-is, so both models must agree
+    // on every token id.
+    const struct llama_vocab *vt = llama_model_get_vocab(h->model);
+    const struct llama_vocab *vd = llama_model_get_vocab(draft);
+    if (llama_vocab_type(vt) != llama_vocab_type(vd) ||
+        llama_vocab_n_tokens(vt) != llama_vocab_n_tokens(vd) ||
+        llama_vocab_bos(vt) != llama_vocab_bos(vd) ||
+        llama_vocab_eos(vt) != llama_vocab_eos(vd)) {
+        fprintf(stderr, "Draft model %s does not share the target model's vocabulary\n", draft_path);
+        llama_model_free(draft);
+        return -1;
     }
 
-    llama_sampler_free(smpl);
-    output[out_pos] = '\0';
-    return output;
+    h->draft_model = draft;
+    h->n_draft = n_draft > 0 ? n_draft : LLAMA_DEFAULT_N_DRAFT;
+    return 0;
 }
 
+void llama_get_spec_stats(LlamaModelHandle *h, LlamaSpecStats *out) {
+    if (!out) return;
+    memset(out, 0, sizeof(*out));
+    if (!h) return;
+    std::lock_guard<std::mutex> lock(h->pool_mu);
+    out->n_steps = h->n_spec_steps;
+    out->n_drafted = h->n_drafted;
+    out->n_accepted = h->n_draft_accepted;
+    out->n_lookup_drafted = h->n_lookup_drafted;
+    out->n_lookup_accepted = h->n_lookup_accepted;
+}
 
 void llama_free_string(char *s) {
     if (s) free(s);
 }
 
+LlamaModelHandle *llama_retain_model(LlamaModelHandle *h) {
+    if (h) h->refs.fetch_add(1, std::memory_order_relaxed);
+    return h;
+}
+
 void llama_close_model(LlamaModelHandle *h) {
     if (!h) return;
-    llama_free(h->ctx);
+    if (h->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    if (h->engine) engine_free(h->engine);
+    for (LlamaContextSlot *slot : h->idle) {
+        free_slot_contexts(slot);
+        delete slot;
+    }
+    if (h->embed_ctx) llama_free(h->embed_ctx);
+    for (auto &g : h->grammars) llama_sampler_free(g.second);
+    if (h->draft_model) llama_model_free(h->draft_model);
     llama_model_free(h->model);
-    llama_backend_free();
-    free(h);
+    llama_threadpool_free(h->threadpool);
+    delete h;
+    backend_release();
 }
 
 void llama_reset_context(LlamaModelHandle* h) {
     if (!h) return;
-    if (h->ctx) {
-        llama_free(h->ctx);
+    std::lock_guard<std::mutex> lock(h->pool_mu);
+    for (LlamaContextSlot *slot : h->idle) {
+        clear_slot(slot);
     }
-    struct llama_context_params cparams = llama_context_default_params();
-    cparams.n_threads = 4;
-    cparams.n_threads_batch = 4;
-    cparams.n_ctx = 2048;
-    h->ctx = llama_init_from_model(h->model, cparams);
+}
+
+void llama_set_context_pool_size(LlamaModelHandle *h, int pool_size) {
+    if (!h) return;
+    if (pool_size < 0) pool_size = 0;
+
+    std::vector<LlamaContextSlot *> evicted;
+    {
+        std::lock_guard<std::mutex> lock(h->pool_mu);
+        h->pool_size = pool_size;
+        while ((int)h->idle.size() > pool_size) {
+            evicted.push_back(h->idle.back());
+            h->idle.pop_back();
+        }
+    }
+    for (LlamaContextSlot *slot : evicted) {
+        free_slot_contexts(slot);
+        delete slot;
+    }
+}
+
+void llama_set_batch_size(LlamaModelHandle *h, int n_batch, int n_ubatch) {
+    if (!h) return;
+    if (n_batch <= 0) n_batch = LLAMA_DEFAULT_N_BATCH;
+    if (n_batch > h->params.n_ctx) n_batch = h->params.n_ctx;
+    if (n_ubatch <= 0 || n_ubatch > n_batch) n_ubatch = n_batch;
+
+    // Batch sizes are fixed when a context is created, so idle contexts built
+    // with the old values are dropped and re-created on demand.
+    std::vector<LlamaContextSlot *> evicted;
+    {
+        std::lock_guard<std::mutex> lock(h->pool_mu);
+        h->params.n_batch = n_batch;
+        h->params.n_ubatch = n_ubatch;
+        evicted.swap(h->idle);
+    }
+    for (LlamaContextSlot *slot : evicted) {
+        free_slot_contexts(slot);
+        delete slot;
+    }
+}
+
+void llama_get_pool_stats(LlamaModelHandle *h, LlamaPoolStats *out) {
+    if (!h || !out) return;
+    std::lock_guard<std::mutex> lock(h->pool_mu);
+    out->pool_size = h->pool_size;
+    out->n_idle = (int)h->idle.size();
+    out->n_created = h->n_created;
+    out->n_reused = h->n_reused;
+    out->n_prefix_tokens = h->n_prefix_tokens;
 }
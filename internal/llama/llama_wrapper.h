@@ -11,23 +11,172 @@ extern "C" {
 // Opaque handle to a loaded model/context
 typedef struct LlamaModelHandle LlamaModelHandle;
 
+// Opaque handle to a context with its own KV cache on a shared model
+typedef struct LlamaContextHandle LlamaContextHandle;
+
 typedef void (*llama_stream_callback)(const char *token_text, void *user_data);
 
 
 // Load a model from a file path and return a handle, or NULL on error.
 // Caller takes ownership and must call llama_close_model(handle).
+// Equivalent to llama_load_model_ex with default parameters and n_threads
+// used for both prefill and decode.
 LlamaModelHandle* llama_load_model(const char* model_path, int n_threads);
 
+// Element type of the KV cache. Quantized caches trade a little accuracy
+// for a much smaller per-token footprint (q8_0 roughly halves f16, q4_0
+// roughly quarters it). Quantizing V requires flash attention.
+typedef enum LlamaKVCacheType {
+    LLAMA_KV_CACHE_F16  = 0,
+    LLAMA_KV_CACHE_Q8_0 = 1,
+    LLAMA_KV_CACHE_Q4_0 = 2
+} LlamaKVCacheType;
+
+// Compute threadpools. By default every context computes on threads of its
+// own, so contexts decoding at the same time oversubscribe the cores. A
+// threadpool keeps the contexts of the models loaded with it on a CPU set
+// (the host when not pinned) with persistent workers, never running more
+// threads than the set has cores: the cores are split into lanes of
+// n_threads, each pinned to CPUs of its own, and every decode runs on a free
+// lane or waits for one. With the default n_threads (every core) decodes
+// take turns; a smaller n_threads lets cores / n_threads decodes run at once.
+// Models that should not compete for cores get pools on disjoint CPU sets.
+// Handles keep their pool alive; llama_threadpool_free drops the caller's
+// reference.
+typedef struct LlamaThreadpool LlamaThreadpool;
+typedef struct LlamaThreadpoolParams {
+    int n_threads;       // workers per generation step (<= 0: one per physical
+                         // core of cpus, or of the host)
+    int n_threads_batch; // workers per prompt prefill (<= 0: n_threads)
+    const char *cpus;    // CPUs the workers are pinned to, e.g. "0-7,16" (NULL = any)
+    int poll;            // busy-wait level 0-100 before a worker sleeps (50)
+} LlamaThreadpoolParams;
+LlamaThreadpoolParams llama_threadpool_params_default(void);
+LlamaThreadpool* llama_threadpool_new(const LlamaThreadpoolParams* params);
+int llama_threadpool_threads(LlamaThreadpool* pool);
+int llama_threadpool_batch_threads(LlamaThreadpool* pool);
+void llama_threadpool_free(LlamaThreadpool* pool);
+
+// Physical cores the process may run on; the default thread count.
+int llama_default_threads(void);
+
+// NUMA placement. Decoding is bound by memory bandwidth, and weights on the
+// other socket are read at a fraction of local speed.
+//   DISTRIBUTE  spread compute threads over all nodes (llama.cpp's numa mode;
+//               drop the page cache first so the weights are not all on the
+//               node that read them last)
+//   ISOLATE     keep compute threads on the node the process started on
+//   REPLICATE   load a private copy of the weights onto numa_node and run
+//               the handle's contexts there; load one handle per node and
+//               route each request to a context on its node
+// DISTRIBUTE and ISOLATE configure the whole process; the first load that
+// asks for one wins. Nodes are numbered 0 .. llama_numa_nodes() - 1.
+typedef enum {
+    LLAMA_NUMA_NONE       = 0,
+    LLAMA_NUMA_DISTRIBUTE = 1,
+    LLAMA_NUMA_ISOLATE    = 2,
+    LLAMA_NUMA_REPLICATE  = 3
+} LlamaNumaStrategy;
+
+// Number of NUMA nodes with CPUs (1 when the host is not NUMA).
+int llama_numa_nodes(void);
+
+// Write the CPU list of node (e.g. "0-15,32-47") to out, NUL-terminated;
+// empty when the host does not report its topology. Returns the list's
+// length, which may exceed n_out - 1 when truncated, or -1 for a node that
+// does not exist.
+int llama_numa_node_cpus(int node, char* out, int n_out);
+
+// Load-time parameters. They are stored on the handle and honored by every
+// context it creates. Size and thread fields <= 0 fall back to the defaults
+// noted below.
+typedef struct LlamaLoadParams {
+    int n_ctx;           // context length per sequence (2048)
+    int n_batch;         // prompt tokens per llama_decode call (512, <= n_ctx)
+    int n_ubatch;        // physical micro-batch size (512, <= n_batch)
+    int n_threads;       // threads used while generating (physical cores)
+    int n_threads_batch; // threads used for prompt prefill (n_threads)
+    int flash_attn;      // -1 = auto, 0 = off, 1 = on
+    int use_mmap;        // map the model file instead of reading it
+    int use_mlock;       // lock model memory so it is never paged out
+    int prefault;        // read all weights in at load time rather than on
+                         // first use, so the first prediction does not fault
+    int huge_pages;      // back mapped weights with transparent huge pages
+                         // where the kernel supports it for files
+    LlamaKVCacheType type_k; // K cache element type (f16)
+    LlamaKVCacheType type_v; // V cache element type (f16)
+    LlamaThreadpool *threadpool; // pool all contexts compute on; its thread
+                                 // counts replace n_threads and n_threads_batch
+                                 // (NULL = threads per context)
+    LlamaNumaStrategy numa; // NUMA placement (NONE)
+    int numa_node;          // node of the replica with LLAMA_NUMA_REPLICATE; its
+                            // contexts get a pool on the node's CPUs unless
+                            // threadpool is set
+    int ctx_shift;          // a generation that fills its context evicts the
+                            // older half of its tokens after the first n_sink
+                            // and continues, instead of stopping
+    int n_sink;             // leading tokens context shifting keeps (4)
+} LlamaLoadParams;
+
+// Return the default load parameters.
+LlamaLoadParams llama_load_params_default(void);
+
+// Load a model with explicit parameters (NULL selects the defaults).
+LlamaModelHandle* llama_load_model_ex(const char* model_path, const LlamaLoadParams* params);
+
+// Fill out with the resolved parameters of the handle.
+void llama_get_load_params(LlamaModelHandle* h, LlamaLoadParams* out);
+
+// Load cost and memory footprint of a handle. Unmapped weights count as
+// resident; compute buffers and KV caches are only part of rss_bytes.
+typedef struct LlamaLoadStats {
+    double load_ms;          // wall time of llama_load_model_ex
+    uint64_t model_bytes;    // size of the weights
+    uint64_t mapped_bytes;   // bytes of the model file mapped (0 if read in)
+    uint64_t resident_bytes; // weight bytes currently in memory
+    uint64_t rss_bytes;      // resident set of the whole process (0 if unknown)
+} LlamaLoadStats;
+
+void llama_get_load_stats(LlamaModelHandle* h, LlamaLoadStats* out);
+
+// Bytes of KV cache one token occupies in one sequence with the handle's
+// cache types, summed over all layers.
+uint64_t llama_kv_bytes_per_token(LlamaModelHandle* h);
+
 // Run prediction for a prompt. Returns a malloc'd C string (caller must free).
 // max_tokens: maximum tokens to generate
 // returns NULL on error.
 char* llama_predict(LlamaModelHandle* h, const char* prompt, int max_tokens, float temp, int top_k, float top_p);
 
-// Reset the context (KV cache) for a loaded model handle. This frees the
-// existing context and creates a fresh one so subsequent predictions start
-// with an empty KV cache.
+// Reset the context (KV cache) for a loaded model handle. Pooled contexts keep
+// the tokens of their last prediction so a following prompt with the same
+// prefix can reuse them; this clears the memory of all idle contexts so the
+// next prediction starts from an empty KV cache. No context is re-allocated.
 void llama_reset_context(LlamaModelHandle* h);
 
+// Context pool statistics for a handle. Contexts are kept in a pool instead
+// of being re-created for each prediction.
+typedef struct LlamaPoolStats {
+    int pool_size;            // maximum number of idle contexts retained
+    int n_idle;               // contexts currently idle in the pool
+    uint64_t n_created;       // contexts freshly allocated
+    uint64_t n_reused;        // predictions served by an already allocated context
+    uint64_t n_prefix_tokens; // prompt tokens served from a cached KV prefix
+} LlamaPoolStats;
+
+// Set the maximum number of idle contexts kept by the handle. Idle contexts
+// beyond the new size are freed immediately.
+void llama_set_context_pool_size(LlamaModelHandle* h, int pool_size);
+
+// Set the prompt chunk sizes used by contexts of the handle: prompts are fed
+// to llama_decode n_batch tokens at a time, each split into n_ubatch-sized
+// micro-batches. Values <= 0 select the defaults. Idle pooled contexts are
+// dropped so new ones pick up the sizes.
+void llama_set_batch_size(LlamaModelHandle* h, int n_batch, int n_ubatch);
+
+// Fill out with the current pool statistics of the handle.
+void llama_get_pool_stats(LlamaModelHandle* h, LlamaPoolStats* out);
+
 char *llama_predict_stream(
     LlamaModelHandle *h,
     const char *prompt,
@@ -39,13 +188,277 @@ char *llama_predict_stream(
     void *user_data
 );
 
+// Cancellation flag shared between a request and the thread that may cancel
+// it. Setting it is safe from any thread; a generation holding it stops
+// before its next decode step (a decode already running is aborted too) and
+// returns NULL. Free the flag once the request has returned.
+typedef struct LlamaCancelFlag LlamaCancelFlag;
+LlamaCancelFlag* llama_cancel_flag_new(void);
+void llama_cancel_flag_set(LlamaCancelFlag* c);
+void llama_cancel_flag_free(LlamaCancelFlag* c);
+
+// Per-request generation parameters, extensible without changing the entry
+// points. Start from llama_predict_params_default and override fields.
+typedef struct LlamaPredictParams {
+    int max_tokens; // maximum tokens to generate (128)
+    float temp;     // sampling temperature; <= 0 is greedy (0.8)
+    int top_k;      // keep the k most likely tokens; <= 0 keeps all (40)
+    float top_p;    // nucleus sampling mass (0.95)
+    int n_lookup;   // prompt lookup: tokens proposed per step by matching
+                    // the latest n-gram against earlier text (0 = off)
+    const char *grammar; // GBNF grammar with a "root" rule the output must
+                         // match (NULL = unconstrained)
+    const char *const *stop; // strings that end generation when they appear
+    int n_stop;              // in the output; the match is not returned
+    const int32_t *prefix_tokens; // tokens standing for the first prefix_len
+    int n_prefix_tokens;          // bytes of the prompt, from
+    int prefix_len;               // llama_tokenize_prompt (NULL = none)
+    const LlamaCancelFlag *cancel; // stops the request once set (NULL = none)
+} LlamaPredictParams;
+
+// Return the default per-request parameters.
+LlamaPredictParams llama_predict_params_default(void);
+
+// llama_predict_stream with explicit parameters (NULL selects the defaults).
+//
+// Prompt lookup is speculative decoding without a draft model: the tokens
+// that followed the previous occurrence of the current n-gram in the prompt
+// or output are proposed and verified in one llama_decode, as with
+// llama_set_draft_model. It pays off when the output quotes its input
+// (extraction, summaries, code edits). When both are available, lookup is
+// tried first and the draft model fills in steps without a match.
+//
+// With a grammar, every token is sampled from those the grammar allows,
+// including the end token once the output is a complete match; generation
+// ends when the model picks it, or at once when the match cannot grow any
+// further. Each distinct grammar is
+// parsed once per handle. Constrained requests do not speculate. Returns
+// NULL if the grammar does not parse.
+//
+// Stop strings are matched incrementally over the generated text, also
+// across token boundaries. Generation ends the moment one is complete and
+// the output ends right before it. on_token only receives text once no stop
+// string can start in it, so streamed and returned output agree.
+//
+// With prefix tokens, only the prompt past prefix_len is tokenized, as a
+// continuation of the prefix (without BOS). The tokens are used as given;
+// the caller guarantees they match that part of the prompt.
+char* llama_predict_ex(LlamaModelHandle* h, const char* prompt, const LlamaPredictParams* params,
+                       llama_stream_callback on_token, void* user_data);
+
+// Single-producer/single-consumer byte ring for streaming output to another
+// thread without calling back into it per token. Pass llama_stream_write as
+// on_token with the stream as user_data; the predicting thread appends every
+// piece (waiting while the ring is full) and calls llama_stream_close_write
+// once the prediction has returned. The reading thread calls
+// llama_stream_read, which waits until text is available and returns all of
+// it up to n_max bytes, or 0 once the stream is closed and drained (-1 on
+// bad arguments). Bytes arrive in order but a read may end inside a UTF-8
+// sequence. capacity <= 0 selects 64 KiB; it is rounded up to a power of
+// two. A reader that stops reading calls llama_stream_abandon: the writer
+// then discards everything it is given instead of waiting for room, and
+// further reads return 0. Free the stream once both sides are done with it.
+typedef struct LlamaTokenStream LlamaTokenStream;
+LlamaTokenStream* llama_stream_open(int capacity);
+void llama_stream_write(const char* text, void* user_data);
+void llama_stream_close_write(LlamaTokenStream* s);
+void llama_stream_abandon(LlamaTokenStream* s);
+int llama_stream_read(LlamaTokenStream* s, char* out, int n_max);
+void llama_stream_free(LlamaTokenStream* s);
+
+
+// Continuous-batching engine. Once started, the handle owns an additional
+// context with n_parallel sequences driven by a background thread; any number
+// of threads may call llama_engine_predict concurrently and their requests
+// are decoded together, one llama_decode per step. Requests beyond
+// n_parallel wait in a queue until a sequence is retired.
+// Returns 0 on success (or if the engine is already running), -1 on error.
+int llama_engine_start(LlamaModelHandle* h, int n_parallel);
+
+// Stop the engine. Requests still queued or in flight fail with NULL. Safe to
+// call while other threads predict on the engine; it returns once they have
+// all left it.
+void llama_engine_stop(LlamaModelHandle* h);
+
+// Returns 1 if the engine of h is running, 0 otherwise.
+int llama_engine_running(LlamaModelHandle* h);
+
+// Same contract as llama_predict, but served by the engine. Safe to call
+// from multiple threads; blocks until the generation completes.
+char* llama_engine_predict(LlamaModelHandle* h, const char* prompt, int max_tokens, float temp, int top_k, float top_p);
+
+// llama_engine_predict with explicit parameters (NULL selects the defaults).
+// The engine honors the sampling fields, stop strings, prefix tokens and the
+// cancel flag; it neither speculates nor applies grammars, so n_lookup and
+// grammar are ignored. A cancelled request leaves the engine at its next
+// step without disturbing the sequences decoded alongside it.
+char* llama_engine_predict_ex(LlamaModelHandle* h, const char* prompt, const LlamaPredictParams* params);
+
+// Predict n independent prompts together: their prefills and decodes run as
+// separate sequences sharing each llama_decode call, instead of one
+// prediction after another. params holds one entry per prompt (NULL selects
+// the defaults for all). outputs[i] receives the malloc'd output of
+// prompts[i], or NULL if it failed. Returns the number of outputs set, or
+// -1 on invalid arguments.
+// The running engine serves the batch if there is one; otherwise a one-off
+// engine of up to 16 sequences is created for it. As with the engine,
+// n_lookup is ignored; prompts with a grammar are predicted one at a time
+// after the others.
+int llama_predict_batch(LlamaModelHandle* h, const char* const* prompts, int n,
+                        const LlamaPredictParams* params, char** outputs);
+
+// Generate n candidate completions of one prompt (1 <= n <= 64). The prompt
+// is decoded once and its KV cache shared by n sequences, which then decode
+// together with samplers of their own, so the candidates cost one prefill.
+// params (NULL selects the defaults) applies to every candidate; with
+// temp <= 0 they are all the same. outputs[i] receives the malloc'd text of
+// candidate i. Returns the number of outputs set: n, or 0 if the generation
+// failed or was cancelled; -1 on invalid arguments. Drafts and n_lookup are
+// not used. n == 1 is llama_predict_ex.
+int llama_predict_n(LlamaModelHandle* h, const char* prompt, const LlamaPredictParams* params, int n,
+                    char** outputs);
+
+typedef struct LlamaEngineStats {
+    int n_parallel;            // sequences decoded together
+    int n_active;              // sequences currently being generated
+    int n_pending;             // requests waiting for a free sequence
+    uint64_t n_requests;       // requests submitted
+    uint64_t n_decode_calls;   // llama_decode steps executed
+    uint64_t n_tokens_decoded; // tokens across all decode steps
+} LlamaEngineStats;
+
+// Fill out with the engine statistics of h (all zero if not running).
+void llama_get_engine_stats(LlamaModelHandle* h, LlamaEngineStats* out);
+
+// Speculative decoding. Pair h with a small draft model that shares its
+// vocabulary: at every step the draft greedily proposes up to n_draft tokens
+// (<= 0 selects 8) and the target verifies them in a single llama_decode,
+// keeping the longest prefix that matches what it samples itself. Output
+// follows the target's sampling either way; only the number of target
+// decodes changes. A handle pairs with at most one draft model for its
+// lifetime; set it before the first prediction. The batching engine does
+// not speculate. Returns 0 on success, -1 if the draft cannot be loaded,
+// its vocabulary differs from the target's, or h already has one.
+int llama_set_draft_model(LlamaModelHandle* h, const char* draft_path, int n_draft);
+
+typedef struct LlamaSpecStats {
+    uint64_t n_steps;    // target decodes that verified at least one draft token
+    uint64_t n_drafted;  // draft tokens proposed
+    uint64_t n_accepted; // draft tokens accepted by the target
+    uint64_t n_lookup_drafted;  // of n_drafted, proposed by prompt lookup
+    uint64_t n_lookup_accepted; // of n_accepted, proposed by prompt lookup
+} LlamaSpecStats;
+
+// Fill out with the speculative decoding statistics of h.
+void llama_get_spec_stats(LlamaModelHandle* h, LlamaSpecStats* out);
+
+// Context shifting counters of a handle loaded with ctx_shift.
+typedef struct LlamaShiftStats {
+    uint64_t n_shifts;         // times a full context was shifted
+    uint64_t n_evicted_tokens; // tokens evicted by those shifts
+} LlamaShiftStats;
+
+// Fill out with the context shifting statistics of h.
+void llama_get_shift_stats(LlamaModelHandle* h, LlamaShiftStats* out);
+
+// Embeddings. llama_embed_batch writes one vector of llama_embed_size(h)
+// floats per text to out, in order, each scaled to unit length so a dot
+// product is the cosine similarity. Texts are decoded many to a
+// llama_decode call on a context of their own with the model's pooling
+// (mean pooling for generative models). A text longer than the handle's
+// n_batch is embedded by its first n_batch tokens. Thread-safe; concurrent
+// calls on one handle are serialized. Returns 0 on success, -1 on error.
+int llama_embed_size(LlamaModelHandle* h);
+int llama_embed_batch(LlamaModelHandle* h, const char* const* texts, int n_texts, float* out);
+
+// Prompt state persistence. llama_save_prompt_state decodes prompt on a
+// pooled context and writes the resulting sequence state (tokens and KV
+// cache) to path. llama_load_prompt_state restores such a file into a
+// cleared pooled context, so the next prediction whose prompt starts with
+// the saved tokens only decodes the remainder. The file is memory-mapped on
+// restore where the platform allows it. A state only loads into a handle
+// with the same model and KV cache types it was saved from.
+// Both return the number of tokens saved/restored, or -1 on error.
+int llama_save_prompt_state(LlamaModelHandle* h, const char* prompt, const char* path);
+int llama_load_prompt_state(LlamaModelHandle* h, const char* path);
+
+// Vocabulary-only handles tokenize prompts ahead of time (e.g. when a
+// workflow is compiled) without loading any weights. llama_tokenize_prompt
+// writes the tokens of text to out, which must hold strlen(text) + 2
+// tokens, adding BOS/EOS as the model does when add_special is set. It
+// returns the number of tokens, or -1 on error.
+typedef struct LlamaVocabHandle LlamaVocabHandle;
+LlamaVocabHandle* llama_open_vocab(const char* model_path);
+int llama_tokenize_prompt(LlamaVocabHandle* v, const char* text, int add_special, int32_t* out, int n_max);
+void llama_close_vocab(LlamaVocabHandle* v);
 
 // Free the C string returned by llama_predict
 void llama_free_string(char* s);
 
+// Model handles are reference counted. llama_retain_model adds a reference
+// and returns h; llama_close_model drops one and frees the model, its
+// pooled contexts and engine once no reference is left.
+LlamaModelHandle* llama_retain_model(LlamaModelHandle* h);
+
 // Close model and free resources
 void llama_close_model(LlamaModelHandle* h);
 
+// Model registry. Models acquired through it are shared by every caller
+// asking for the same file (by canonical path) with the same load
+// parameters and draft model. The registry holds a reference of its own, so
+// a model stays loaded after its last user releases it and the next
+// acquire finds it ready. Once the weights of the registered models exceed
+// the budget, idle models (held by nothing but the registry) are closed,
+// least recently acquired first, before another model is loaded and
+// whenever a model is released.
+// llama_registry_acquire returns a reference for the caller (NULL on
+// error), dropped with llama_registry_release.
+LlamaModelHandle* llama_registry_acquire(const char* model_path, const LlamaLoadParams* params,
+                                         const char* draft_path, int n_draft);
+void llama_registry_release(LlamaModelHandle* h);
+
+// Budget in bytes of weights for the registered models (0 = unlimited, the
+// default). Idle models beyond a new budget are closed right away.
+void llama_registry_set_budget(uint64_t bytes);
+
+// Close every idle registered model. Returns how many were closed.
+int llama_registry_evict_idle(void);
+
+typedef struct LlamaRegistryStats {
+    int n_models;         // registered models
+    int n_idle;           // of those, held only by the registry
+    uint64_t bytes;       // weights of the registered models
+    uint64_t budget;      // 0 = unlimited
+    uint64_t n_hits;      // acquires served by a registered model
+    uint64_t n_loads;     // acquires that loaded a model
+    uint64_t n_evictions; // idle models closed to stay within the budget
+} LlamaRegistryStats;
+
+void llama_registry_get_stats(LlamaRegistryStats* out);
+
+// Per-caller contexts. A context shares the weights of h (holding a
+// reference to it) but has its own KV cache and lock, so goroutines or
+// threads that each own a context predict concurrently without any global
+// serialization. Calls on one context are serialized; its KV cache keeps the
+// last prompt so a following prompt with the same prefix skips re-decoding.
+LlamaContextHandle* llama_context_open(LlamaModelHandle* h);
+char* llama_context_predict(LlamaContextHandle* c, const char* prompt, int max_tokens, float temp, int top_k, float top_p);
+char* llama_context_predict_ex(LlamaContextHandle* c, const char* prompt, const LlamaPredictParams* params);
+// llama_context_predict_ex passing the output to on_token as it is generated.
+char* llama_context_predict_stream(LlamaContextHandle* c, const char* prompt, const LlamaPredictParams* params,
+                                   llama_stream_callback on_token, void* user_data);
+void llama_context_close(LlamaContextHandle* c);
+
+// llama_save_prompt_state / llama_load_prompt_state on a context's own KV
+// cache instead of the handle's pool.
+int llama_context_save_prompt_state(LlamaContextHandle* c, const char* prompt, const char* path);
+int llama_context_load_prompt_state(LlamaContextHandle* c, const char* path);
+
+// llama_context_save_prompt_state for an already tokenized prompt, such as
+// the compile-time tokens of a prompt's static prefix. Only those tokens
+// are kept in the context afterwards.
+int llama_context_save_token_state(LlamaContextHandle* c, const int32_t* tokens, int n_tokens, const char* path);
+
 #ifdef __cplusplus
 }
 #endif
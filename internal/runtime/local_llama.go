@@ -1,11 +1,21 @@
 package runtime
 
 import (
+	"context"
+	"crypto/sha256"
+	"encoding/binary"
+	"encoding/hex"
+	"encoding/json"
+	"errors"
 	"fmt"
 	"os"
 	"path/filepath"
+	"sort"
+	"strings"
 	"sync"
+	"time"
 
+	"github.com/LiboWorks/llm-compiler/internal/config"
 	"github.com/LiboWorks/llm-compiler/internal/llama"
 	"github.com/LiboWorks/llm-compiler/internal/worker"
 )
@@ -13,7 +23,9 @@ import (
 // LocalLlamaRuntime manages loaded models (cached) and generation.
 type LocalLlamaRuntime struct {
 	mu     sync.Mutex
-	models map[string]*llama.Model // model handle from binding
+	models map[string]*localModel // keyed by modelKey
+	// prompt state files already restored into (or saved from) a runtime context
+	restored map[string]bool
 	// Optional worker client for subprocess-backed generation
 	workerClient *worker.Client
 	// default options; kept simple for the internal wrapper
@@ -21,14 +33,20 @@ type LocalLlamaRuntime struct {
 	// opts field removed because the internal wrapper uses PredictOptions per-call
 }
 
-// predictMu serializes Predict calls into the llama binding to avoid
-// concurrent access to underlying ggml/llama C contexts which can cause
-// KV-cache / sequence-position corruption on some backends (Metal).
-var predictMu sync.Mutex
+// localModel is a shared model as seen by one runtime. Unless the batching
+// engine serves the model, the runtime predicts on a context of its own:
+// its KV cache and lock are never touched by other runtimes, so runtimes of
+// workflows running in parallel do not serialize against each other.
+type localModel struct {
+	model *llama.Model
+	ctx   *llama.Context // nil when the engine is running
+	key   string         // shared key of the model (or of its NUMA replica)
+}
 
 func NewLocalLlamaRuntime() *LocalLlamaRuntime {
 	r := &LocalLlamaRuntime{
-		models: make(map[string]*llama.Model),
+		models:   make(map[string]*localModel),
+		restored: make(map[string]bool),
 	}
 
 	// If environment opts into subprocess mode, start a worker client.
@@ -45,31 +63,174 @@ func NewLocalLlamaRuntime() *LocalLlamaRuntime {
 	return r
 }
 
-// LoadModel loads a gguf model from filePath (caches handle).
+// LocalLLMOptions carries per-step settings for a local generation. The
+// zero value uses the runtime defaults.
+type LocalLLMOptions struct {
+	// MaxTokens limits the completion length (0 = runtime default).
+	MaxTokens int
+	// KVCacheType overrides the KV cache element type ("f16", "q8_0" or
+	// "q4_0") for both K and V. Models loaded with different cache types
+	// are cached separately.
+	KVCacheType string
+	// DraftModel enables speculative decoding with this draft GGUF, which
+	// proposes DraftTokens tokens per step (0 = default). Empty uses
+	// LLAMA_DRAFT_MODEL, if set.
+	DraftModel  string
+	DraftTokens int
+	// PromptLookup enables draft-free speculative decoding that proposes
+	// up to PromptLookup tokens per step from earlier text (0 = use
+	// LLAMA_PROMPT_LOOKUP). Unlike the options above it does not affect
+	// which handle serves the step.
+	PromptLookup int
+	// Grammar is GBNF text constraining the completion; generation stops
+	// when the model ends a complete match, or once the match cannot grow.
+	// Empty leaves it unconstrained.
+	Grammar string
+	// Stop ends the completion at the first of these strings, which is
+	// not included in the result.
+	Stop []string
+	// N > 1 generates N candidate completions from one decode of the
+	// prompt and returns them as a JSON array of strings.
+	N int
+	// Prefix is the prompt's static beginning tokenized for the model when
+	// the workflow was compiled. It is used when the prompt starts with
+	// Prefix.Text, so only the rest of the prompt is tokenized.
+	Prefix *PromptPrefix
+}
+
+// PromptPrefix is the static text a prompt template starts with and its
+// tokens, including BOS, for the step's model.
+type PromptPrefix struct {
+	Text   string
+	Tokens []int32
+}
+
+// LoadModel loads a gguf model from filePath. Models are shared by every
+// runtime in the process and stay loaded until the last runtime using them
+// is closed.
 func (r *LocalLlamaRuntime) LoadModel(filePath string) (*llama.Model, error) {
+	lm, _, err := r.loadModel(filePath, LocalLLMOptions{})
+	if err != nil {
+		return nil, err
+	}
+	return lm.model, nil
+}
+
+// loadModel returns the runtime's view of the model for filePath and opts
+// together with its cache key.
+func (r *LocalLlamaRuntime) loadModel(filePath string, opts LocalLLMOptions) (*localModel, string, error) {
 	r.mu.Lock()
 	defer r.mu.Unlock()
 
 	abs, _ := filepath.Abs(filePath)
-	if m, ok := r.models[abs]; ok {
-		return m, nil
+	if opts.DraftModel != "" {
+		opts.DraftModel, _ = filepath.Abs(opts.DraftModel)
+	}
+	key := modelKey(abs, opts)
+	if lm, ok := r.models[key]; ok {
+		return lm, key, nil
 	}
 
-	// Use the internal wrapper's LoadModel API
-	model, err := llama.LoadModel(abs, 4)
+	loadOpts := llamaLoadOptions(config.Get())
+	if opts.KVCacheType != "" {
+		t, err := llama.ParseKVCacheType(opts.KVCacheType)
+		if err != nil {
+			return nil, "", err
+		}
+		loadOpts.CacheTypeK, loadOpts.CacheTypeV = t, t
+	}
+	if opts.DraftModel != "" {
+		loadOpts.DraftModel = opts.DraftModel
+		if opts.DraftTokens > 0 {
+			loadOpts.DraftTokens = opts.DraftTokens
+		}
+	}
+	model, sharedKey, err := acquireModel(key, abs, loadOpts)
 	if err != nil {
-		return nil, fmt.Errorf("failed to load model %s: %w", abs, err)
+		return nil, "", err
 	}
 
-	r.models[abs] = model
-	return model, nil
+	lm := &localModel{model: model, key: sharedKey}
+	if !model.EngineRunning() {
+		if lm.ctx, err = model.NewContext(); err != nil {
+			releaseModel(sharedKey)
+			return nil, "", fmt.Errorf("failed to create context for %s: %w", abs, err)
+		}
+	}
+
+	r.models[key] = lm
+	return lm, key, nil
+}
+
+// modelKey identifies a loaded handle: the same file loaded with different
+// per-step load options gets its own handle.
+func modelKey(absPath string, opts LocalLLMOptions) string {
+	key := absPath
+	if opts.KVCacheType != "" {
+		key += "#kv=" + opts.KVCacheType
+	}
+	if opts.DraftModel != "" {
+		key += fmt.Sprintf("#draft=%s:%d", opts.DraftModel, opts.DraftTokens)
+	}
+	return key
+}
+
+// llamaLoadOptions maps the LLAMA_* configuration onto wrapper load options.
+func llamaLoadOptions(cfg *config.Config) llama.LoadOptions {
+	return llama.LoadOptions{
+		ContextSize:  cfg.LlamaContextSize,
+		BatchSize:    cfg.LlamaBatchSize,
+		UBatchSize:   cfg.LlamaUBatchSize,
+		Threads:      cfg.LlamaThreads,
+		BatchThreads: cfg.LlamaBatchThreads,
+		FlashAttn:    llama.ParseFlashAttn(cfg.LlamaFlashAttn),
+		NoMmap:       !cfg.LlamaMmap,
+		Mlock:        cfg.LlamaMlock,
+		Prefault:     cfg.LlamaPrefault,
+		HugePages:    cfg.LlamaHugePages,
+		CacheTypeK:   kvCacheType(cfg.LlamaCacheTypeK),
+		CacheTypeV:   kvCacheType(cfg.LlamaCacheTypeV),
+		DraftModel:   cfg.LlamaDraftModel,
+		DraftTokens:  cfg.LlamaDraftTokens,
+		Numa:         numaStrategy(cfg.LlamaNuma),
+		ContextShift: cfg.LlamaContextShift,
+		SinkTokens:   cfg.LlamaSinkTokens,
+	}
+}
+
+// numaStrategy parses the configured NUMA strategy, falling back to none
+// with a warning.
+func numaStrategy(s string) llama.NumaStrategy {
+	t, err := llama.ParseNumaStrategy(s)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "%v; not using NUMA placement\n", err)
+		return llama.NumaNone
+	}
+	return t
+}
+
+// kvCacheType parses a configured cache type, falling back to f16 with a
+// warning so a typo in the environment does not prevent loading.
+func kvCacheType(s string) llama.KVCacheType {
+	t, err := llama.ParseKVCacheType(s)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "%v; using %s\n", err, llama.KVCacheF16)
+		return llama.KVCacheF16
+	}
+	return t
 }
 
 // Close releases resources held by the runtime, including worker clients.
 func (r *LocalLlamaRuntime) Close() error {
 	r.mu.Lock()
 	defer r.mu.Unlock()
-	
+
+	for _, lm := range r.models {
+		lm.ctx.Close()
+		releaseModel(lm.key)
+	}
+	r.models = make(map[string]*localModel)
+
 	if r.workerClient != nil {
 		err := r.workerClient.Close()
 		r.workerClient = nil
@@ -81,30 +242,256 @@ func (r *LocalLlamaRuntime) Close() error {
 // Generate runs the model with prompt and returns the completion text.
 // maxTokens controls the number of tokens to generate (0 = use default inside runtime).
 func (r *LocalLlamaRuntime) Generate(prompt string, modelPath string, maxTokens int) (string, error) {
-	model, err := r.LoadModel(modelPath)
-	if err != nil {
+	return r.GenerateWithOptions(prompt, modelPath, LocalLLMOptions{MaxTokens: maxTokens})
+}
+
+// GenerateWithOptions is Generate with per-step options.
+func (r *LocalLlamaRuntime) GenerateWithOptions(prompt string, modelPath string, opts LocalLLMOptions) (string, error) {
+	return r.GenerateContext(context.Background(), prompt, modelPath, opts)
+}
+
+// GenerateContext is GenerateWithOptions bounded by ctx. Once ctx is done
+// the generation stops within a token, in-process or in the worker, and
+// ctx.Err() is returned.
+func (r *LocalLlamaRuntime) GenerateContext(ctx context.Context, prompt string, modelPath string, opts LocalLLMOptions) (string, error) {
+	if err := ctx.Err(); err != nil {
 		return "", err
 	}
-	// If worker client is configured, use it for true concurrency.
+	// If worker client is configured, use it for true concurrency. The
+	// worker loads the model itself, so this process never does.
 	if r.workerClient != nil {
-		return r.workerClient.SendRequest(modelPath, prompt, maxTokens)
+		return r.workerClient.SendContext(ctx, worker.Request{
+			ModelSpec:    modelPath,
+			Prompt:       prompt,
+			MaxTokens:    opts.MaxTokens,
+			KVCacheType:  opts.KVCacheType,
+			DraftModel:   opts.DraftModel,
+			DraftTokens:  opts.DraftTokens,
+			PromptLookup: opts.PromptLookup,
+			Grammar:      opts.Grammar,
+			Stop:         opts.Stop,
+			N:            opts.N,
+			Prefix:       prefixText(opts.Prefix),
+			PrefixTokens: prefixTokens(opts.Prefix),
+		})
+	}
+
+	lm, key, err := r.loadModel(modelPath, opts)
+	if err != nil {
+		return "", err
 	}
 
 	// Call the wrapper's Predict API (in-process). Use provided maxTokens if non-zero, otherwise fall back to 256
 	mt := 256
-	if maxTokens > 0 {
-		mt = maxTokens
-	}
-	predictMu.Lock()
-	out, err := model.Predict(prompt, llama.PredictOptions{
-		MaxTokens: mt,
-		TopK:      40,
-		TopP:      0.9,
-		Temp:      0.8,
-	})
-	predictMu.Unlock()
+	if opts.MaxTokens > 0 {
+		mt = opts.MaxTokens
+	}
+	predictOpts := llama.PredictOptions{
+		MaxTokens:    mt,
+		TopK:         40,
+		TopP:         0.9,
+		Temp:         0.8,
+		PromptLookup: opts.PromptLookup,
+		Grammar:      opts.Grammar,
+		Stop:         opts.Stop,
+		Done:         ctx.Done(),
+	}
+	if predictOpts.PromptLookup == 0 {
+		predictOpts.PromptLookup = config.Get().LlamaPromptLookup
+	}
+	if p := opts.Prefix; p != nil && len(p.Tokens) > 0 && strings.HasPrefix(prompt, p.Text) {
+		predictOpts.PrefixTokens = p.Tokens
+		predictOpts.PrefixLen = len(p.Text)
+	}
+	if opts.N > 1 {
+		// The candidates get a context of their own that shares the prompt.
+		outs, err := lm.model.PredictN(prompt, opts.N, predictOpts)
+		if errors.Is(err, llama.ErrCanceled) {
+			return "", ctx.Err()
+		}
+		if err != nil {
+			return "", err
+		}
+		b, err := json.Marshal(outs)
+		if err != nil {
+			return "", err
+		}
+		return string(b), nil
+	}
+	if lm.ctx == nil {
+		// Served by the batching engine, which schedules concurrent calls
+		// (constrained calls fall back to the model's context pool).
+		out, err := lm.model.Predict(prompt, predictOpts)
+		if errors.Is(err, llama.ErrCanceled) {
+			return "", ctx.Err()
+		}
+		return out, err
+	}
+
+	r.preparePromptState(lm.ctx, key, predictOpts.PrefixTokens)
+	out, err := lm.ctx.Predict(prompt, predictOpts)
+	if errors.Is(err, llama.ErrCanceled) {
+		return "", ctx.Err()
+	}
+	return out, err
+}
+
+func prefixText(p *PromptPrefix) string {
+	if p == nil {
+		return ""
+	}
+	return p.Text
+}
+
+func prefixTokens(p *PromptPrefix) []int32 {
+	if p == nil {
+		return nil
+	}
+	return p.Tokens
+}
+
+// Embed returns the unit-length embedding of each text under the model at
+// modelPath, computed in as few batched decodes as the model allows.
+func (r *LocalLlamaRuntime) Embed(texts []string, modelPath string) ([][]float32, error) {
+	if r.workerClient != nil {
+		val, err := r.workerClient.Send(worker.Request{ModelSpec: modelPath, Embed: texts})
+		if err != nil {
+			return nil, err
+		}
+		var vecs [][]float32
+		if err := json.Unmarshal([]byte(val), &vecs); err != nil {
+			return nil, fmt.Errorf("invalid embeddings from worker: %w", err)
+		}
+		return vecs, nil
+	}
+
+	lm, _, err := r.loadModel(modelPath, LocalLLMOptions{})
+	if err != nil {
+		return nil, err
+	}
+	return lm.model.Embed(texts)
+}
+
+// EmbedJSON is Embed with the vectors encoded as a JSON array of arrays,
+// the form embed steps store in the workflow context.
+func (r *LocalLlamaRuntime) EmbedJSON(texts []string, modelPath string) (string, error) {
+	vecs, err := r.Embed(texts, modelPath)
+	if err != nil {
+		return "", err
+	}
+	b, err := json.Marshal(vecs)
 	if err != nil {
 		return "", err
 	}
-	return out, nil
+	return string(b), nil
+}
+
+// promptStatePath returns the file under LLAMA_STATE_DIR holding the KV
+// state of a static prompt prefix for the model identified by key and the
+// configured cache types. Keying on the prefix rather than the rendered
+// prompt lets every run of a step share one file whatever its variables.
+func promptStatePath(cfg *config.Config, key string, prefix []int32) string {
+	h := sha256.New()
+	for _, s := range []string{key, cfg.LlamaCacheTypeK, cfg.LlamaCacheTypeV} {
+		h.Write([]byte(s))
+		h.Write([]byte{0})
+	}
+	buf := make([]byte, 0, 4*len(prefix))
+	for _, t := range prefix {
+		buf = binary.LittleEndian.AppendUint32(buf, uint32(t))
+	}
+	h.Write(buf)
+	return filepath.Join(cfg.LlamaStateDir, hex.EncodeToString(h.Sum(nil)[:16])+promptStateExt)
+}
+
+const promptStateExt = ".kvstate"
+
+// preparePromptState puts the KV state of a prompt's static prefix into ctx
+// the first time the runtime sees the prefix, when LLAMA_STATE_DIR is set:
+// restored from its state file, or decoded and saved there if there is no
+// usable file yet. The prediction that follows reuses the prefix and only
+// prefills the rest of the prompt. Prompts without compile-time prefix
+// tokens are not persisted.
+func (r *LocalLlamaRuntime) preparePromptState(ctx *llama.Context, key string, prefix []int32) {
+	cfg := config.Get()
+	if cfg.LlamaStateDir == "" || len(prefix) == 0 {
+		return
+	}
+	path := promptStatePath(cfg, key, prefix)
+
+	r.mu.Lock()
+	done := r.restored[path]
+	r.restored[path] = true
+	r.mu.Unlock()
+	if done {
+		return
+	}
+	if _, err := os.Stat(path); err == nil {
+		if _, err := ctx.LoadPromptState(path); err == nil {
+			// Mark the file as recently used for pruning.
+			now := time.Now()
+			_ = os.Chtimes(path, now, now)
+			return
+		}
+		// Stale or incompatible state; overwrite it below.
+		fmt.Fprintf(os.Stderr, "%v\n", err)
+	}
+	savePromptState(ctx, prefix, path, int64(cfg.LlamaStateMaxMB)<<20)
+}
+
+// savePromptState decodes prefix into ctx, writes its KV state to path and
+// prunes the state directory to maxBytes (0 = unlimited).
+func savePromptState(ctx *llama.Context, prefix []int32, path string, maxBytes int64) {
+	err := os.MkdirAll(filepath.Dir(path), 0o755)
+	if err == nil {
+		_, err = ctx.SaveTokenState(prefix, path)
+	}
+	if err == nil && maxBytes > 0 {
+		err = prunePromptStates(filepath.Dir(path), maxBytes, path)
+	}
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "%v\n", err)
+	}
+}
+
+// prunePromptStates removes the least recently used state files in dir
+// until the rest fit in maxBytes. keep, the file just written, is never
+// removed.
+func prunePromptStates(dir string, maxBytes int64, keep string) error {
+	entries, err := os.ReadDir(dir)
+	if err != nil {
+		return err
+	}
+	type stateFile struct {
+		path  string
+		size  int64
+		mtime time.Time
+	}
+	var files []stateFile
+	var total int64
+	for _, e := range entries {
+		if e.IsDir() || filepath.Ext(e.Name()) != promptStateExt {
+			continue
+		}
+		info, err := e.Info()
+		if err != nil {
+			continue
+		}
+		files = append(files, stateFile{filepath.Join(dir, e.Name()), info.Size(), info.ModTime()})
+		total += info.Size()
+	}
+	sort.Slice(files, func(i, j int) bool { return files[i].mtime.Before(files[j].mtime) })
+	for _, f := range files {
+		if total <= maxBytes {
+			break
+		}
+		if f.path == keep {
+			continue
+		}
+		if err := os.Remove(f.path); err != nil && !os.IsNotExist(err) {
+			return err
+		}
+		total -= f.size
+	}
+	return nil
 }
@@ -0,0 +1,43 @@
+package runtime
+
+import (
+	"os"
+	"path/filepath"
+	"testing"
+	"time"
+)
+
+func TestPrunePromptStates(t *testing.T) {
+	dir := t.TempDir()
+	base := time.Now().Add(-time.Hour)
+	write := func(name string, size int, age int) string {
+		path := filepath.Join(dir, name)
+		if err := os.WriteFile(path, make([]byte, size), 0o644); err != nil {
+			t.Fatal(err)
+		}
+		mtime := base.Add(time.Duration(age) * time.Minute)
+		if err := os.Chtimes(path, mtime, mtime); err != nil {
+			t.Fatal(err)
+		}
+		return path
+	}
+	oldest := write("a"+promptStateExt, 100, 0)
+	older := write("b"+promptStateExt, 100, 1)
+	newer := write("c"+promptStateExt, 100, 2)
+	other := write("notes.txt", 1000, 0)
+	// The file just written is kept even though it is the oldest.
+	keep := write("d"+promptStateExt, 100, -1)
+
+	if err := prunePromptStates(dir, 250, keep); err != nil {
+		t.Fatalf("prunePromptStates: %v", err)
+	}
+	for _, c := range []struct {
+		path string
+		want bool
+	}{{oldest, false}, {older, false}, {newer, true}, {other, true}, {keep, true}} {
+		_, err := os.Stat(c.path)
+		if got := err == nil; got != c.want {
+			t.Errorf("%s exists = %v, want %v", filepath.Base(c.path), got, c.want)
+		}
+	}
+}
@@ -0,0 +1,181 @@
+package runtime
+
+import (
+	"fmt"
+	"os"
+	"sync"
+	"time"
+
+	"github.com/LiboWorks/llm-compiler/internal/config"
+	"github.com/LiboWorks/llm-compiler/internal/llama"
+)
+
+// sharedModel is a loaded model shared by every LocalLlamaRuntime in the
+// process. Each runtime predicts on its own llama.Context, so workflows
+// running in parallel use one copy of the weights without serializing.
+type sharedModel struct {
+	model *llama.Model
+	refs  int // runtimes holding the model
+}
+
+var (
+	sharedMu     sync.Mutex
+	sharedModels = make(map[string]*sharedModel)
+
+	// sharedPool is the threadpool every model computes on when
+	// LLAMA_CPUS or LLAMA_SHARED_THREADPOOL is set; created on first load
+	// and kept for the life of the process.
+	sharedPool     *llama.Threadpool
+	sharedPoolOnce sync.Once
+
+	// nodePools are the threadpools of the NUMA nodes, pinned to each
+	// node's CPUs and shared by every replica placed there, with
+	// generation and prefill workers sized from LLAMA_THREADS and
+	// LLAMA_THREADS_BATCH. Guarded by sharedMu.
+	nodePools = make(map[int]*llama.Threadpool)
+
+	// budgetOnce applies LLAMA_MODEL_BUDGET_MB to the model registry.
+	budgetOnce sync.Once
+)
+
+// sharedThreadpool returns the process-wide threadpool, or nil when models
+// use threads of their own. A pool that cannot be created (e.g. a malformed
+// LLAMA_CPUS) is reported once and models fall back to their own threads.
+func sharedThreadpool() *llama.Threadpool {
+	sharedPoolOnce.Do(func() {
+		cfg := config.Get()
+		if cfg.LlamaCPUs == "" && !cfg.LlamaSharedPool {
+			return
+		}
+		tp, err := llama.NewThreadpool(llama.ThreadpoolOptions{
+			Threads:      cfg.LlamaThreads,
+			BatchThreads: cfg.LlamaBatchThreads,
+			CPUs:         cfg.LlamaCPUs,
+		})
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "%v; using per-context threads\n", err)
+			return
+		}
+		if cfg.Verbose {
+			fmt.Fprintf(os.Stderr, "llama threadpool: %d threads, %d for prefill (cpus %q)\n", tp.Threads(), tp.BatchThreads(), cfg.LlamaCPUs)
+		}
+		sharedPool = tp
+	})
+	return sharedPool
+}
+
+// nodeThreadpool returns the threadpool of NUMA node, creating it on first
+// use; nil if it cannot be created, in which case the replica gets a pool
+// of its own. The caller holds sharedMu.
+func nodeThreadpool(node int) *llama.Threadpool {
+	if tp, ok := nodePools[node]; ok {
+		return tp
+	}
+	cfg := config.Get()
+	tp, err := llama.NewThreadpool(llama.ThreadpoolOptions{
+		Threads:      cfg.LlamaThreads,
+		BatchThreads: cfg.LlamaBatchThreads,
+		CPUs:         llama.NumaNodeCPUs(node),
+	})
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "NUMA node %d: %v\n", node, err)
+	}
+	nodePools[node] = tp
+	return tp
+}
+
+// pickReplica chooses the NUMA node for a caller of the model at key: the
+// one whose replica has the fewest runtimes, loading a new replica on an
+// unused node before doubling up. It returns the replica's key.
+func pickReplica(key string, opts *llama.LoadOptions) string {
+	best, bestRefs := 0, -1
+	for node := 0; node < llama.NumaNodes(); node++ {
+		refs := 0
+		if sm, ok := sharedModels[replicaKey(key, node)]; ok {
+			refs = sm.refs
+		}
+		if bestRefs < 0 || refs < bestRefs {
+			best, bestRefs = node, refs
+		}
+	}
+	opts.NumaNode = best
+	opts.Threadpool = nodeThreadpool(best)
+	return replicaKey(key, best)
+}
+
+func replicaKey(key string, node int) string {
+	return fmt.Sprintf("%s#node=%d", key, node)
+}
+
+// acquireModel returns the process-wide model for key, loading it from abs
+// with opts on first use, and adds a reference for the caller. With
+// NumaReplicate on a multi-node host the model is one of its per-node
+// replicas; the returned key identifies it for releaseModel.
+func acquireModel(key, abs string, opts llama.LoadOptions) (*llama.Model, string, error) {
+	sharedMu.Lock()
+	defer sharedMu.Unlock()
+
+	if opts.Numa == llama.NumaReplicate && llama.NumaNodes() > 1 {
+		// Replicas compute on their node's pool, not on LLAMA_CPUS.
+		key = pickReplica(key, &opts)
+	} else {
+		if opts.Numa == llama.NumaReplicate {
+			// One node: a private copy would only lose the mapping.
+			opts.Numa = llama.NumaNone
+		}
+		opts.Threadpool = sharedThreadpool()
+	}
+
+	if sm, ok := sharedModels[key]; ok {
+		sm.refs++
+		return sm.model, key, nil
+	}
+
+	cfg := config.Get()
+	budgetOnce.Do(func() {
+		if cfg.LlamaModelBudget > 0 {
+			llama.SetModelBudget(uint64(cfg.LlamaModelBudget) << 20)
+		}
+	})
+	loads := llama.ModelRegistryStats().Loads
+	model, err := llama.AcquireModel(abs, opts)
+	if err != nil {
+		return nil, "", fmt.Errorf("failed to load model %s: %w", abs, err)
+	}
+	if cfg.Verbose && llama.ModelRegistryStats().Loads != loads {
+		st := model.LoadStats()
+		fmt.Fprintf(os.Stderr, "loaded %s in %v: %d MiB of weights, %d MiB resident, process RSS %d MiB\n",
+			abs, st.LoadTime.Round(time.Millisecond), st.ModelBytes>>20, st.ResidentBytes>>20, st.RSSBytes>>20)
+	}
+
+	// A model kept by the registry may still have its engine running.
+	if n := cfg.LlamaParallel; n > 1 && !model.EngineRunning() {
+		if err := model.StartEngine(n); err != nil {
+			fmt.Fprintf(os.Stderr, "failed to start batching engine for %s: %v\n", abs, err)
+		}
+	}
+
+	sharedModels[key] = &sharedModel{model: model, refs: 1}
+	return model, key, nil
+}
+
+// releaseModel drops a reference taken by acquireModel and hands the model
+// back to the registry once no runtime uses it.
+func releaseModel(key string) {
+	sharedMu.Lock()
+	defer sharedMu.Unlock()
+
+	sm, ok := sharedModels[key]
+	if !ok {
+		return
+	}
+	if sm.refs--; sm.refs > 0 {
+		return
+	}
+	delete(sharedModels, key)
+	if st := sm.model.SpecStats(); st.Drafted > 0 && config.Get().Verbose {
+		fmt.Fprintf(os.Stderr, "speculative decoding (%s): %d/%d draft tokens accepted (%.0f%%) over %d steps, %d/%d from prompt lookup\n",
+			key, st.Accepted, st.Drafted, 100*st.AcceptanceRate(), st.Steps, st.LookupAccepted, st.LookupDrafted)
+	}
+	sm.model.Close()
+}
@@ -1,6 +1,7 @@
 package runtime
 
 import (
+	"context"
 	"os"
 
 	"github.com/LiboWorks/llm-compiler/internal/worker"
@@ -15,6 +16,27 @@ func (h *localLlamaHandler) Generate(prompt, modelSpec string, maxTokens int) (s
 	return h.llama.Generate(prompt, modelSpec, maxTokens)
 }
 
+func (h *localLlamaHandler) HandleRequest(ctx context.Context, req worker.Request) (string, error) {
+	if len(req.Embed) > 0 {
+		return h.llama.EmbedJSON(req.Embed, req.ModelSpec)
+	}
+	var prefix *PromptPrefix
+	if len(req.PrefixTokens) > 0 {
+		prefix = &PromptPrefix{Text: req.Prefix, Tokens: req.PrefixTokens}
+	}
+	return h.llama.GenerateContext(ctx, req.Prompt, req.ModelSpec, LocalLLMOptions{
+		MaxTokens:    req.MaxTokens,
+		KVCacheType:  req.KVCacheType,
+		DraftModel:   req.DraftModel,
+		DraftTokens:  req.DraftTokens,
+		PromptLookup: req.PromptLookup,
+		Grammar:      req.Grammar,
+		Stop:         req.Stop,
+		N:            req.N,
+		Prefix:       prefix,
+	})
+}
+
 func init() {
 	if worker.IsWorkerProcess() {
 		// Create handler with local llama runtime
@@ -4,6 +4,7 @@ package worker
 
 import (
 	"bufio"
+	"context"
 	"encoding/json"
 	"fmt"
 	"io"
@@ -21,6 +22,29 @@ type Request struct {
 	ModelSpec string `json:"model_spec"`
 	Prompt    string `json:"prompt"`
 	MaxTokens int    `json:"max_tokens"`
+	// Optional per-step generation options; zero values mean defaults.
+	KVCacheType string `json:"kv_cache_type,omitempty"`
+	DraftModel  string `json:"draft_model,omitempty"`
+	DraftTokens int    `json:"draft_tokens,omitempty"`
+	// PromptLookup is the number of tokens prompt lookup proposes per step.
+	PromptLookup int `json:"prompt_lookup,omitempty"`
+	// Grammar is GBNF text constraining the completion.
+	Grammar string `json:"grammar,omitempty"`
+	// Stop lists strings that end the completion.
+	Stop []string `json:"stop,omitempty"`
+	// N > 1 asks for N candidate completions; the response value holds
+	// them as a JSON array of strings.
+	N int `json:"n,omitempty"`
+	// PrefixTokens are the compile-time tokens of Prefix, the static
+	// beginning of Prompt.
+	Prefix       string  `json:"prefix,omitempty"`
+	PrefixTokens []int32 `json:"prefix_tokens,omitempty"`
+	// Embed, when set, asks for the embeddings of these texts instead of a
+	// completion; the response value holds them as a JSON array of vectors.
+	Embed []string `json:"embed,omitempty"`
+	// Cancel asks the worker to stop the request with the same ID. It has
+	// no response of its own; the cancelled request fails.
+	Cancel bool `json:"cancel,omitempty"`
 }
 
 // Response is sent from worker to client over stdout as JSON newline.
@@ -36,13 +60,22 @@ type Handler interface {
 	Generate(prompt, modelSpec string, maxTokens int) (string, error)
 }
 
+// RequestHandler is optionally implemented by handlers that honor the
+// per-request options carried in Request. The server prefers it over
+// Handler.Generate when available. ctx is cancelled when the client
+// cancels the request.
+type RequestHandler interface {
+	HandleRequest(ctx context.Context, req Request) (string, error)
+}
+
 // Client manages communication with a worker subprocess
 type Client struct {
 	cmd    *exec.Cmd
 	stdin  io.WriteCloser
 	stdout io.ReadCloser
 
-	enc *json.Encoder
+	encMu sync.Mutex
+	enc   *json.Encoder
 
 	pendingMu sync.Mutex
 	pending   map[string]chan Response
@@ -147,23 +180,54 @@ func (c *Client) readLoop() {
 
 // SendRequest sends a request to the worker and waits for the response
 func (c *Client) SendRequest(modelSpec, prompt string, maxTokens int) (string, error) {
+	return c.Send(Request{ModelSpec: modelSpec, Prompt: prompt, MaxTokens: maxTokens})
+}
+
+// SendRequestContext is SendRequest bounded by ctx.
+func (c *Client) SendRequestContext(ctx context.Context, modelSpec, prompt string, maxTokens int) (string, error) {
+	return c.SendContext(ctx, Request{ModelSpec: modelSpec, Prompt: prompt, MaxTokens: maxTokens})
+}
+
+// Send sends req to the worker and waits for the response. The request ID
+// is assigned by the client.
+func (c *Client) Send(req Request) (string, error) {
+	return c.SendContext(context.Background(), req)
+}
+
+// SendContext is Send bounded by ctx. When ctx is done first, the worker is
+// told to cancel the request and ctx.Err() is returned right away; the
+// worker stops generating within a token and its late response is dropped.
+func (c *Client) SendContext(ctx context.Context, req Request) (string, error) {
 	id := fmt.Sprintf("%d", atomic.AddUint64(&c.idCounter, 1))
-	req := Request{ID: id, ModelSpec: modelSpec, Prompt: prompt, MaxTokens: maxTokens}
+	req.ID = id
 
 	ch := make(chan Response, 1)
 	c.pendingMu.Lock()
 	c.pending[id] = ch
 	c.pendingMu.Unlock()
 
-	if err := c.enc.Encode(req); err != nil {
+	if err := c.encode(req); err != nil {
 		return "", err
 	}
 
-	resp := <-ch
-	if resp.Err != "" {
-		return resp.Val, fmt.Errorf("%s", resp.Err)
+	select {
+	case resp := <-ch:
+		if resp.Err != "" {
+			return resp.Val, fmt.Errorf("%s", resp.Err)
+		}
+		return resp.Val, nil
+	case <-ctx.Done():
+		c.encode(Request{ID: id, Cancel: true})
+		return "", ctx.Err()
 	}
-	return resp.Val, nil
+}
+
+// encode writes one message to the worker; concurrent senders and
+// cancellations must not interleave their lines.
+func (c *Client) encode(req Request) error {
+	c.encMu.Lock()
+	defer c.encMu.Unlock()
+	return c.enc.Encode(req)
 }
 
 // Close shuts down the worker subprocess
@@ -2,6 +2,7 @@ package worker
 
 import (
 	"bufio"
+	"context"
 	"encoding/json"
 	"fmt"
 	"io"
@@ -9,16 +10,26 @@ import (
 	"sync"
 )
 
+// maxRequestBytes bounds one request line. Prompts, grammars, embedding
+// inputs and prefix tokens all travel in the request, so it is far above
+// bufio.Scanner's 64 KiB default.
+const maxRequestBytes = 256 << 20
+
 // Server runs inside a spawned worker process and handles incoming requests
 type Server struct {
 	handler   Handler
 	statusOut io.Writer
 	mu        sync.Mutex
+
+	// Cancel functions of the requests received and not yet answered,
+	// by request ID.
+	inflightMu sync.Mutex
+	inflight   map[string]context.CancelFunc
 }
 
 // NewServer creates a new worker server with the given handler
 func NewServer(handler Handler) *Server {
-	return &Server{handler: handler}
+	return &Server{handler: handler, inflight: make(map[string]context.CancelFunc)}
 }
 
 // Run starts the server loop, reading requests from stdin and writing responses to stdout.
@@ -42,29 +53,52 @@ func (s *Server) Run() {
 
 	w := bufio.NewWriter(os.Stdout)
 	scanner := bufio.NewScanner(os.Stdin)
+	scanner.Buffer(make([]byte, 0, 64*1024), maxRequestBytes)
 	enc := json.NewEncoder(w)
+	var writeMu sync.Mutex
+	respond := func(resp Response) {
+		writeMu.Lock()
+		enc.Encode(resp)
+		w.Flush()
+		writeMu.Unlock()
+	}
 
+	// Requests are handled one at a time, as before, but off the read
+	// loop so that a cancellation can arrive while one is running.
+	var wg sync.WaitGroup
 	for scanner.Scan() {
 		line := scanner.Bytes()
 		var req Request
 		if err := json.Unmarshal(line, &req); err != nil {
-			resp := Response{ID: req.ID, Val: "", Err: fmt.Sprintf("invalid request: %v", err)}
-			enc.Encode(resp)
-			w.Flush()
+			respond(Response{ID: req.ID, Val: "", Err: fmt.Sprintf("invalid request: %v", err)})
+			continue
+		}
+		if req.Cancel {
+			s.cancel(req.ID)
 			continue
 		}
 
-		s.mu.Lock()
-		val, err := s.handler.Generate(req.Prompt, req.ModelSpec, req.MaxTokens)
-		s.mu.Unlock()
+		ctx, cancel := context.WithCancel(context.Background())
+		s.inflightMu.Lock()
+		s.inflight[req.ID] = cancel
+		s.inflightMu.Unlock()
 
-		resp := Response{ID: req.ID, Val: val}
-		if err != nil {
-			resp.Err = err.Error()
-		}
-		enc.Encode(resp)
-		w.Flush()
+		wg.Add(1)
+		go func(req Request) {
+			defer wg.Done()
+			s.mu.Lock()
+			val, err := s.handle(ctx, req)
+			s.mu.Unlock()
+			s.cancel(req.ID)
+
+			resp := Response{ID: req.ID, Val: val}
+			if err != nil {
+				resp.Err = err.Error()
+			}
+			respond(resp)
+		}(req)
 	}
+	wg.Wait()
 
 	if err := scanner.Err(); err != nil && err != io.EOF {
 		if statusWriter != nil {
@@ -85,6 +119,26 @@ func (s *Server) Run() {
 	}
 }
 
+// handle dispatches req to the handler, passing the full request when the
+// handler understands per-request options.
+func (s *Server) handle(ctx context.Context, req Request) (string, error) {
+	if rh, ok := s.handler.(RequestHandler); ok {
+		return rh.HandleRequest(ctx, req)
+	}
+	return s.handler.Generate(req.Prompt, req.ModelSpec, req.MaxTokens)
+}
+
+// cancel cancels the in-flight request id, if any, and forgets it.
+func (s *Server) cancel(id string) {
+	s.inflightMu.Lock()
+	cancel, ok := s.inflight[id]
+	delete(s.inflight, id)
+	s.inflightMu.Unlock()
+	if ok {
+		cancel()
+	}
+}
+
 // WriteStatus writes a status message to the status output (fd3 or stderr)
 func (s *Server) WriteStatus(format string, args ...interface{}) {
 	if s.statusOut != nil {
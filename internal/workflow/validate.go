@@ -7,6 +7,13 @@ var validStepTypes = map[string]bool{
 	"llm": true,
 }
 
+// KV cache types supported by the local llama runtime
+var validKVCacheTypes = map[string]bool{
+	"f16":  true,
+	"q8_0": true,
+	"q4_0": true,
+}
+
 func (wf *Workflow) Validate() error {
 	if wf.Name == "" {
 		return fmt.Errorf("workflow name is required")
@@ -33,6 +40,36 @@ func (wf *Workflow) Validate() error {
 			if step.Model == "" {
 				return fmt.Errorf("llm step %s missing model", step.Name)
 			}
+			if step.KVCacheType != "" && !validKVCacheTypes[step.KVCacheType] {
+				return fmt.Errorf("llm step %s has unsupported kv_cache_type %q", step.Name, step.KVCacheType)
+			}
+			if step.DraftTokens < 0 {
+				return fmt.Errorf("llm step %s has negative draft_tokens", step.Name)
+			}
+			if step.PromptLookup < 0 {
+				return fmt.Errorf("llm step %s has negative prompt_lookup", step.Name)
+			}
+			if step.N < 0 || step.N > 64 {
+				return fmt.Errorf("llm step %s has n outside [0, 64]", step.Name)
+			}
+			if step.Grammar != "" && step.JSONSchema != "" {
+				return fmt.Errorf("llm step %s sets both grammar and json_schema", step.Name)
+			}
+			if _, err := step.GBNF(); err != nil {
+				return err
+			}
+			for _, s := range step.Stop {
+				if s == "" {
+					return fmt.Errorf("llm step %s has an empty stop string", step.Name)
+				}
+			}
+		case StepEmbed:
+			if len(step.Inputs) == 0 {
+				return fmt.Errorf("embed step %s has no inputs", step.Name)
+			}
+			if step.Model == "" {
+				return fmt.Errorf("embed step %s missing model", step.Name)
+			}
 		default:
 			return fmt.Errorf("unknown step type: %s", step.Type)
 		}
@@ -1,5 +1,11 @@
 package workflow
 
+import (
+	"fmt"
+
+	"github.com/LiboWorks/llm-compiler/internal/grammar"
+)
+
 type Workflow struct {
 	Name  string         `yaml:"name"`
 	Steps []WorkflowStep `yaml:"steps"`
@@ -11,6 +17,7 @@ const (
 	StepShell    StepType = "shell"
 	StepLLM      StepType = "llm" // <-- add this
 	StepLocalLLM StepType = "local_llm"
+	StepEmbed    StepType = "embed"
 )
 
 type WorkflowStep struct {
@@ -20,8 +27,39 @@ type WorkflowStep struct {
 	Prompt    string   `yaml:"prompt,omitempty"`  // for LLM
 	Model     string   `yaml:"model,omitempty"`   // for LLM
 	MaxTokens int      `yaml:"max_tokens,omitempty"`
-	Output    string   `yaml:"output,omitempty"`
-	If        string
+	// Inputs are the texts an embed step embeds with Model, each rendered
+	// against the workflow context first. The step's output is a JSON
+	// array holding one unit-length vector per input.
+	Inputs []string `yaml:"inputs,omitempty"`
+	// KVCacheType selects the KV cache element type (f16, q8_0 or q4_0)
+	// for local_llm steps. Quantized caches use less memory per token,
+	// letting more steps run in parallel. Empty uses the runtime default.
+	KVCacheType string `yaml:"kv_cache_type,omitempty"`
+	// DraftModel names a small GGUF model sharing the step model's
+	// vocabulary; local_llm steps then use speculative decoding, with the
+	// draft proposing DraftTokens tokens per step (0 = default).
+	DraftModel  string `yaml:"draft_model,omitempty"`
+	DraftTokens int    `yaml:"draft_tokens,omitempty"`
+	// PromptLookup enables speculative decoding without a draft model for
+	// local_llm steps: up to PromptLookup tokens per step are proposed by
+	// matching the latest output against the prompt. Useful when the
+	// output quotes its input (extraction, rewriting). 0 disables.
+	PromptLookup int `yaml:"prompt_lookup,omitempty"`
+	// Grammar (GBNF text with a "root" rule) or JSONSchema (a JSON schema
+	// document) constrains the output of a local_llm step, e.g. to JSON a
+	// later step can parse without retries. The schema is converted to a
+	// grammar when the workflow is compiled. At most one may be set.
+	Grammar    string `yaml:"grammar,omitempty"`
+	JSONSchema string `yaml:"json_schema,omitempty"`
+	// Stop ends a local_llm step's generation as soon as its output
+	// contains any of these strings; the output ends right before it.
+	Stop []string `yaml:"stop,omitempty"`
+	// N > 1 makes a local_llm step generate N candidate completions of its
+	// prompt, which is decoded only once for all of them. The step's output
+	// is then a JSON array of the candidates.
+	N      int    `yaml:"n,omitempty"`
+	Output string `yaml:"output,omitempty"`
+	If     string
 	// WaitFor optionally specifies another workflow step to wait on before
 	// executing this step. Format: "workflowName.stepName". When the
 	// producer step completes and has an `output`, its value will be sent on
@@ -32,3 +70,17 @@ type WorkflowStep struct {
 	// indefinitely.
 	WaitTimeout int `yaml:"wait_timeout,omitempty"`
 }
+
+// GBNF returns the grammar constraining the step's output: Grammar as
+// given, or JSONSchema converted to a grammar. It returns "" when the step
+// is unconstrained.
+func (s WorkflowStep) GBNF() (string, error) {
+	if s.JSONSchema == "" {
+		return s.Grammar, nil
+	}
+	g, err := grammar.FromJSONSchema([]byte(s.JSONSchema))
+	if err != nil {
+		return "", fmt.Errorf("step %s: %w", s.Name, err)
+	}
+	return g, nil
+}
@@ -186,6 +186,116 @@ func TestValidateWorkflow(t *testing.T) {
 			},
 			wantErr: true,
 		},
+		{
+			name: "quantized kv cache",
+			wf: Workflow{
+				Name: "test",
+				Steps: []WorkflowStep{
+					{Name: "step1", Type: StepLocalLLM, Prompt: "hi", Model: "m.gguf", KVCacheType: "q8_0"},
+				},
+			},
+			wantErr: false,
+		},
+		{
+			name: "unsupported kv cache type",
+			wf: Workflow{
+				Name: "test",
+				Steps: []WorkflowStep{
+					{Name: "step1", Type: StepLocalLLM, Prompt: "hi", Model: "m.gguf", KVCacheType: "q5_1"},
+				},
+			},
+			wantErr: true,
+		},
+		{
+			name: "negative draft tokens",
+			wf: Workflow{
+				Name: "test",
+				Steps: []WorkflowStep{
+					{Name: "step1", Type: StepLocalLLM, Prompt: "hi", Model: "m.gguf", DraftModel: "d.gguf", DraftTokens: -1},
+				},
+			},
+			wantErr: true,
+		},
+		{
+			name: "negative prompt lookup",
+			wf: Workflow{
+				Name: "test",
+				Steps: []WorkflowStep{
+					{Name: "step1", Type: StepLocalLLM, Prompt: "hi", Model: "m.gguf", PromptLookup: -1},
+				},
+			},
+			wantErr: true,
+		},
+		{
+			name: "json schema",
+			wf: Workflow{
+				Name: "test",
+				Steps: []WorkflowStep{
+					{Name: "step1", Type: StepLocalLLM, Prompt: "hi", Model: "m.gguf", JSONSchema: `{"type": "integer"}`},
+				},
+			},
+			wantErr: false,
+		},
+		{
+			name: "unsupported json schema",
+			wf: Workflow{
+				Name: "test",
+				Steps: []WorkflowStep{
+					{Name: "step1", Type: StepLocalLLM, Prompt: "hi", Model: "m.gguf", JSONSchema: `{"$ref": "#/x"}`},
+				},
+			},
+			wantErr: true,
+		},
+		{
+			name: "grammar and json schema",
+			wf: Workflow{
+				Name: "test",
+				Steps: []WorkflowStep{
+					{Name: "step1", Type: StepLocalLLM, Prompt: "hi", Model: "m.gguf", Grammar: `root ::= "yes"`, JSONSchema: `{"type": "integer"}`},
+				},
+			},
+			wantErr: true,
+		},
+		{
+			name: "embed step",
+			wf: Workflow{
+				Name: "test",
+				Steps: []WorkflowStep{
+					{Name: "step1", Type: StepEmbed, Model: "e.gguf", Inputs: []string{"{{a}}", "{{b}}"}},
+				},
+			},
+			wantErr: false,
+		},
+		{
+			name: "embed step without inputs",
+			wf: Workflow{
+				Name: "test",
+				Steps: []WorkflowStep{
+					{Name: "step1", Type: StepEmbed, Model: "e.gguf"},
+				},
+			},
+			wantErr: true,
+		},
+		{
+			name: "empty stop string",
+			wf: Workflow{
+				Name: "test",
+				Steps: []WorkflowStep{
+					{Name: "step1", Type: StepLocalLLM, Prompt: "hi", Model: "m.gguf", Stop: []string{"END", ""}},
+				},
+			},
+			wantErr: true,
+		},
+		{
+			name: "too many candidates",
+			wf: Workflow{
+				Name: "test",
+				Steps: []WorkflowStep{
+					{Name: "step1", Type: StepLocalLLM, Prompt: "hi", Model: "m.gguf", N: 65},
+				},
+			},
+			wantErr: true,
+		},
 	}
 
 	for _, tt := range tests {
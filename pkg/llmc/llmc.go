@@ -54,6 +54,13 @@ type CompileOptions struct {
 
 	// Verbose enables detailed output during compilation.
 	Verbose bool
+
+	// Tokenize, when set, tokenizes text with the vocabulary of the model at
+	// modelPath (adding BOS/EOS when addSpecial is set). The static
+	// beginning of every local_llm prompt is then tokenized at compile time
+	// and embedded in the binary. Optional: builds with `-tags llama` use
+	// the models' own vocabularies when it is nil.
+	Tokenize func(modelPath, text string, addSpecial bool) ([]int32, error)
 }
 
 // CompileResult contains the results of a successful compilation.
@@ -159,6 +166,7 @@ func toInternalOptions(opts *CompileOptions) *compiler.Options {
 		SkipBuild:  opts.SkipBuild,
 		KeepSource: opts.KeepSource,
 		Verbose:    opts.Verbose,
+		Tokenize:   opts.Tokenize,
 	}
 }
 
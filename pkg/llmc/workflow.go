@@ -16,6 +16,9 @@ const (
 
 	// StepTypeLocalLLM runs inference locally via llama.cpp.
 	StepTypeLocalLLM StepType = "local_llm"
+
+	// StepTypeEmbed computes embeddings locally via llama.cpp.
+	StepTypeEmbed StepType = "embed"
 )
 
 // Workflow represents a compiled workflow with its steps.
@@ -32,7 +35,7 @@ type Step struct {
 	// Name is the unique identifier for this step within the workflow.
 	Name string
 
-	// Type specifies how this step executes (shell, llm, local_llm).
+	// Type specifies how this step executes (shell, llm, local_llm, embed).
 	Type StepType
 
 	// Command is the shell command to execute (for StepTypeShell).
@@ -47,6 +50,41 @@ type Step struct {
 	// MaxTokens limits the LLM response length.
 	MaxTokens int
 
+	// Inputs are the text templates a StepTypeEmbed step embeds with
+	// Model. Its output is a JSON array of unit-length vectors, one per
+	// input.
+	Inputs []string
+
+	// KVCacheType selects the KV cache element type for StepTypeLocalLLM:
+	// "f16" (default), "q8_0" or "q4_0".
+	KVCacheType string
+
+	// DraftModel is a small GGUF model sharing Model's vocabulary that
+	// StepTypeLocalLLM uses for speculative decoding, proposing DraftTokens
+	// tokens per step (0 = default).
+	DraftModel  string
+	DraftTokens int
+
+	// PromptLookup enables speculative decoding without a draft model for
+	// StepTypeLocalLLM, proposing up to PromptLookup tokens per step from
+	// earlier prompt or output text (0 = off).
+	PromptLookup int
+
+	// Grammar (GBNF text with a "root" rule) or JSONSchema (a JSON schema
+	// document) constrains the output of StepTypeLocalLLM. The schema is
+	// converted to a grammar at compile time. At most one may be set.
+	Grammar    string
+	JSONSchema string
+
+	// Stop ends a StepTypeLocalLLM generation at the first of these
+	// strings, which is not included in the output.
+	Stop []string
+
+	// N > 1 makes a StepTypeLocalLLM step generate N candidate completions
+	// from a single decode of the prompt; the output is then a JSON array
+	// of the candidates.
+	N int
+
 	// Output is the variable name to store this step's result.
 	// Can be referenced in subsequent steps via {{output_name}}.
 	Output string
@@ -116,6 +154,17 @@ func LocalLLMStep(name, prompt string) *StepBuilder {
 	}
 }
 
+// EmbedStep creates a new local embedding step over inputs.
+func EmbedStep(name string, inputs ...string) *StepBuilder {
+	return &StepBuilder{
+		step: &Step{
+			Name:   name,
+			Type:   StepTypeEmbed,
+			Inputs: inputs,
+		},
+	}
+}
+
 // WithOutput sets the output variable name for the step.
 func (b *StepBuilder) WithOutput(output string) *StepBuilder {
 	b.step.Output = output
@@ -134,6 +183,53 @@ func (b *StepBuilder) WithMaxTokens(tokens int) *StepBuilder {
 	return b
 }
 
+// WithKVCacheType sets the KV cache element type for a local LLM step.
+func (b *StepBuilder) WithKVCacheType(cacheType string) *StepBuilder {
+	b.step.KVCacheType = cacheType
+	return b
+}
+
+// WithDraftModel enables speculative decoding for a local LLM step with the
+// given draft model, proposing tokens tokens per step (0 = default).
+func (b *StepBuilder) WithDraftModel(model string, tokens int) *StepBuilder {
+	b.step.DraftModel = model
+	b.step.DraftTokens = tokens
+	return b
+}
+
+// WithPromptLookup enables prompt-lookup speculative decoding for a local
+// LLM step, proposing up to tokens tokens per step.
+func (b *StepBuilder) WithPromptLookup(tokens int) *StepBuilder {
+	b.step.PromptLookup = tokens
+	return b
+}
+
+// WithGrammar constrains a local LLM step's output to a GBNF grammar.
+func (b *StepBuilder) WithGrammar(gbnf string) *StepBuilder {
+	b.step.Grammar = gbnf
+	return b
+}
+
+// WithJSONSchema constrains a local LLM step's output to JSON matching
+// schema.
+func (b *StepBuilder) WithJSONSchema(schema string) *StepBuilder {
+	b.step.JSONSchema = schema
+	return b
+}
+
+// WithStop sets the stop strings of a local LLM step.
+func (b *StepBuilder) WithStop(stop ...string) *StepBuilder {
+	b.step.Stop = stop
+	return b
+}
+
+// WithCandidates makes a local LLM step generate n candidate completions
+// sharing one decode of the prompt.
+func (b *StepBuilder) WithCandidates(n int) *StepBuilder {
+	b.step.N = n
+	return b
+}
+
 // WithCondition sets a conditional expression for the step.
 func (b *StepBuilder) WithCondition(condition string) *StepBuilder {
 	b.step.If = condition
@@ -163,16 +259,25 @@ func (w *Workflow) toInternal() workflow.Workflow {
 	steps := make([]workflow.WorkflowStep, len(w.Steps))
 	for i, s := range w.Steps {
 		steps[i] = workflow.WorkflowStep{
-			Name:        s.Name,
-			Type:        workflow.StepType(s.Type),
-			Command:     s.Command,
-			Prompt:      s.Prompt,
-			Model:       s.Model,
-			MaxTokens:   s.MaxTokens,
-			Output:      s.Output,
-			If:          s.If,
-			WaitFor:     s.WaitFor,
-			WaitTimeout: s.WaitTimeout,
+			Name:         s.Name,
+			Type:         workflow.StepType(s.Type),
+			Command:      s.Command,
+			Prompt:       s.Prompt,
+			Model:        s.Model,
+			MaxTokens:    s.MaxTokens,
+			Inputs:       s.Inputs,
+			KVCacheType:  s.KVCacheType,
+			DraftModel:   s.DraftModel,
+			DraftTokens:  s.DraftTokens,
+			PromptLookup: s.PromptLookup,
+			Grammar:      s.Grammar,
+			JSONSchema:   s.JSONSchema,
+			Stop:         s.Stop,
+			N:            s.N,
+			Output:       s.Output,
+			If:           s.If,
+			WaitFor:      s.WaitFor,
+			WaitTimeout:  s.WaitTimeout,
 		}
 	}
 	return workflow.Workflow{
@@ -185,16 +290,25 @@ func fromInternalWorkflow(wf workflow.Workflow) *Workflow {
 	steps := make([]*Step, len(wf.Steps))
 	for i, s := range wf.Steps {
 		steps[i] = &Step{
-			Name:        s.Name,
-			Type:        StepType(s.Type),
-			Command:     s.Command,
-			Prompt:      s.Prompt,
-			Model:       s.Model,
-			MaxTokens:   s.MaxTokens,
-			Output:      s.Output,
-			If:          s.If,
-			WaitFor:     s.WaitFor,
-			WaitTimeout: s.WaitTimeout,
+			Name:         s.Name,
+			Type:         StepType(s.Type),
+			Command:      s.Command,
+			Prompt:       s.Prompt,
+			Model:        s.Model,
+			MaxTokens:    s.MaxTokens,
+			Inputs:       s.Inputs,
+			KVCacheType:  s.KVCacheType,
+			DraftModel:   s.DraftModel,
+			DraftTokens:  s.DraftTokens,
+			PromptLookup: s.PromptLookup,
+			Grammar:      s.Grammar,
+			JSONSchema:   s.JSONSchema,
+			Stop:         s.Stop,
+			N:            s.N,
+			Output:       s.Output,
+			If:           s.If,
+			WaitFor:      s.WaitFor,
+			WaitTimeout:  s.WaitTimeout,
 		}
 	}
 	return &Workflow{
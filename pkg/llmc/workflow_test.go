@@ -79,6 +79,22 @@ func TestLocalLLMStep(t *testing.T) {
 	}
 }
 
+func TestEmbedStep(t *testing.T) {
+	step := llmc.EmbedStep("embed-step", "{{title}}", "{{body}}").
+		WithModel("embed.gguf").
+		Build()
+
+	if step.Type != llmc.StepTypeEmbed {
+		t.Errorf("expected type Embed, got %s", step.Type)
+	}
+	if len(step.Inputs) != 2 || step.Inputs[0] != "{{title}}" || step.Inputs[1] != "{{body}}" {
+		t.Errorf("unexpected inputs %q", step.Inputs)
+	}
+	if step.Model != "embed.gguf" {
+		t.Errorf("expected model 'embed.gguf', got %s", step.Model)
+	}
+}
+
 func TestStepBuilderWithOutput(t *testing.T) {
 	step := llmc.ShellStep("step", "echo 'test'").
 		WithOutput("result").
@@ -109,6 +125,57 @@ func TestStepBuilderWithMaxTokens(t *testing.T) {
 	}
 }
 
+func TestStepBuilderWithKVCacheType(t *testing.T) {
+	step := llmc.LocalLLMStep("step", "prompt").
+		WithKVCacheType("q4_0").
+		Build()
+
+	if step.KVCacheType != "q4_0" {
+		t.Errorf("expected kv cache type q4_0, got %s", step.KVCacheType)
+	}
+}
+
+func TestStepBuilderWithDraftModel(t *testing.T) {
+	step := llmc.LocalLLMStep("step", "prompt").
+		WithDraftModel("/path/to/draft.gguf", 4).
+		Build()
+
+	if step.DraftModel != "/path/to/draft.gguf" || step.DraftTokens != 4 {
+		t.Errorf("expected draft model /path/to/draft.gguf with 4 tokens, got %s with %d", step.DraftModel, step.DraftTokens)
+	}
+}
+
+func TestStepBuilderWithPromptLookup(t *testing.T) {
+	step := llmc.LocalLLMStep("step", "prompt").
+		WithPromptLookup(10).
+		Build()
+
+	if step.PromptLookup != 10 {
+		t.Errorf("expected prompt lookup 10, got %d", step.PromptLookup)
+	}
+}
+
+func TestStepBuilderWithJSONSchema(t *testing.T) {
+	schema := `{"type": "object", "properties": {"ok": {"type": "boolean"}}}`
+	step := llmc.LocalLLMStep("step", "prompt").
+		WithJSONSchema(schema).
+		Build()
+
+	if step.JSONSchema != schema {
+		t.Errorf("expected json schema %s, got %s", schema, step.JSONSchema)
+	}
+}
+
+func TestStepBuilderWithStop(t *testing.T) {
+	step := llmc.LocalLLMStep("step", "prompt").
+		WithStop("\n\n", "END").
+		Build()
+
+	if len(step.Stop) != 2 || step.Stop[0] != "\n\n" || step.Stop[1] != "END" {
+		t.Errorf("unexpected stop strings %q", step.Stop)
+	}
+}
+
 func TestStepBuilderWithCondition(t *testing.T) {
 	step := llmc.ShellStep("step", "echo 'test'").
 		WithCondition("{{mode}} == 'prod'").